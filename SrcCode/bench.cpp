@@ -0,0 +1,940 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <map>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fiber.h"
+#include "iomanager.h"
+#include "log.h"
+#include "log_binary.h"
+#include "log_ratelimit.h"
+#include "log_static_format.h"
+#include "scheduler.h"
+#include "timer.h"
+
+// 日志系统的性能测试
+// 用法: ./bench [--json 文件名]
+// 结果打印到标准输出，指定--json时另外写一份JSON，便于在版本之间比较：
+//     {"results": [{"name": "...", "iters": 100, "ns_per_op": 1.5}, {"name": "...", "p50_ns": 80, ...}]}
+
+// 阻止编译器把日志等级的判断提到循环外面，保证每次迭代都真实地走一遍宏
+#define BENCH_CLOBBER() asm volatile("" ::: "memory")
+
+// 强制把被测的lambda内联进循环，否则测到的主要是函数调用的开销
+#define BENCH_INLINE __attribute__((always_inline))
+
+// 只格式化不输出，用来单独衡量日志本身的开销
+class NullAppender : public LogAppender
+{
+public:
+    virtual void log(const LogEvent::ptr& event) override
+    {
+        LogStream ss;
+        format(ss, event);
+        m_bytes.fetch_add(ss.size(), std::memory_order_relaxed);
+    }
+
+    size_t getBytes() const { return m_bytes.load(std::memory_order_relaxed); }
+private:
+    std::atomic<size_t> m_bytes{0};
+};
+
+// 只计数不格式化，用于多线程测试中核对日志条数
+class CountAppender : public LogAppender
+{
+public:
+    virtual void log(const LogEvent::ptr& event) override
+    {
+        m_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t getCount() const { return m_count.load(std::memory_order_relaxed); }
+private:
+    std::atomic<uint64_t> m_count{0};
+};
+
+// 一项测试结果，metrics为 指标名->数值
+struct BenchResult
+{
+    std::string name;
+    std::vector<std::pair<std::string, double>> metrics;
+};
+
+static std::vector<BenchResult> s_results;
+
+static void Record(const std::string& name, std::vector<std::pair<std::string, double>> metrics)
+{
+    s_results.push_back(BenchResult{name, std::move(metrics)});
+}
+
+static void AppendJsonString(std::string& out, const std::string& str)
+{
+    out.push_back('"');
+    for (char c : str)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out.push_back('\\');
+            out.push_back(c);
+        }
+        else if ((unsigned char)c < 0x20)
+        {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out.append(buf);
+        }
+        else
+        {
+            out.push_back(c);
+        }
+    }
+    out.push_back('"');
+}
+
+static bool WriteJson(const char* path)
+{
+    std::string out = "{\n  \"results\": [\n";
+    for (size_t i = 0; i < s_results.size(); ++i)
+    {
+        out.append("    {\"name\": ");
+        AppendJsonString(out, s_results[i].name);
+        for (auto& it : s_results[i].metrics)
+        {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "%.3f", it.second);
+            out.append(", ");
+            AppendJsonString(out, it.first);
+            out.append(": ");
+            out.append(buf);
+        }
+        out.append(i + 1 < s_results.size() ? "},\n" : "}\n");
+    }
+    out.append("  ]\n}\n");
+
+    FILE* fp = fopen(path, "w");
+    if (!fp)
+    {
+        return false;
+    }
+    bool ok = fwrite(out.data(), 1, out.size(), fp) == out.size();
+    return fclose(fp) == 0 && ok;
+}
+
+// 有序样本的分位数
+static double Percentile(const std::vector<uint64_t>& sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    size_t idx = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return (double)sorted[idx];
+}
+
+// 运行期间把标准输出重定向到/dev/null，用于测StdoutLogAppender
+class StdoutSilencer
+{
+public:
+    StdoutSilencer()
+    {
+        fflush(stdout);
+        m_saved = dup(STDOUT_FILENO);
+        int fd = open("/dev/null", O_WRONLY);
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+    }
+    ~StdoutSilencer()
+    {
+        std::cout.flush();
+        fflush(stdout);
+        dup2(m_saved, STDOUT_FILENO);
+        close(m_saved);
+    }
+private:
+    int m_saved;
+};
+
+static uint64_t NowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void Report(const char* name, size_t iters, double ns)
+{
+    printf("%-40s %12zu iters %10.2f ns/op\n", name, iters, ns);
+    Record(name, {{"iters", (double)iters}, {"ns_per_op", ns}});
+}
+
+// 执行func共iters次，返回平均每次的纳秒数
+template<class F>
+static double MeasureBench(size_t iters, F func)
+{
+    // 预热，让缓存和分支预测进入稳定状态
+    for (size_t i = 0; i < iters / 10; ++i)
+    {
+        func(i);
+        BENCH_CLOBBER();
+    }
+
+    uint64_t begin = NowNs();
+    for (size_t i = 0; i < iters; ++i)
+    {
+        func(i);
+        BENCH_CLOBBER();
+    }
+    uint64_t end = NowNs();
+
+    return (double)(end - begin) / iters;
+}
+
+// 执行func共iters次，打印并返回平均每次的纳秒数
+template<class F>
+static double RunBench(const char* name, size_t iters, F func)
+{
+    double ns = MeasureBench(iters, func);
+    Report(name, iters, ns);
+    return ns;
+}
+
+int main(int argc, char** argv)
+{
+    const char* json_path = nullptr;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+        {
+            json_path = argv[++i];
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--json file]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    Logger::ptr lg(new Logger("bench", LogLevel::INFO));
+    std::shared_ptr<NullAppender> null_appender(new NullAppender);
+    lg->addAppender(null_appender);
+
+    // 被过滤掉的日志应该只有一次分支的开销
+    RunBench("disabled LOG_LEVEL_CPP", 100000000, [&](size_t i) BENCH_INLINE {
+        LOG_LEVEL_CPP(lg, LogLevel::DEBUG) << "value=" << i << " name=" << lg->getName();
+    });
+    RunBench("disabled LOG_LEVEL_C", 100000000, [&](size_t i) BENCH_INLINE {
+        LOG_LEVEL_C(lg, LogLevel::DEBUG, "value=" << i << " name=" << lg->getName());
+    });
+
+    // 作为对照，真正输出的日志
+    RunBench("enabled LOG_LEVEL_CPP (null appender)", 1000000, [&](size_t i) {
+        LOG_LEVEL_CPP(lg, LogLevel::INFO) << "value=" << i << " name=" << lg->getName();
+    });
+
+    // 打开运行统计后的开销，顺便打印统计结果
+    {
+        Logger::ptr stats_lg(new Logger("bench_stats", LogLevel::INFO));
+        stats_lg->addAppender(LogAppender::ptr(new NullAppender));
+        Manager::getSingletion()->setStatsEnabled(true);
+        RunBench("enabled LOG_LEVEL_CPP (stats on)", 1000000, [&](size_t i) {
+            LOG_LEVEL_CPP(stats_lg, LogLevel::INFO) << "value=" << i << " name=" << stats_lg->getName();
+        });
+        Manager::getSingletion()->setStatsEnabled(false);
+        printf("%s", LogStats::ToText({stats_lg->getStats().snapshot(stats_lg->getName())}).c_str());
+    }
+
+    // 限流：被拦下的日志只有调用点状态上的一两次原子操作
+    RunBench("LOG_EVERY_N suppressed (n=1000000)", 10000000, [&](size_t i) BENCH_INLINE {
+        LOG_EVERY_N(lg, LogLevel::INFO, 1000000) << "value=" << i << " name=" << lg->getName();
+    });
+    RunBench("LOG_EVERY_MS suppressed (1s)", 10000000, [&](size_t i) BENCH_INLINE {
+        LOG_EVERY_MS(lg, LogLevel::INFO, 1000) << "value=" << i << " name=" << lg->getName();
+    });
+    RunBench("LOG_RATE_LIMIT suppressed (10/s)", 10000000, [&](size_t i) BENCH_INLINE {
+        LOG_RATE_LIMIT(lg, LogLevel::INFO, 10, 1) << "value=" << i << " name=" << lg->getName();
+    });
+
+    // 运行期解析的格式器与编译期解析的格式器对比
+    LogEvent::ptr event(new LogEvent(LogLevel::INFO, __FILE__, __LINE__, 0, 1234, 1, time(0), "bench"));
+    event->getSs() << "formatter benchmark message";
+    LogFormatter::ptr runtime_fmt(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"));
+    LogFormatter::ptr static_fmt(new StaticLogFormatter<"%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T[%c]%T%f:%l%T%m%n">);
+    size_t bytes = 0;
+    RunBench("LogFormatter::format (runtime)", 1000000, [&](size_t) {
+        bytes += runtime_fmt->format(event).size();
+    });
+    RunBench("StaticLogFormatter::format", 1000000, [&](size_t) {
+        bytes += static_fmt->format(event).size();
+    });
+    std::string out;
+    RunBench("StaticLogFormatter::formatTo string", 1000000, [&](size_t) {
+        out.clear();
+        StaticLogFormatter<"%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T[%c]%T%f:%l%T%m%n">::formatTo(out, *event);
+        bytes += out.size();
+    });
+    RunBench("LogFormatter::format LogStream (runtime)", 1000000, [&](size_t) {
+        LogStream ss;
+        runtime_fmt->format(ss, event);
+        bytes += ss.size();
+    });
+    RunBench("StaticLogFormatter::format LogStream", 1000000, [&](size_t) {
+        LogStream ss;
+        static_fmt->format(ss, event);
+        bytes += ss.size();
+    });
+
+    // 每个格式项单独的开销，格式为"%X"的运行期格式器
+    for (const char* item : {"m", "p", "r", "c", "t", "N", "F", "n", "T", "f", "l", "d"})
+    {
+        char pattern[8];
+        char name[64];
+        snprintf(pattern, sizeof(pattern), "%%%s", item);
+        snprintf(name, sizeof(name), "LogFormatter item %s", pattern);
+        LogFormatter::ptr fmt(new LogFormatter(pattern));
+        RunBench(name, 1000000, [&](size_t) {
+            LogStream ss;
+            fmt->format(ss, event);
+            bytes += ss.size();
+        });
+    }
+
+    // 标准输出，输出重定向到/dev/null
+    {
+        Logger::ptr stdout_lg(new Logger("bench_stdout", LogLevel::INFO));
+        stdout_lg->addAppender(LogAppender::ptr(new StdoutLogAppender));
+        double ns;
+        {
+            StdoutSilencer silencer;
+            ns = MeasureBench(1000000, [&](size_t i) {
+                LOG_LEVEL_CPP(stdout_lg, LogLevel::INFO) << "stdout appender test line " << i;
+            });
+        }
+        Report("StdoutLogAppender LOG_LEVEL_CPP", 1000000, ns);
+    }
+
+    // 文件输出的吞吐，日志写到/tmp下的临时文件
+    {
+        const char* path = "/tmp/zy_bench_file_appender.log";
+        unlink(path);
+        Logger::ptr file_lg(new Logger("bench_file", LogLevel::INFO));
+        FileAppender::ptr file(new FileAppender(path));
+        file->setFormatter(LogFormatter::ptr(new StaticLogFormatter<"%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T[%c]%T%f:%l%T%m%n">));
+        file_lg->addAppender(file);
+        size_t iters = 1000000;
+        uint64_t begin = NowNs();
+        double ns = RunBench("FileAppender LOG_LEVEL_CPP", iters, [&](size_t i) {
+            LOG_LEVEL_CPP(file_lg, LogLevel::INFO) << "file appender throughput test line " << i;
+        });
+        file_lg->flush();
+        struct stat st;
+        stat(path, &st);
+        double sec = (double)(NowNs() - begin) / 1e9;
+        printf("%-40s %10.2f MB/s  %zu writes for %zu lines (%.0f ns/line)\n", "FileAppender throughput",
+               st.st_size / sec / 1024 / 1024, (size_t)file->getWriteCount(), iters + iters / 10, ns);
+        Record("FileAppender throughput", {{"mb_per_sec", st.st_size / sec / 1024 / 1024},
+                                           {"writes", (double)file->getWriteCount()}});
+        unlink(path);
+    }
+
+    // 内存映射文件输出
+    {
+        const char* path = "/tmp/zy_bench_mmap_appender.log";
+        unlink(path);
+        Logger::ptr mmap_lg(new Logger("bench_mmap", LogLevel::INFO));
+        MmapFileAppender::ptr file(new MmapFileAppender(path));
+        file->setFormatter(LogFormatter::ptr(new StaticLogFormatter<"%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T[%c]%T%f:%l%T%m%n">));
+        mmap_lg->addAppender(file);
+        RunBench("MmapFileAppender LOG_LEVEL_CPP", 1000000, [&](size_t i) {
+            LOG_LEVEL_CPP(mmap_lg, LogLevel::INFO) << "mmap appender throughput test line " << i;
+        });
+        mmap_lg.reset();
+        file.reset();
+        unlink(path);
+    }
+
+    // 二进制日志：只拷贝参数的原始字节，格式化留给离线工具
+    {
+        const char* path = "/tmp/zy_bench_binary.blog";
+        BinaryLog::Open(path);
+        std::string user = "alice";
+        RunBench("LOG_BINARY 3 args", 10000000, [&](size_t i) {
+            LOG_BINARY(lg, LogLevel::INFO, "binary throughput test line {} user {} ratio {}", i, user, 0.5);
+        });
+        BinaryLog::Close();
+        struct stat st;
+        stat(path, &st);
+        printf("%-40s %10.2f MB written, %llu dropped\n", "LOG_BINARY file size",
+               st.st_size / 1024.0 / 1024.0, (unsigned long long)BinaryLog::GetDropped());
+        Record("LOG_BINARY file size", {{"mb", st.st_size / 1024.0 / 1024.0},
+                                        {"dropped", (double)BinaryLog::GetDropped()}});
+        unlink(path);
+    }
+
+    // 延迟格式化：同步时与流式写法做同样的工作，异步时业务线程只编码参数
+    {
+        std::string user = "alice";
+        RunBench("LOG_LEVEL_CPP 3 args (sync)", 1000000, [&](size_t i) {
+            LOG_LEVEL_CPP(lg, LogLevel::INFO) << "lazy format test line " << i << " user " << user << " ratio " << 0.5;
+        });
+        RunBench("LOG_INFO lazy 3 args (sync)", 1000000, [&](size_t i) {
+            LOG_INFO(lg, "lazy format test line {} user {} ratio {}", i, user, 0.5);
+        });
+        Logger::ptr async_lg(new Logger("bench_lazy", LogLevel::INFO));
+        async_lg->addAppender(LogAppender::ptr(new NullAppender));
+        // 队列满时丢弃，只衡量业务线程自己的开销
+        async_lg->setAsync(1 << 20, AsyncLogBackend::DROP_NEWEST, AsyncLogBackend::PER_THREAD);
+        RunBench("LOG_LEVEL_CPP 3 args (async caller)", 1000000, [&](size_t i) {
+            LOG_LEVEL_CPP(async_lg, LogLevel::INFO) << "lazy format test line " << i << " user " << user << " ratio " << 0.5;
+        });
+        async_lg->flush();
+        RunBench("LOG_INFO lazy 3 args (async caller)", 1000000, [&](size_t i) {
+            LOG_INFO(async_lg, "lazy format test line {} user {} ratio {}", i, user, 0.5);
+        });
+        async_lg->flush();
+    }
+
+    // 按名字查找日志器：哈希表查找与调用点缓存
+    {
+        char name[64];
+        for (int i = 0; i < 300; ++i)
+        {
+            snprintf(name, sizeof(name), "bench.module%d.sub", i);
+            Manager::getSingletion()->getLogger(name);
+        }
+        std::string target = "bench.module150.sub";
+        auto mgr = Manager::getSingletion();
+        RunBench("LogManager::getLogger (300 loggers)", 10000000, [&](size_t) {
+            bytes += mgr->getLogger(target)->getName().size();
+        });
+        RunBench("LOG_NAME cached lookup", 100000000, [&](size_t) {
+            bytes += LOG_NAME("bench.module150.sub")->getName().size();
+        });
+    }
+
+    // 结果不对的测试项个数，运行时的正确性检查在test里，这里只确认测出来的数字有意义
+    size_t failures = 0;
+
+    // 协程：resume加Yield是一来一回两次切换，结果按单次切换折算
+    {
+        Fiber::ptr fiber(new Fiber([]() {
+            while (true)
+            {
+                Fiber::Yield();
+            }
+        }));
+        const size_t iters = 10000000;
+        double ns = MeasureBench(iters, [&](size_t) {
+            fiber->resume();
+        });
+        Report("Fiber context switch", iters * 2, ns / 2);
+
+        RunBench("Fiber create+run+destroy (pooled stack)", 1000000, [&](size_t) {
+            Fiber::ptr tmp(new Fiber([]() {}));
+            tmp->resume();
+        });
+    }
+
+    // 调度器：外部线程提交的扇出，和任务内部递归产生子任务(走本地队列和窃取)
+    // 时间包括stop等待所有任务执行完
+    for (size_t threads : {1, 4})
+    {
+        for (int nested = 0; nested < 2; ++nested)
+        {
+            const size_t total = 1000000;
+            std::atomic<uint64_t> done(0);
+            Scheduler::ptr sc(new Scheduler(threads, "bench_sc"));
+            sc->start();
+            // 每个任务产生两个子任务，直到凑够total个
+            std::function<void(size_t)> spawn = [&](size_t n) {
+                done.fetch_add(1, std::memory_order_relaxed);
+                size_t left = (n - 1) / 2, right = n - 1 - left;
+                if (right > 0)
+                {
+                    sc->schedule([&spawn, right]() { spawn(right); });
+                }
+                if (left > 0)
+                {
+                    sc->schedule([&spawn, left]() { spawn(left); });
+                }
+            };
+            uint64_t begin = NowNs();
+            if (nested)
+            {
+                sc->schedule([&]() { spawn(total); });
+            }
+            else
+            {
+                for (size_t i = 0; i < total; ++i)
+                {
+                    sc->schedule([&]() { done.fetch_add(1, std::memory_order_relaxed); });
+                }
+            }
+            sc->stop();
+            double sec = (double)(NowNs() - begin) / 1e9;
+            uint64_t steals = 0, parks = 0;
+            for (auto& it : sc->getStats())
+            {
+                steals += it.steals;
+                parks += it.parks;
+            }
+            char name[64];
+            snprintf(name, sizeof(name), "scheduler %s x%zu", nested ? "nested spawn" : "external fan-out", threads);
+            printf("%-40s %12llu tasks %10.0f tasks/s  steals %llu  parks %llu\n", name,
+                   (unsigned long long)done.load(), done.load() / sec, (unsigned long long)steals,
+                   (unsigned long long)parks);
+            Record(name, {{"threads", (double)threads}, {"tasks", (double)done.load()},
+                          {"tasks_per_sec", done.load() / sec}, {"steals", (double)steals}, {"parks", (double)parks}});
+            if (done.load() != total)
+            {
+                ++failures;
+            }
+        }
+    }
+
+    // IO调度器：本地回环上的echo服务，服务端每个连接一个协程，客户端是普通的阻塞线程
+    // 每个连接 connect、发64字节、收齐回显、关闭，延迟按整个连接计算
+    // 第二轮启用hook，服务端按阻塞的写法直接调用accept/read/write，由hook挂起协程
+    for (int hooked = 0; hooked < 2; ++hooked)
+    {
+        const char* name = hooked ? "IOManager echo x2 hooked" : "IOManager echo x2 (loopback)";
+        IOManager::ptr iom(new IOManager(2, "bench_io"));
+        iom->setHookEnable(hooked);
+        iom->start();
+
+        int lfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | (hooked ? 0 : SOCK_NONBLOCK), 0);
+        int on = 1;
+        setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t addr_len = sizeof(addr);
+        if (bind(lfd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(lfd, 1024) != 0
+            || getsockname(lfd, (sockaddr*)&addr, &addr_len) != 0)
+        {
+            printf("echo server listen failed: %s\n", strerror(errno));
+            ++failures;
+        }
+
+        auto serve = [](int fd) {
+            char buf[4096];
+            while (true)
+            {
+                ssize_t n = read(fd, buf, sizeof(buf));
+                if (n < 0 && errno == EAGAIN)
+                {
+                    IOManager::GetThis()->wait(fd, IOManager::READ);
+                    continue;
+                }
+                if (n <= 0)
+                {
+                    break;
+                }
+                for (ssize_t off = 0; off < n; )
+                {
+                    ssize_t w = write(fd, buf + off, n - off);
+                    if (w > 0)
+                    {
+                        off += w;
+                    }
+                    else if (w < 0 && errno == EAGAIN)
+                    {
+                        IOManager::GetThis()->wait(fd, IOManager::WRITE);
+                    }
+                    else
+                    {
+                        n = -1;
+                        break;
+                    }
+                }
+                if (n < 0)
+                {
+                    break;
+                }
+            }
+            close(fd);
+        };
+        auto serve_blocking = [](int fd) {
+            char buf[4096];
+            ssize_t n;
+            while ((n = read(fd, buf, sizeof(buf))) > 0)
+            {
+                ssize_t off = 0, w = 0;
+                while (off < n && (w = write(fd, buf + off, n - off)) > 0)
+                {
+                    off += w;
+                }
+                if (w <= 0)
+                {
+                    break;
+                }
+            }
+            close(fd);
+        };
+        std::atomic<bool> closing(false), accept_done(false);
+        iom->schedule([&]() {
+            while (hooked && !closing.load())
+            {
+                int fd = accept(lfd, nullptr, nullptr);
+                if (fd >= 0)
+                {
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                    IOManager::GetThis()->schedule([serve_blocking, fd]() { serve_blocking(fd); });
+                }
+            }
+            while (!hooked && !closing.load())
+            {
+                int fd = accept4(lfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd >= 0)
+                {
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                    IOManager::GetThis()->schedule([serve, fd]() { serve(fd); });
+                }
+                else if (errno == EAGAIN)
+                {
+                    IOManager::GetThis()->wait(lfd, IOManager::READ);
+                }
+            }
+            accept_done.store(true);
+        });
+
+        const size_t clients = 4, per_client = 5000;
+        std::vector<std::vector<uint64_t>> lat(clients);
+        std::atomic<uint64_t> failed(0);
+        std::vector<std::thread> workers;
+        uint64_t begin = NowNs();
+        for (size_t c = 0; c < clients; ++c)
+        {
+            workers.emplace_back([&, c]() {
+                char req[64], resp[64];
+                memset(req, 'e', sizeof(req));
+                // 用RST关闭，避免两万个TIME_WAIT占满本地端口
+                linger lg = { 1, 0 };
+                for (size_t i = 0; i < per_client; ++i)
+                {
+                    uint64_t t0 = NowNs();
+                    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                    setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+                    size_t got = 0;
+                    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0 && write(fd, req, sizeof(req)) == sizeof(req))
+                    {
+                        ssize_t n;
+                        while (got < sizeof(resp) && (n = read(fd, resp + got, sizeof(resp) - got)) > 0)
+                        {
+                            got += n;
+                        }
+                    }
+                    close(fd);
+                    if (got != sizeof(resp))
+                    {
+                        failed.fetch_add(1);
+                    }
+                    lat[c].push_back(NowNs() - t0);
+                }
+            });
+        }
+        for (auto& it : workers)
+        {
+            it.join();
+        }
+        double sec = (double)(NowNs() - begin) / 1e9;
+
+        // 关闭监听fd叫醒在上面等待的协程，再次accept时拿到EBADF，看到退出标志后结束
+        closing.store(true);
+        close(lfd);
+        while (!accept_done.load())
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        iom->stop();
+
+        std::vector<uint64_t> all;
+        for (auto& it : lat)
+        {
+            all.insert(all.end(), it.begin(), it.end());
+        }
+        std::sort(all.begin(), all.end());
+        double p50 = Percentile(all, 0.50), p99 = Percentile(all, 0.99);
+        printf("%-40s %12zu conns %10.0f conns/s  p50 %6.0f us  p99 %6.0f us  failed %llu\n",
+               name, all.size(), all.size() / sec, p50 / 1000, p99 / 1000, (unsigned long long)failed.load());
+        Record(name, {{"conns", (double)all.size()}, {"conns_per_sec", all.size() / sec},
+                      {"p50_ns", p50}, {"p99_ns", p99}, {"failed", (double)failed.load()}});
+        if (failed.load() != 0)
+        {
+            ++failures;
+        }
+    }
+
+    // 定时器：1000万个活跃定时器(1ms到10分钟随机)，测插入、取消其中十分之一、全部到期的单次开销
+    // 对照组是以(到期时刻, 序号)为键的std::map(红黑树)，取消时按键删除
+    {
+        const size_t total = 10000000;
+        const uint64_t span = 600000;
+        std::vector<uint32_t> delays(total);
+        std::mt19937_64 rng(12345);
+        for (auto& it : delays)
+        {
+            it = 1 + rng() % span;
+        }
+        std::atomic<uint64_t> fired(0);
+        auto report = [&](const char* name, size_t iters, uint64_t ns) {
+            Report(name, iters, (double)ns / iters);
+        };
+        // glibc把释放的小块先留在fastbin里，下一次分配大块内存时才合并，合并要把它们逐个从内存里读一遍
+        // 两边到期时都释放了900万个对象，计时结束前分配一次大块内存，把推迟的合并算在各自的到期上，
+        // 否则谁在计时区间里碰巧分配了大块内存谁就替对方付了这笔开销
+        auto settle = []() {
+            void* p = malloc(64 << 10);
+            asm volatile("" :: "r"(p) : "memory");
+            free(p);
+        };
+
+        {
+            TimerManager tm;
+            std::vector<Timer::ptr> handles;
+            handles.reserve(total / 10);
+            uint64_t base = TimerManager::NowMs();
+            uint64_t begin = NowNs();
+            for (size_t i = 0; i < total; ++i)
+            {
+                Timer::ptr timer = tm.addTimer(delays[i], [&fired]() { fired.fetch_add(1, std::memory_order_relaxed); });
+                if (i % 10 == 0)
+                {
+                    handles.push_back(std::move(timer));
+                }
+            }
+            report("timer wheel insert (10M active)", total, NowNs() - begin);
+
+            begin = NowNs();
+            for (auto& it : handles)
+            {
+                it->cancel();
+            }
+            report("timer wheel cancel (10M active)", handles.size(), NowNs() - begin);
+            handles.clear();
+
+            size_t expired = 0;
+            std::vector<std::function<void()>> cbs;
+            begin = NowNs();
+            for (uint64_t t = base; tm.hasTimer(); t += 100)
+            {
+                cbs.clear();
+                tm.listExpiredUntil(cbs, t);
+                expired += cbs.size();
+            }
+            settle();
+            report("timer wheel expire (10M active)", expired, NowNs() - begin);
+            if (expired != total - total / 10 || tm.getTimerCount() != 0)
+            {
+                printf("timer wheel expired %zu, expected %zu\n", expired, total - total / 10);
+                ++failures;
+            }
+        }
+
+        {
+            // 键直接放在节点里，比比较时再解引用的写法少一次缓存缺失
+            std::map<std::pair<uint64_t, uint64_t>, std::function<void()>> timers;
+            std::vector<std::pair<uint64_t, uint64_t>> handles;
+            handles.reserve(total / 10);
+            uint64_t base = TimerManager::NowMs();
+            uint64_t begin = NowNs();
+            for (size_t i = 0; i < total; ++i)
+            {
+                std::pair<uint64_t, uint64_t> key(TimerManager::NowMs() + delays[i], i);
+                timers.emplace(key, [&fired]() { fired.fetch_add(1, std::memory_order_relaxed); });
+                if (i % 10 == 0)
+                {
+                    handles.push_back(key);
+                }
+            }
+            report("std::map timers insert (10M active)", total, NowNs() - begin);
+
+            begin = NowNs();
+            for (auto& it : handles)
+            {
+                timers.erase(it);
+            }
+            report("std::map timers cancel (10M active)", handles.size(), NowNs() - begin);
+
+            size_t expired = 0;
+            std::vector<std::function<void()>> cbs;
+            begin = NowNs();
+            for (uint64_t t = base; !timers.empty(); t += 100)
+            {
+                cbs.clear();
+                while (!timers.empty() && timers.begin()->first.first <= t)
+                {
+                    cbs.push_back(std::move(timers.begin()->second));
+                    timers.erase(timers.begin());
+                }
+                expired += cbs.size();
+            }
+            settle();
+            report("std::map timers expire (10M active)", expired, NowNs() - begin);
+        }
+    }
+
+    // 多线程压力测试：写日志的同时不停地增删输出地、修改格式和等级
+    // 常驻的计数输出地必须恰好收到全部日志
+    bool stress_ok = true;
+    {
+        const size_t threads = 8;
+        const size_t per_thread = 100000;
+        Logger::ptr stress_lg(new Logger("bench_stress", LogLevel::INFO));
+        std::shared_ptr<CountAppender> counter(new CountAppender);
+        stress_lg->addAppender(counter);
+
+        std::atomic<bool> stop{false};
+        std::thread config([&]() {
+            size_t round = 0;
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                LogAppender::ptr extra(new NullAppender);
+                stress_lg->addAppender(extra);
+                if (round % 16 == 0)
+                {
+                    stress_lg->setFormat(LogFormatter::ptr(new LogFormatter("%d%T%p%T%m%n")));
+                }
+                stress_lg->setLevel(round % 2 ? LogLevel::DEBUG : LogLevel::INFO);
+                stress_lg->delAppender(extra);
+                ++round;
+                std::this_thread::yield();
+            }
+        });
+
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([&, t]() {
+                for (size_t i = 0; i < per_thread; ++i)
+                {
+                    LOG_LEVEL_CPP(stress_lg, LogLevel::INFO) << "stress thread " << t << " line " << i;
+                }
+            });
+        }
+        for (auto& it : workers)
+        {
+            it.join();
+        }
+        stop.store(true);
+        config.join();
+
+        stress_ok = counter->getCount() == threads * per_thread;
+        printf("%-40s %s (%llu of %zu lines)\n", "multi-thread stress", stress_ok ? "PASS" : "FAIL",
+               (unsigned long long)counter->getCount(), threads * per_thread);
+        Record("multi-thread stress", {{"pass", stress_ok ? 1.0 : 0.0}, {"lines", (double)counter->getCount()}});
+    }
+
+    // 异步模式下调用方一次写日志的延迟分布(入队的耗时，包括队列满时的等待)
+    // 每个线程只记录自己的样本，最后合并排序求分位数
+    const char* async_modes[] = { "async shared queue", "async per-thread" };
+    for (int mode = 0; mode < 2; ++mode)
+    {
+        for (size_t threads : {1, 4})
+        {
+            const size_t per_thread = 200000;
+            Logger::ptr lat_lg(new Logger("bench_latency", LogLevel::INFO));
+            lat_lg->addAppender(LogAppender::ptr(new NullAppender));
+            lat_lg->setAsync(mode == 0 ? 8192 : 1024, AsyncLogBackend::BLOCK,
+                             mode == 0 ? AsyncLogBackend::SHARED_QUEUE : AsyncLogBackend::PER_THREAD);
+            std::vector<std::vector<uint64_t>> samples(threads);
+            std::vector<std::thread> workers;
+            for (size_t t = 0; t < threads; ++t)
+            {
+                workers.emplace_back([&, t]() {
+                    std::vector<uint64_t>& out = samples[t];
+                    out.reserve(per_thread);
+                    for (size_t i = 0; i < per_thread; ++i)
+                    {
+                        uint64_t begin = Clock::Now();
+                        LOG_LEVEL_CPP(lat_lg, LogLevel::INFO) << "latency test line " << i;
+                        out.push_back(Clock::ToNanoseconds(Clock::Now()) - Clock::ToNanoseconds(begin));
+                    }
+                });
+            }
+            for (auto& it : workers)
+            {
+                it.join();
+            }
+            lat_lg->flush();
+
+            std::vector<uint64_t> all;
+            for (auto& it : samples)
+            {
+                all.insert(all.end(), it.begin(), it.end());
+            }
+            std::sort(all.begin(), all.end());
+            double p50 = Percentile(all, 0.50), p99 = Percentile(all, 0.99), p999 = Percentile(all, 0.999);
+            char name[64];
+            snprintf(name, sizeof(name), "%s latency x%zu", async_modes[mode], threads);
+            printf("%-40s p50 %8.0f ns  p99 %8.0f ns  p999 %8.0f ns  max %8.0f ns\n",
+                   name, p50, p99, p999, (double)all.back());
+            Record(name, {{"samples", (double)all.size()}, {"p50_ns", p50}, {"p99_ns", p99},
+                          {"p999_ns", p999}, {"max_ns", (double)all.back()}});
+        }
+    }
+
+    // 多线程吞吐：所有线程写同一个日志器，输出地只做格式化
+    // 分别测同步输出、共享队列的异步后台、每线程队列的异步后台，时间包括等待后台写完
+    const char* modes[] = { "sync", "async shared queue", "async per-thread" };
+    for (int mode = 0; mode < 3; ++mode)
+    {
+        for (size_t threads : {1, 4, 16, 64})
+        {
+            const size_t total = 1000000;
+            Logger::ptr mt_lg(new Logger("bench_mt", LogLevel::INFO));
+            mt_lg->addAppender(LogAppender::ptr(new NullAppender));
+            if (mode == 1)
+            {
+                mt_lg->setAsync(8192, AsyncLogBackend::BLOCK, AsyncLogBackend::SHARED_QUEUE);
+            }
+            else if (mode == 2)
+            {
+                mt_lg->setAsync(1024, AsyncLogBackend::BLOCK, AsyncLogBackend::PER_THREAD);
+            }
+            std::vector<std::thread> workers;
+            uint64_t begin = NowNs();
+            for (size_t t = 0; t < threads; ++t)
+            {
+                workers.emplace_back([&]() {
+                    for (size_t i = 0; i < total / threads; ++i)
+                    {
+                        LOG_LEVEL_CPP(mt_lg, LogLevel::INFO) << "multi-thread throughput line " << i;
+                    }
+                });
+            }
+            for (auto& it : workers)
+            {
+                it.join();
+            }
+            mt_lg->flush();
+            double sec = (double)(NowNs() - begin) / 1e9;
+            char name[64];
+            snprintf(name, sizeof(name), "%s x%zu", modes[mode], threads);
+            printf("%-40s %12zu lines %10.0f lines/s\n", name, total / threads * threads, total / threads * threads / sec);
+            Record(name, {{"threads", (double)threads}, {"lines", (double)(total / threads * threads)},
+                          {"lines_per_sec", total / threads * threads / sec}});
+        }
+    }
+
+    if (json_path && !WriteJson(json_path))
+    {
+        fprintf(stderr, "write %s failed\n", json_path);
+        return 1;
+    }
+    return bytes == 0 || failures != 0 || !stress_ok;
+}
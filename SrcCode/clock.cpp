@@ -0,0 +1,128 @@
+#include "clock.h"
+
+#include <mutex>
+
+#if ZY_CLOCK_HAS_TSC
+#include <cpuid.h>
+#endif
+
+// 启动时刻，运行时长和频率都以它为起点
+struct ClockStart
+{
+    ClockStart() : ticks(Clock::Now()), mono_ns(Clock::MonotonicNs()) {}
+
+    uint64_t ticks;
+    uint64_t mono_ns;
+};
+
+static const ClockStart& Start()
+{
+    static const ClockStart s_start;
+    return s_start;
+}
+
+// 在静态初始化阶段记下启动时刻，只读两次时钟，不等待
+static const ClockStart& s_startup = Start();
+
+// 频率至少要用这么长的基线计算，第一次换算发生在刚启动时最多等这么久
+static const uint64_t MIN_BASELINE_NS = 20000;
+// 锚点有效期的范围，启动初期频率误差较大，锚点取得勤一些
+static const uint64_t MIN_EXPIRE_NS = 1000000;
+static const uint64_t MAX_EXPIRE_NS = 1000000000;
+
+// 是否有不随频率和休眠变化的TSC
+bool Clock::DetectTsc()
+{
+#if ZY_CLOCK_HAS_TSC
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+    {
+        return false;
+    }
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx & (1u << 8)) != 0;
+#else
+    return false;
+#endif
+}
+
+void Clock::Recalibrate()
+{
+    static std::mutex s_mutex;
+    std::unique_lock<std::mutex> lock(s_mutex, std::try_to_lock);
+    if (!lock.owns_lock())
+    {
+        // 已经有锚点时用旧的也可以，第一次必须等别的线程取完
+        if (s_anchor.mult.load(std::memory_order_acquire))
+        {
+            return;
+        }
+        lock.lock();
+    }
+
+    // 计数夹在两次单调时钟之间读，取两次的中点减小误差
+    const ClockStart& start = Start();
+    uint64_t mono0;
+    uint64_t mono1;
+    uint64_t ticks;
+    do
+    {
+        mono0 = MonotonicNs();
+        ticks = Now();
+        mono1 = MonotonicNs();
+    } while (mono0 - start.mono_ns < MIN_BASELINE_NS && UseTsc());
+    uint64_t real = RealtimeNs();
+    uint64_t mono = mono0 + (mono1 - mono0) / 2;
+    uint64_t old_mult = s_anchor.mult.load(std::memory_order_relaxed);
+    if (old_mult && ticks < s_anchor.expire_ticks.load(std::memory_order_relaxed))
+    {
+        // 别的线程刚取过
+        return;
+    }
+
+    uint64_t elapsed = mono - start.mono_ns;
+    double ns_per_tick = 1.0;
+    if (UseTsc() && ticks > start.ticks)
+    {
+        ns_per_tick = (double)elapsed / (double)(ticks - start.ticks);
+    }
+    uint64_t mult = (uint64_t)(ns_per_tick * 4294967296.0);
+    if (old_mult)
+    {
+        // 新频率比旧的小时按单调时钟算出的运行时长可能比按旧锚点外推的还小，取较大的保证不倒退
+        int64_t prev = (int64_t)s_anchor.elapsed_ns.load(std::memory_order_relaxed)
+                     + Scale(ticks - s_anchor.ticks.load(std::memory_order_relaxed), old_mult);
+        if (prev > (int64_t)elapsed)
+        {
+            elapsed = prev;
+        }
+    }
+    uint64_t expire_ns = mono - start.mono_ns;
+    expire_ns = expire_ns < MIN_EXPIRE_NS ? MIN_EXPIRE_NS : expire_ns > MAX_EXPIRE_NS ? MAX_EXPIRE_NS : expire_ns;
+
+    uint64_t seq = s_anchor.seq.load(std::memory_order_relaxed);
+    s_anchor.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s_anchor.ticks.store(ticks, std::memory_order_relaxed);
+    s_anchor.real_ns.store(real, std::memory_order_relaxed);
+    s_anchor.elapsed_ns.store(elapsed, std::memory_order_relaxed);
+    s_anchor.mult.store(mult, std::memory_order_relaxed);
+    s_anchor.seq.store(seq + 2, std::memory_order_release);
+    // 有效期最后发布，其他线程看到新的有效期之前顶多多调用一次Recalibrate
+    s_anchor.expire_ticks.store(ticks + (uint64_t)(expire_ns / ns_per_tick), std::memory_order_relaxed);
+}
+
+Clock::Calibration Clock::Get()
+{
+    Anchor a;
+    Load(Now(), a);
+    Calibration c;
+    c.use_tsc = UseTsc();
+    c.base_ticks = a.ticks;
+    c.base_real_ns = a.real_ns;
+    c.base_elapsed_ns = a.elapsed_ns;
+    c.mult = a.mult;
+    c.ns_per_tick = a.mult / 4294967296.0;
+    c.generation = a.seq / 2;
+    return c;
+}
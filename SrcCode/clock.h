@@ -0,0 +1,165 @@
+#ifndef __ZY_CLOCK_H__
+#define __ZY_CLOCK_H__
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define ZY_CLOCK_HAS_TSC 1
+#else
+#define ZY_CLOCK_HAS_TSC 0
+#endif
+
+// 日志用的高精度时钟
+// 写日志的线程只读一次计数器(rdtsc)，换算成墙上时间和运行时长的工作推迟到格式化时，
+// 异步模式下由后台线程完成
+// CPU不支持恒定频率的TSC时，计数器退化为CLOCK_MONOTONIC的纳秒数
+//
+// 静态初始化时只记下启动时刻的计数和CLOCK_MONOTONIC，不做耗时的校准
+// 换算按最近一次取的锚点(计数, 墙上时间, 运行时长, 频率)进行，换算的计数超过锚点的有效期时重新取锚点：
+//     频率用启动以来的计数差和CLOCK_MONOTONIC差计算，运行得越久越准；
+//     墙上时间重新读CLOCK_REALTIME，NTP或settimeofday对系统时间的调整最多一个周期后反映到日志上
+// 有效期从1ms开始随运行时长增加，最长1秒；锚点用顺序锁发布，换算时只读几个原子变量
+class Clock
+{
+public:
+    struct Calibration
+    {
+        bool use_tsc;               // 计数器是否为TSC，否则为CLOCK_MONOTONIC的纳秒数
+        uint64_t base_ticks;        // 锚点的计数
+        uint64_t base_real_ns;      // 锚点的CLOCK_REALTIME
+        uint64_t base_elapsed_ns;   // 锚点距离启动时刻的纳秒数
+        double ns_per_tick;         // 每个计数对应的纳秒数
+        uint64_t mult;              // ns_per_tick的32位定点表示，换算时避免浮点运算
+        uint64_t generation;        // 锚点的版本，每取一次锚点加一
+    };
+
+    // 当前计数，只能用于和本进程内其他计数比较或换算
+    static uint64_t Now()
+    {
+#if ZY_CLOCK_HAS_TSC
+        if (UseTsc())
+        {
+            return __rdtsc();
+        }
+#endif
+        return MonotonicNs();
+    }
+
+    // 启动时刻到计数所在时刻的纳秒数，不会倒退
+    static uint64_t ToNanoseconds(uint64_t ticks)
+    {
+        Anchor a;
+        Load(ticks, a);
+        int64_t ns = (int64_t)a.elapsed_ns + Scale(ticks - a.ticks, a.mult);
+        return ns > 0 ? ns : 0;
+    }
+
+    // 两个计数之间的纳秒数
+    static uint64_t ElapsedNs(uint64_t begin, uint64_t end)
+    {
+        if (end <= begin)
+        {
+            return 0;
+        }
+        uint64_t mult = s_anchor.mult.load(std::memory_order_relaxed);
+        if (!mult)
+        {
+            Recalibrate();
+            mult = s_anchor.mult.load(std::memory_order_relaxed);
+        }
+        return (uint64_t)(((unsigned __int128)(end - begin) * mult) >> 32);
+    }
+
+    // 计数对应的墙上时间(纳秒)，早于锚点的计数按当前锚点往回推
+    static uint64_t ToWallNanoseconds(uint64_t ticks)
+    {
+        Anchor a;
+        Load(ticks, a);
+        return a.real_ns + Scale(ticks - a.ticks, a.mult);
+    }
+
+    // 程序启动到计数所在时刻的毫秒数
+    static uint32_t ToElapsedMs(uint64_t ticks) { return (uint32_t)(ToNanoseconds(ticks) / 1000000); }
+
+    static bool IsTsc() { return UseTsc(); }
+
+    // 当前的锚点，已经过期时先重新取
+    static Calibration Get();
+
+    static uint64_t MonotonicNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    static uint64_t RealtimeNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+private:
+    struct Anchor
+    {
+        uint64_t ticks;
+        uint64_t real_ns;
+        uint64_t elapsed_ns;
+        uint64_t mult;
+        uint64_t seq;
+    };
+
+    // 顺序锁保护的锚点，seq为奇数时正在更新；静态存储初始为0，表示还没有取过锚点
+    struct SharedAnchor
+    {
+        std::atomic<uint64_t> seq;
+        std::atomic<uint64_t> ticks;
+        std::atomic<uint64_t> real_ns;
+        std::atomic<uint64_t> elapsed_ns;
+        std::atomic<uint64_t> mult;
+        std::atomic<uint64_t> expire_ticks;            // 锚点的有效期，换算到这之后的计数时重新取锚点
+    };
+
+    static bool UseTsc()
+    {
+        static const bool s_use_tsc = DetectTsc();
+        return s_use_tsc;
+    }
+    static bool DetectTsc();
+
+    // 有符号的计数差换算成纳秒，早于锚点的计数得到负数
+    static int64_t Scale(uint64_t delta, uint64_t mult)
+    {
+        return (int64_t)(((__int128)(int64_t)delta * mult) >> 32);
+    }
+
+    static void Load(uint64_t ticks, Anchor& a)
+    {
+        if (ticks >= s_anchor.expire_ticks.load(std::memory_order_relaxed))
+        {
+            Recalibrate();
+        }
+        uint64_t seq;
+        do
+        {
+            seq = s_anchor.seq.load(std::memory_order_acquire);
+            a.ticks = s_anchor.ticks.load(std::memory_order_relaxed);
+            a.real_ns = s_anchor.real_ns.load(std::memory_order_relaxed);
+            a.elapsed_ns = s_anchor.elapsed_ns.load(std::memory_order_relaxed);
+            a.mult = s_anchor.mult.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((seq & 1) || seq != s_anchor.seq.load(std::memory_order_relaxed));
+        a.seq = seq;
+    }
+
+    // 重新取锚点，别的线程正在取时直接返回(第一次除外)
+    static void Recalibrate();
+
+    static inline SharedAnchor s_anchor;
+};
+
+#endif
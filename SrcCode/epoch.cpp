@@ -0,0 +1,154 @@
+#include "epoch.h"
+
+#include <mutex>
+#include <vector>
+
+// 每个线程一条记录，线程退出后留给后来的线程复用，从不释放
+struct EpochRecord
+{
+    std::atomic<uint64_t> epoch{0};                    // 进入区间时的全局epoch，0表示不在区间内
+    std::atomic<bool> used{false};
+    EpochRecord* next = nullptr;
+};
+
+struct EpochDomain
+{
+    std::atomic<uint64_t> global{1};
+    std::atomic<EpochRecord*> records{nullptr};
+
+    std::mutex mutex;
+    std::vector<std::pair<uint64_t, std::function<void()>>> retired;  // (退休时的epoch, 释放函数)
+};
+
+// 进程退出时也不析构，其他静态对象的析构函数里仍可能退休对象
+static EpochDomain& Domain()
+{
+    static EpochDomain* s_domain = new EpochDomain;
+    return *s_domain;
+}
+
+static EpochRecord* AcquireRecord()
+{
+    EpochDomain& d = Domain();
+    for (EpochRecord* it = d.records.load(std::memory_order_acquire); it; it = it->next)
+    {
+        bool expected = false;
+        if (!it->used.load(std::memory_order_relaxed)
+            && it->used.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+        {
+            return it;
+        }
+    }
+    EpochRecord* rec = new EpochRecord;
+    rec->used.store(true, std::memory_order_relaxed);
+    EpochRecord* head = d.records.load(std::memory_order_relaxed);
+    do
+    {
+        rec->next = head;
+    } while (!d.records.compare_exchange_weak(head, rec, std::memory_order_release, std::memory_order_relaxed));
+    return rec;
+}
+
+struct ThreadEpoch
+{
+    EpochRecord* rec = nullptr;
+    uint32_t depth = 0;
+
+    ~ThreadEpoch()
+    {
+        if (rec)
+        {
+            rec->epoch.store(0, std::memory_order_release);
+            rec->used.store(false, std::memory_order_release);
+            rec = nullptr;
+        }
+    }
+};
+
+static thread_local ThreadEpoch t_epoch;
+
+EpochGuard::EpochGuard()
+{
+    ThreadEpoch& te = t_epoch;
+    if (te.depth++ != 0)
+    {
+        return;
+    }
+    if (!te.rec)
+    {
+        te.rec = AcquireRecord();
+    }
+    // 和Reclaim中扫描记录之前的屏障配对：要么回收者看到这条记录，要么这里之后读到的指针已经是新对象
+    te.rec->epoch.store(Domain().global.load(std::memory_order_seq_cst), std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+EpochGuard::~EpochGuard()
+{
+    ThreadEpoch& te = t_epoch;
+    if (--te.depth == 0)
+    {
+        te.rec->epoch.store(0, std::memory_order_release);
+    }
+}
+
+void EpochReclaimer::Retire(std::function<void()> deleter)
+{
+    EpochDomain& d = Domain();
+    {
+        std::lock_guard<std::mutex> lock(d.mutex);
+        // 之后进入区间的读者记录的epoch比它大，一定看不到这个对象
+        uint64_t epoch = d.global.fetch_add(1, std::memory_order_seq_cst);
+        d.retired.emplace_back(epoch, std::move(deleter));
+    }
+    Reclaim();
+}
+
+void EpochReclaimer::Reclaim()
+{
+    EpochDomain& d = Domain();
+    std::vector<std::function<void()>> ready;
+    {
+        std::lock_guard<std::mutex> lock(d.mutex);
+        if (d.retired.empty())
+        {
+            return;
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t min = ~0ULL;
+        for (EpochRecord* it = d.records.load(std::memory_order_acquire); it; it = it->next)
+        {
+            uint64_t e = it->epoch.load(std::memory_order_seq_cst);
+            if (e != 0 && e < min)
+            {
+                min = e;
+            }
+        }
+        // 区间内记录的epoch不大于退休时的epoch，说明它可能在退休之前就拿到了对象
+        size_t keep = 0;
+        for (auto& it : d.retired)
+        {
+            if (it.first < min)
+            {
+                ready.push_back(std::move(it.second));
+            }
+            else
+            {
+                d.retired[keep++] = std::move(it);
+            }
+        }
+        d.retired.resize(keep);
+    }
+    // 释放函数可能析构输出地等对象，放在锁外执行，其中还可以再退休对象
+    for (auto& it : ready)
+    {
+        it();
+    }
+}
+
+size_t EpochReclaimer::GetPending()
+{
+    EpochDomain& d = Domain();
+    std::lock_guard<std::mutex> lock(d.mutex);
+    return d.retired.size();
+}
@@ -0,0 +1,57 @@
+#ifndef __ZY_EPOCH_H__
+#define __ZY_EPOCH_H__
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+// 基于epoch的延迟回收
+// 读者不加锁地访问一个原子指针指向的对象，写者换上新对象之后不能马上释放旧的，
+// 因为可能还有读者在用。读者用EpochGuard标出访问的区间，写者把旧对象交给Retire，
+// 等所有在Retire之前进入区间的读者都离开之后再释放
+//
+// 读者进入区间只写自己线程的记录(一次原子交换)，没有共享的计数，不会在缓存行上竞争
+// 区间可以嵌套，只有最外层会写记录
+// 回收在Retire和Reclaim中进行，释放函数在锁外调用
+//
+// 用法：
+//     {
+//         EpochGuard guard;
+//         Config* cfg = g_config.load(std::memory_order_acquire);
+//         ... 使用cfg ...
+//     }
+//     Config* old = g_config.exchange(fresh);
+//     EpochReclaimer::Retire(old);
+class EpochGuard
+{
+public:
+    EpochGuard();
+    ~EpochGuard();
+
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+};
+
+class EpochReclaimer
+{
+public:
+    // 对象已经不可能被新的读者看到，之后调用deleter释放
+    static void Retire(std::function<void()> deleter);
+
+    template<class T>
+    static void Retire(T* ptr)
+    {
+        if (ptr)
+        {
+            Retire([ptr]() { delete ptr; });
+        }
+    }
+
+    // 释放所有已经没有读者的对象
+    static void Reclaim();
+
+    // 还没有释放的对象数
+    static size_t GetPending();
+};
+
+#endif
@@ -0,0 +1,160 @@
+#include "fd_manager.h"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "hook.h"
+
+void FdCtx::init(int fd)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_flags.load(std::memory_order_relaxed) & (INIT | CLOSING))
+    {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        // fd无效，不记录，下次用到时再检查
+        return;
+    }
+    uint32_t flags = INIT;
+    if (S_ISSOCK(st.st_mode))
+    {
+        flags |= SOCKET;
+        // 已经是非阻塞的socket说明是用户自己设置的，hook的函数不挂起
+        int fl = fcntl_f(fd, F_GETFL, 0);
+        if (fl & O_NONBLOCK)
+        {
+            flags |= USER_NONBLOCK;
+        }
+        else if (fcntl_f(fd, F_SETFL, fl | O_NONBLOCK) == 0)
+        {
+            flags |= SYS_NONBLOCK;
+        }
+
+        // 初始化之前设置的超时也要算数
+        int types[] = { SO_RCVTIMEO, SO_SNDTIMEO };
+        for (int type : types)
+        {
+            timeval tv;
+            socklen_t len = sizeof(tv);
+            if (getsockopt(fd, SOL_SOCKET, type, &tv, &len) == 0 && (tv.tv_sec || tv.tv_usec))
+            {
+                setTimeout(type, tv.tv_sec * 1000ULL + (tv.tv_usec + 999) / 1000);
+            }
+        }
+    }
+    m_flags.store(flags, std::memory_order_release);
+}
+
+void FdCtx::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // 和attach配对，见那里的说明
+    m_flags.store(CLOSING, std::memory_order_seq_cst);
+    m_recvTimeout.store(NO_TIMEOUT, std::memory_order_relaxed);
+    m_sendTimeout.store(NO_TIMEOUT, std::memory_order_relaxed);
+}
+
+void FdCtx::closed()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_flags.fetch_and(~(uint32_t)CLOSING, std::memory_order_release);
+}
+
+void FdCtx::setUserNonblock(bool v)
+{
+    if (v)
+    {
+        m_flags.fetch_or(USER_NONBLOCK, std::memory_order_acq_rel);
+    }
+    else
+    {
+        m_flags.fetch_and(~(uint32_t)USER_NONBLOCK, std::memory_order_acq_rel);
+    }
+}
+
+uint64_t FdCtx::getTimeout(int type) const
+{
+    return (type == SO_RCVTIMEO ? m_recvTimeout : m_sendTimeout).load(std::memory_order_relaxed);
+}
+
+void FdCtx::setTimeout(int type, uint64_t ms)
+{
+    // 内核里0表示不超时
+    (type == SO_RCVTIMEO ? m_recvTimeout : m_sendTimeout).store(ms ? ms : NO_TIMEOUT, std::memory_order_relaxed);
+}
+
+bool FdCtx::attach(IOManager* iom)
+{
+    m_iomanager.store(iom, std::memory_order_seq_cst);
+    // close先清除状态再取走调度器：要么这里看到状态已经清除，要么close看到这里记下的调度器
+    if (!(m_flags.load(std::memory_order_seq_cst) & INIT))
+    {
+        detach(iom);
+        return false;
+    }
+    return true;
+}
+
+IOManager* FdCtx::detach()
+{
+    return m_iomanager.exchange(nullptr, std::memory_order_seq_cst);
+}
+
+void FdCtx::detach(IOManager* iom)
+{
+    m_iomanager.compare_exchange_strong(iom, nullptr, std::memory_order_seq_cst);
+}
+
+FdCtx* FdManager::get(int fd, bool create)
+{
+    if (fd < 0 || (size_t)fd >= (size_t)MAX_CHUNKS * CHUNK_SIZE)
+    {
+        return nullptr;
+    }
+    std::atomic<FdCtx*>& slot = m_chunks[fd >> CHUNK_BITS];
+    FdCtx* chunk = slot.load(std::memory_order_acquire);
+    if (!chunk)
+    {
+        if (!create)
+        {
+            return nullptr;
+        }
+        FdCtx* fresh = new FdCtx[CHUNK_SIZE];
+        if (slot.compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel))
+        {
+            chunk = fresh;
+        }
+        else
+        {
+            delete[] fresh;
+        }
+    }
+    FdCtx* ctx = &chunk[fd & (CHUNK_SIZE - 1)];
+    if (create && !ctx->isInit())
+    {
+        ctx->init(fd);
+    }
+    return ctx;
+}
+
+void FdManager::del(int fd)
+{
+    FdCtx* ctx = get(fd, false);
+    if (ctx && ctx->isInit())
+    {
+        ctx->clear();
+    }
+}
+
+void FdManager::closed(int fd)
+{
+    FdCtx* ctx = get(fd, false);
+    if (ctx)
+    {
+        ctx->closed();
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef __ZY_FD_MANAGER_H__
+#define __ZY_FD_MANAGER_H__
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include "singleton.h"
+
+class IOManager;
+
+// hook层记录的fd状态
+// 第一次被hook的函数用到或者在IO调度器上登记事件时初始化：检查是否是socket，是阻塞的socket时由框架设置成非阻塞，
+// 并记下用户自己设置的非阻塞标志和SO_RCVTIMEO/SO_SNDTIMEO，hook的函数据此决定是否挂起协程、挂起多久
+class FdCtx
+{
+friend class FdManager;
+public:
+    static constexpr uint64_t NO_TIMEOUT = ~0ULL;
+
+    bool isInit() const { return m_flags.load(std::memory_order_acquire) & INIT; }
+    bool isSocket() const { return m_flags.load(std::memory_order_acquire) & SOCKET; }
+    // 框架为了挂起协程而设置的非阻塞
+    bool getSysNonblock() const { return m_flags.load(std::memory_order_acquire) & SYS_NONBLOCK; }
+    // 用户自己要求的非阻塞，此时hook的函数直接返回EAGAIN，不挂起
+    bool getUserNonblock() const { return m_flags.load(std::memory_order_acquire) & USER_NONBLOCK; }
+    // 用户通过fcntl/ioctl修改非阻塞标志时调用，内核里的fd保持非阻塞
+    void setUserNonblock(bool v);
+
+    // type为SO_RCVTIMEO或SO_SNDTIMEO，单位毫秒，没有设置时为NO_TIMEOUT
+    uint64_t getTimeout(int type) const;
+    void setTimeout(int type, uint64_t ms);
+
+    // 在IO调度器上登记事件时记下调度器，hook的close从任何线程调用都能唤醒等待的协程
+    // fd正在被关闭(状态已经清除)时返回false，调用者不要再登记
+    bool attach(IOManager* iom);
+    // 清除状态之后取走记下的调度器，由close调用
+    IOManager* detach();
+    // 调度器析构时调用，记下的是它时清空
+    void detach(IOManager* iom);
+
+private:
+    enum
+    {
+        INIT = 0x1,
+        SOCKET = 0x2,
+        SYS_NONBLOCK = 0x4,
+        USER_NONBLOCK = 0x8,
+        CLOSING = 0x10                                 // 正在关闭，关闭完成之前不重新初始化
+    };
+
+    void init(int fd);
+    void clear();
+    void closed();
+
+private:
+    std::mutex m_mutex;                                // 只在初始化和清理时使用
+    std::atomic<uint32_t> m_flags{0};
+    std::atomic<uint64_t> m_recvTimeout{NO_TIMEOUT};
+    std::atomic<uint64_t> m_sendTimeout{NO_TIMEOUT};
+    std::atomic<IOManager*> m_iomanager{nullptr};      // 最近一次登记事件的调度器
+};
+
+// fd状态的管理，和IOManager一样按fd的值存放在分段的数组里，查找不加锁
+// 段在进程退出时也不释放：其他单例析构时关闭fd仍会经过hook的close
+class FdManager
+{
+public:
+    // fd对应的状态，create为真时按需分配并初始化；fd无效或者超出范围时返回空
+    FdCtx* get(int fd, bool create);
+    // fd关闭之前清除它的状态，关闭完成之前不会被重新初始化，之后登记事件都会失败
+    void del(int fd);
+    // fd关闭之后调用，fd的值被重新分配时重新初始化
+    void closed(int fd);
+
+private:
+    enum
+    {
+        CHUNK_BITS = 12,
+        CHUNK_SIZE = 1 << CHUNK_BITS,
+        MAX_CHUNKS = 256
+    };
+
+    std::atomic<FdCtx*> m_chunks[MAX_CHUNKS] = {};
+};
+
+typedef Singletion<FdManager> FdMgr;
+
+#endif
@@ -0,0 +1,309 @@
+#include "fiber.h"
+
+#include <cstring>
+#include <exception>
+#include <new>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "log.h"
+#include "thread.h"
+
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#endif
+
+static std::atomic<uint32_t> s_fiber_id(0);
+static std::atomic<uint64_t> s_fiber_count(0);
+
+static thread_local Fiber* t_fiber = nullptr;          // 当前运行的协程
+static thread_local Fiber::ptr t_main_fiber;           // 线程的主协程
+
+#if ZY_FIBER_ASM
+// 保存当前的被调用者保存寄存器和浮点控制字，栈指针存到*from_sp，再从to_sp恢复另一个协程
+// 栈上的布局(从低到高)：mxcsr/x87控制字、r12、r13、r14、r15、rbx、rbp、返回地址
+extern "C" void zy_fiber_switch(void** from_sp, void* to_sp);
+
+asm(R"(
+    .text
+    .globl zy_fiber_switch
+    .type zy_fiber_switch, @function
+    .p2align 4
+zy_fiber_switch:
+    pushq %rbp
+    pushq %rbx
+    pushq %r15
+    pushq %r14
+    pushq %r13
+    pushq %r12
+    subq $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    addq $8, %rsp
+    popq %r12
+    popq %r13
+    popq %r14
+    popq %r15
+    popq %rbx
+    popq %rbp
+    ret
+    .size zy_fiber_switch, .-zy_fiber_switch
+    .section .note.GNU-stack, "", @progbits
+    .text
+)");
+#endif
+
+// 协程栈的分配和缓存
+// 每个栈下面多映射一页并设为不可访问，作为保护页
+// 默认大小的栈释放后放进线程本地的缓存，线程退出时统一归还给系统
+class FiberStackPool
+{
+public:
+    enum { MAX_CACHED = 64 };
+
+    static size_t PageSize()
+    {
+        static const size_t s_page = sysconf(_SC_PAGESIZE);
+        return s_page;
+    }
+
+    static void* Allocate(size_t size)
+    {
+        if (size == Fiber::DEFAULT_STACK_SIZE && !t_dead)
+        {
+            std::vector<void*>& cache = t_pool.m_cache;
+            if (!cache.empty())
+            {
+                void* stack = cache.back();
+                cache.pop_back();
+                return stack;
+            }
+        }
+
+        size_t page = PageSize();
+        void* base = mmap(nullptr, size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED)
+        {
+            throw std::bad_alloc();
+        }
+        mprotect(base, page, PROT_NONE);
+        return (char*)base + page;
+    }
+
+    static void Release(void* stack, size_t size)
+    {
+        if (size == Fiber::DEFAULT_STACK_SIZE && !t_dead && t_pool.m_cache.size() < MAX_CACHED)
+        {
+            t_pool.m_cache.push_back(stack);
+            return;
+        }
+        Unmap(stack, size);
+    }
+
+    ~FiberStackPool()
+    {
+        t_dead = true;
+        for (void* it : m_cache)
+        {
+            Unmap(it, Fiber::DEFAULT_STACK_SIZE);
+        }
+    }
+
+private:
+    static void Unmap(void* stack, size_t size)
+    {
+        size_t page = PageSize();
+        munmap((char*)stack - page, size + page);
+    }
+
+private:
+    std::vector<void*> m_cache;
+
+    static thread_local FiberStackPool t_pool;
+    static thread_local bool t_dead;                   // 线程退出时缓存已经析构，之后直接归还系统
+};
+
+thread_local FiberStackPool FiberStackPool::t_pool;
+thread_local bool FiberStackPool::t_dead = false;
+
+Fiber::Fiber()
+    : m_id(0)
+{
+    m_state.store(RUNNING, std::memory_order_relaxed);
+#if !ZY_FIBER_ASM
+    getcontext(&m_ctx);
+#endif
+}
+
+Fiber::Fiber(std::function<void()> cb, size_t stack_size)
+    : m_id(++s_fiber_id), m_cb(std::move(cb))
+{
+    size_t page = FiberStackPool::PageSize();
+    m_stackSize = stack_size ? (stack_size + page - 1) / page * page : (size_t)DEFAULT_STACK_SIZE;
+    m_stack = FiberStackPool::Allocate(m_stackSize);
+    initContext();
+    s_fiber_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+Fiber::~Fiber()
+{
+    if (m_stack)
+    {
+        FiberStackPool::Release(m_stack, m_stackSize);
+        s_fiber_count.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+void Fiber::initContext()
+{
+#if defined(__SANITIZE_ADDRESS__)
+    // Main不会返回，上一次运行留在栈上的红区标记不会被清除，复用栈之前手动清掉
+    ASAN_UNPOISON_MEMORY_REGION(m_stack, m_stackSize);
+#endif
+#if ZY_FIBER_ASM
+    // 伪造一次zy_fiber_switch的现场，第一次切换进来时ret到Main
+    // Main像被call进入一样，入口处栈指针模16余8，上面放一个空的返回地址
+    uintptr_t top = ((uintptr_t)m_stack + m_stackSize) & ~(uintptr_t)15;
+    void** sp = (void**)top;
+    *--sp = nullptr;
+    *--sp = (void*)&Fiber::Main;
+    for (int i = 0; i < 6; ++i)
+    {
+        *--sp = nullptr;
+    }
+    uint32_t csr[2] = { 0, 0 };
+    asm volatile("stmxcsr %0" : "=m"(csr[0]));
+    asm volatile("fnstcw %0" : "=m"(csr[1]));
+    *--sp = nullptr;
+    memcpy(sp, csr, sizeof(csr));
+    m_sp = sp;
+#else
+    getcontext(&m_ctx);
+    m_ctx.uc_link = nullptr;
+    m_ctx.uc_stack.ss_sp = m_stack;
+    m_ctx.uc_stack.ss_size = m_stackSize;
+    makecontext(&m_ctx, &Fiber::Main, 0);
+#endif
+}
+
+bool Fiber::reset(std::function<void()> cb)
+{
+    if (!m_stack || (getState() != INIT && !isFinished()))
+    {
+        return false;
+    }
+    m_cb = std::move(cb);
+    initContext();
+    m_state.store(INIT, std::memory_order_release);
+    return true;
+}
+
+bool Fiber::resume()
+{
+    State state = m_state.load(std::memory_order_acquire);
+    do
+    {
+        if (state != INIT && state != READY)
+        {
+            return false;
+        }
+    } while (!m_state.compare_exchange_weak(state, RUNNING, std::memory_order_acquire));
+
+    Fiber* caller = Current();
+    if (!caller)
+    {
+        GetThis();
+        caller = Current();
+    }
+    m_caller = caller;
+    caller->switchTo(this);
+    // 协程已经完全切出，这之后别的线程才能再次resume它
+    m_state.store(m_next, std::memory_order_release);
+    return true;
+}
+
+void Fiber::Yield()
+{
+    Fiber* cur = Current();
+    if (!cur || !cur->m_caller)
+    {
+        // 主协程没有可以切回去的地方
+        return;
+    }
+    Fiber* caller = cur->m_caller;
+    cur->m_caller = nullptr;
+    cur->m_next = READY;
+    cur->switchTo(caller);
+}
+
+void Fiber::switchTo(Fiber* to)
+{
+    SetCurrent(to);
+#if ZY_FIBER_ASM
+    zy_fiber_switch(&m_sp, to->m_sp);
+#else
+    swapcontext(&m_ctx, &to->m_ctx);
+#endif
+}
+
+void Fiber::Main()
+{
+    Fiber* cur = Current();
+    try
+    {
+        cur->m_cb();
+        cur->m_next = TERM;
+    }
+    catch (std::exception& e)
+    {
+        cur->m_next = EXCEPT;
+        LOG_ERROR(LOG_NAME("system"), "fiber {} exception: {}", cur->m_id, e.what());
+    }
+    catch (...)
+    {
+        cur->m_next = EXCEPT;
+        LOG_ERROR(LOG_NAME("system"), "fiber {} unknown exception", cur->m_id);
+    }
+    // 回调捕获的对象在协程里析构
+    cur->m_cb = nullptr;
+
+    // 切回去之后不会再回到这里，所以栈上不能留有需要析构的对象
+    Fiber* caller = cur->m_caller;
+    cur->m_caller = nullptr;
+    cur->switchTo(caller);
+}
+
+Fiber* Fiber::Current()
+{
+    return t_fiber;
+}
+
+void Fiber::SetCurrent(Fiber* fiber)
+{
+    t_fiber = fiber;
+    ThreadInfo::SetFiberId(fiber->m_id);
+}
+
+Fiber::ptr Fiber::GetThis()
+{
+    if (!t_fiber)
+    {
+        t_main_fiber.reset(new Fiber());
+        SetCurrent(t_main_fiber.get());
+    }
+    return t_fiber->shared_from_this();
+}
+
+uint32_t Fiber::GetFiberId()
+{
+    return ThreadInfo::GetFiberId();
+}
+
+uint64_t Fiber::GetFiberCount()
+{
+    return s_fiber_count.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,115 @@
+#ifndef __ZY_FIBER_H__
+#define __ZY_FIBER_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#if defined(__x86_64__) && !defined(ZY_FIBER_UCONTEXT)
+#define ZY_FIBER_ASM 1
+#else
+#define ZY_FIBER_ASM 0
+#include <ucontext.h>
+#endif
+
+// 有栈协程
+// 每个协程有自己的栈，resume切换进去执行，协程内调用Fiber::Yield切回调用resume的地方
+// x86-64上用手写汇编切换上下文，只保存被调用者保存的寄存器和浮点控制字，不进入内核；
+// 其他平台(或者定义了ZY_FIBER_UCONTEXT)退化为ucontext，每次切换多一次sigprocmask系统调用
+//
+// 栈用mmap分配，最低处留一页不可访问的保护页，栈溢出时立即段错误而不是踩坏别的内存
+// 默认大小的栈用完后放进线程本地的缓存，下次创建协程时直接复用
+//
+// 切换时同时更新ThreadInfo中的协程号，日志的%F输出当前协程号，不在协程中时为0
+//
+// 协程让出后可以由其他线程resume(调度器靠这一点在线程之间迁移协程)
+// 协程的状态在切换完全结束、回到resume的调用者之后才发布，
+// 所以别的线程看到READY时，协程的寄存器一定已经保存好了；
+// 协程内的代码不要跨越Yield持有线程局部变量的地址
+//
+// 用法：
+//     Fiber::ptr fiber(new Fiber([]() {
+//         LOG_INFO(logger, "step 1");
+//         Fiber::Yield();
+//         LOG_INFO(logger, "step 2");
+//     }));
+//     fiber->resume();    // 输出step 1后回到这里
+//     fiber->resume();    // 输出step 2，协程结束
+class Fiber : public std::enable_shared_from_this<Fiber>
+{
+public:
+    typedef std::shared_ptr<Fiber> ptr;
+
+    enum State
+    {
+        INIT,                                          // 创建后还没运行过
+        READY,                                         // 让出了执行权，可以再次resume
+        RUNNING,
+        TERM,                                          // 回调正常结束
+        EXCEPT                                         // 回调抛出了异常
+    };
+
+    enum { DEFAULT_STACK_SIZE = 128 * 1024 };
+
+    // stack_size为0时使用默认大小
+    explicit Fiber(std::function<void()> cb, size_t stack_size = 0);
+    ~Fiber();
+
+    Fiber(const Fiber&) = delete;
+    Fiber& operator=(const Fiber&) = delete;
+
+    // 已经结束的协程换一个回调重新使用，保留原来的栈，返回false表示协程还没有结束
+    bool reset(std::function<void()> cb);
+
+    // 从当前协程切换到本协程，直到它Yield或结束才返回
+    // 协程正在运行(包括还没有完全切出)或者已经结束时返回false，多个线程同时resume只有一个成功
+    bool resume();
+
+    uint32_t getId() const { return m_id; }
+    State getState() const { return m_state.load(std::memory_order_acquire); }
+    bool isFinished() const
+    {
+        State state = getState();
+        return state == TERM || state == EXCEPT;
+    }
+
+    // 当前协程让出执行权，回到调用resume的协程
+    static void Yield();
+
+    // 当前正在运行的协程，线程第一次调用时创建代表线程本身的主协程
+    static Fiber::ptr GetThis();
+    // 当前协程号，主协程为0
+    static uint32_t GetFiberId();
+    // 已创建且没有销毁的协程数(不含主协程)
+    static uint64_t GetFiberCount();
+
+private:
+    // 主协程，代表线程原本的栈
+    Fiber();
+
+    static void Main();
+    static Fiber* Current();
+    static void SetCurrent(Fiber* fiber);
+    void initContext();
+    // 从本协程切换到to
+    void switchTo(Fiber* to);
+
+private:
+    uint32_t m_id = 0;
+    std::atomic<State> m_state{INIT};
+    State m_next = READY;                              // 切出后要发布的状态，由resume在切回来之后写入m_state
+    void* m_stack = nullptr;                           // 栈的最低地址(保护页之上)，主协程为空
+    size_t m_stackSize = 0;
+    Fiber* m_caller = nullptr;                         // 调用resume的协程，Yield时切回去
+    std::function<void()> m_cb;
+
+#if ZY_FIBER_ASM
+    void* m_sp = nullptr;                              // 切出时保存的栈指针
+#else
+    ucontext_t m_ctx;
+#endif
+};
+
+#endif
@@ -0,0 +1,478 @@
+#include "hook.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdarg>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include "fd_manager.h"
+#include "iomanager.h"
+
+#define HOOK_FUN(XX) \
+    XX(read) \
+    XX(write) \
+    XX(recv) \
+    XX(send) \
+    XX(connect) \
+    XX(accept) \
+    XX(sleep) \
+    XX(usleep) \
+    XX(nanosleep) \
+    XX(socket) \
+    XX(close) \
+    XX(fcntl) \
+    XX(ioctl) \
+    XX(setsockopt)
+
+extern "C"
+{
+#define XX(name) name ## _fun name ## _f = nullptr;
+    HOOK_FUN(XX)
+#undef XX
+}
+
+static std::once_flag s_hook_once;
+static std::atomic<bool> s_hook_inited(false);
+
+static void HookInit()
+{
+    std::call_once(s_hook_once, []() {
+#define XX(name) name ## _f = (name ## _fun)dlsym(RTLD_NEXT, #name);
+        HOOK_FUN(XX)
+#undef XX
+        s_hook_inited.store(true, std::memory_order_release);
+    });
+}
+
+// 包装函数可能在本文件的静态初始化之前就被调用(其他单例的构造)，每次先确认原函数已经取到
+static inline void EnsureHook()
+{
+    if (__builtin_expect(!s_hook_inited.load(std::memory_order_acquire), 0))
+    {
+        HookInit();
+    }
+}
+
+// 启动时取到所有原函数
+struct HookIniter
+{
+    HookIniter() { HookInit(); }
+};
+static HookIniter s_hook_initer;
+
+// 当前能否挂起协程：线程启用了hook，并且正在IOManager的协程里
+static IOManager* HookedIOManager()
+{
+    if (!t_hook_enable || Fiber::GetFiberId() == 0)
+    {
+        return nullptr;
+    }
+    return IOManager::GetThis();
+}
+
+// errno是线程局部变量，编译器认为__errno_location()的结果不变，会把地址缓存下来跨越函数调用使用
+// 协程让出之后可能在别的线程上继续，可能让出的函数里都通过它读写errno，每次重新取当前线程的地址
+// asm阻止编译器把它推断成const函数后合并调用
+__attribute__((noinline)) static int& Errno()
+{
+    asm volatile("");
+    return errno;
+}
+
+static uint64_t TimevalToMs(const timeval* tv)
+{
+    return tv->tv_sec * 1000ULL + (tv->tv_usec + 999) / 1000;
+}
+
+// 等待fd就绪，最多等到deadline(毫秒，NO_TIMEOUT表示不限时)
+// 能挂起协程时登记到IOManager上让出，否则用poll阻塞当前线程
+// 已经超时返回0；就绪或者被唤醒返回1，可能是虚假唤醒，调用者重试系统调用确认；出错返回-1
+static int WaitReady(IOManager* iom, int fd, IOManager::Event event, uint64_t deadline)
+{
+    uint64_t timeout = FdCtx::NO_TIMEOUT;
+    if (deadline != FdCtx::NO_TIMEOUT)
+    {
+        uint64_t now = TimerManager::NowMs();
+        if (now >= deadline)
+        {
+            return 0;
+        }
+        timeout = deadline - now;
+    }
+
+    // 同一个fd的同一方向已经有协程在等(或者登记失败)时，退化成阻塞线程等待
+    if (!iom || !iom->addEvent(fd, event))
+    {
+        FdCtx* ctx = FdMgr::getSingletion()->get(fd, false);
+        if (iom && ctx && !ctx->isInit())
+        {
+            // fd正在被别的线程关闭，poll不会因为关闭而返回，让调用者重试系统调用拿到EBADF
+            return 1;
+        }
+        pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = event == IOManager::READ ? POLLIN : POLLOUT;
+        pfd.revents = 0;
+        int n = poll(&pfd, 1, timeout == FdCtx::NO_TIMEOUT ? -1 : (int)std::min<uint64_t>(timeout, INT_MAX));
+        return n < 0 && Errno() != EINTR ? -1 : 1;
+    }
+
+    // 超时的时候取消事件把协程唤醒；协程先醒来时定时器随alive一起作废，不会误取消之后登记的事件
+    std::shared_ptr<int> alive = std::make_shared<int>(0);
+    Timer::ptr timer;
+    if (timeout != FdCtx::NO_TIMEOUT)
+    {
+        timer = iom->addConditionTimer(timeout, [iom, fd, event]() {
+            iom->cancelEvent(fd, event);
+        }, alive);
+    }
+    Fiber::Yield();
+    if (timer)
+    {
+        timer->cancel();
+    }
+    return 1;
+}
+
+// 读写类调用的公共流程：先直接调用，内核返回EAGAIN并且fd是框架设置成非阻塞的socket时等待就绪再重试
+// 超过timeout_so指定的超时返回EAGAIN，和阻塞socket的超时一样
+template<typename OriginFun, typename... Args>
+static ssize_t DoIo(int fd, OriginFun fun, IOManager::Event event, int timeout_so, Args... args)
+{
+    EnsureHook();
+    IOManager* iom = HookedIOManager();
+    if (iom)
+    {
+        // 第一次用到时检查fd类型，阻塞的socket改成非阻塞，免得下面的调用阻塞线程
+        FdMgr::getSingletion()->get(fd, true);
+    }
+    ssize_t n = fun(fd, args...);
+    if (n >= 0 || Errno() != EAGAIN)
+    {
+        return n;
+    }
+
+    // 没有启用hook的线程用到框架改成非阻塞的socket时，也要像阻塞socket一样等待
+    FdCtx* ctx = FdMgr::getSingletion()->get(fd, false);
+    if (!ctx || !ctx->isSocket() || ctx->getUserNonblock())
+    {
+        Errno() = EAGAIN;
+        return n;
+    }
+    uint64_t timeout = ctx->getTimeout(timeout_so);
+    uint64_t deadline = timeout == FdCtx::NO_TIMEOUT ? FdCtx::NO_TIMEOUT : TimerManager::NowMs() + timeout;
+    while (n < 0 && Errno() == EAGAIN)
+    {
+        int rt = WaitReady(iom, fd, event, deadline);
+        if (rt == 0)
+        {
+            Errno() = EAGAIN;
+            return -1;
+        }
+        if (rt < 0)
+        {
+            return -1;
+        }
+        n = fun(fd, args...);
+    }
+    return n;
+}
+
+// 用定时器挂起当前协程，不能挂起时返回false，由调用者调用原函数
+static bool SleepMs(uint64_t ms)
+{
+    IOManager* iom = HookedIOManager();
+    if (!iom)
+    {
+        return false;
+    }
+    Fiber::ptr fiber = Fiber::GetThis();
+    iom->addTimer(ms, [iom, fiber]() {
+        iom->schedule(fiber);
+    });
+    Fiber::Yield();
+    return true;
+}
+
+int ConnectWithTimeout(int fd, const struct sockaddr* addr, socklen_t addrlen, uint64_t timeout_ms)
+{
+    EnsureHook();
+    IOManager* iom = HookedIOManager();
+    FdCtx* ctx = FdMgr::getSingletion()->get(fd, iom != nullptr);
+    int n = connect_f(fd, addr, addrlen);
+    if (n == 0 || Errno() != EINPROGRESS || !ctx || !ctx->isSocket() || ctx->getUserNonblock())
+    {
+        return n;
+    }
+
+    uint64_t deadline = timeout_ms == FdCtx::NO_TIMEOUT ? FdCtx::NO_TIMEOUT : TimerManager::NowMs() + timeout_ms;
+    while (true)
+    {
+        // 可写说明连接已经有结果(成功或失败)，被别人取消唤醒时继续等
+        pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 0) > 0)
+        {
+            break;
+        }
+        int rt = WaitReady(iom, fd, IOManager::WRITE, deadline);
+        if (rt == 0)
+        {
+            // 阻塞socket的connect超时时内核也返回EINPROGRESS
+            Errno() = EINPROGRESS;
+            return -1;
+        }
+        if (rt < 0)
+        {
+            return -1;
+        }
+    }
+
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0)
+    {
+        return -1;
+    }
+    if (error != 0)
+    {
+        Errno() = error;
+        return -1;
+    }
+    return 0;
+}
+
+extern "C"
+{
+
+ssize_t read(int fd, void* buf, size_t count)
+{
+    return DoIo(fd, read_f, IOManager::READ, SO_RCVTIMEO, buf, count);
+}
+
+ssize_t write(int fd, const void* buf, size_t count)
+{
+    return DoIo(fd, write_f, IOManager::WRITE, SO_SNDTIMEO, buf, count);
+}
+
+ssize_t recv(int sockfd, void* buf, size_t len, int flags)
+{
+    EnsureHook();
+    if (flags & MSG_DONTWAIT)
+    {
+        return recv_f(sockfd, buf, len, flags);
+    }
+    return DoIo(sockfd, recv_f, IOManager::READ, SO_RCVTIMEO, buf, len, flags);
+}
+
+ssize_t send(int sockfd, const void* buf, size_t len, int flags)
+{
+    EnsureHook();
+    if (flags & MSG_DONTWAIT)
+    {
+        return send_f(sockfd, buf, len, flags);
+    }
+    return DoIo(sockfd, send_f, IOManager::WRITE, SO_SNDTIMEO, buf, len, flags);
+}
+
+int connect(int sockfd, const struct sockaddr* addr, socklen_t addrlen)
+{
+    EnsureHook();
+    // 和内核一样，阻塞socket的connect使用SO_SNDTIMEO作为超时
+    uint64_t timeout = FdCtx::NO_TIMEOUT;
+    FdCtx* ctx = FdMgr::getSingletion()->get(sockfd, t_hook_enable);
+    if (ctx && ctx->isSocket())
+    {
+        timeout = ctx->getTimeout(SO_SNDTIMEO);
+    }
+    return ConnectWithTimeout(sockfd, addr, addrlen, timeout);
+}
+
+int accept(int sockfd, struct sockaddr* addr, socklen_t* addrlen)
+{
+    int fd = (int)DoIo(sockfd, accept_f, IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    if (fd >= 0 && t_hook_enable)
+    {
+        FdMgr::getSingletion()->get(fd, true);
+    }
+    return fd;
+}
+
+unsigned int sleep(unsigned int seconds)
+{
+    EnsureHook();
+    if (SleepMs(seconds * 1000ULL))
+    {
+        return 0;
+    }
+    return sleep_f(seconds);
+}
+
+int usleep(useconds_t usec)
+{
+    EnsureHook();
+    if (SleepMs((usec + 999ULL) / 1000))
+    {
+        return 0;
+    }
+    return usleep_f(usec);
+}
+
+int nanosleep(const struct timespec* req, struct timespec* rem)
+{
+    EnsureHook();
+    // 参数非法时交给原函数返回EINVAL
+    if (req && req->tv_sec >= 0 && req->tv_nsec >= 0 && req->tv_nsec < 1000000000
+        && SleepMs(req->tv_sec * 1000ULL + (req->tv_nsec + 999999) / 1000000))
+    {
+        return 0;
+    }
+    return nanosleep_f(req, rem);
+}
+
+int socket(int domain, int type, int protocol)
+{
+    EnsureHook();
+    int fd = socket_f(domain, type, protocol);
+    if (fd >= 0 && t_hook_enable)
+    {
+        FdMgr::getSingletion()->get(fd, true);
+    }
+    return fd;
+}
+
+int close(int fd)
+{
+    EnsureHook();
+    FdCtx* ctx = FdMgr::getSingletion()->get(fd, false);
+    if (ctx && ctx->isInit())
+    {
+        // 先清除状态，之后登记的事件会失败；再唤醒已经在这个fd上等待的协程，它们重试时会拿到EBADF
+        // 登记事件的调度器记在fd状态里，不要求在它的工作线程上关闭
+        FdMgr::getSingletion()->del(fd);
+        IOManager* iom = ctx->detach();
+        if (iom)
+        {
+            iom->cancelAll(fd);
+        }
+        int rt = close_f(fd);
+        FdMgr::getSingletion()->closed(fd);
+        return rt;
+    }
+    return close_f(fd);
+}
+
+int fcntl(int fd, int cmd, ...)
+{
+    EnsureHook();
+    va_list va;
+    va_start(va, cmd);
+    switch (cmd)
+    {
+    case F_SETFL:
+        {
+            int arg = va_arg(va, int);
+            va_end(va);
+            // 框架管理的socket在内核里始终是非阻塞的，用户的设置只记录下来
+            FdCtx* ctx = FdMgr::getSingletion()->get(fd, false);
+            if (ctx && ctx->isSocket())
+            {
+                ctx->setUserNonblock(arg & O_NONBLOCK);
+                arg |= O_NONBLOCK;
+            }
+            return fcntl_f(fd, cmd, arg);
+        }
+    case F_GETFL:
+        {
+            va_end(va);
+            int arg = fcntl_f(fd, cmd);
+            FdCtx* ctx = FdMgr::getSingletion()->get(fd, false);
+            if (arg >= 0 && ctx && ctx->isSocket())
+            {
+                arg = ctx->getUserNonblock() ? (arg | O_NONBLOCK) : (arg & ~O_NONBLOCK);
+            }
+            return arg;
+        }
+    // 参数是int的命令
+    case F_DUPFD:
+    case F_DUPFD_CLOEXEC:
+    case F_SETFD:
+    case F_SETOWN:
+    case F_SETSIG:
+    case F_SETLEASE:
+    case F_NOTIFY:
+#ifdef F_SETPIPE_SZ
+    case F_SETPIPE_SZ:
+#endif
+        {
+            int arg = va_arg(va, int);
+            va_end(va);
+            return fcntl_f(fd, cmd, arg);
+        }
+    // 没有参数的命令
+    case F_GETFD:
+    case F_GETOWN:
+    case F_GETSIG:
+    case F_GETLEASE:
+#ifdef F_GETPIPE_SZ
+    case F_GETPIPE_SZ:
+#endif
+        va_end(va);
+        return fcntl_f(fd, cmd);
+    // 其余的参数都是指针
+    default:
+        {
+            void* arg = va_arg(va, void*);
+            va_end(va);
+            return fcntl_f(fd, cmd, arg);
+        }
+    }
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+    EnsureHook();
+    va_list va;
+    va_start(va, request);
+    void* arg = va_arg(va, void*);
+    va_end(va);
+
+    if (request == FIONBIO && arg)
+    {
+        FdCtx* ctx = FdMgr::getSingletion()->get(fd, false);
+        if (ctx && ctx->isSocket())
+        {
+            ctx->setUserNonblock(*(int*)arg != 0);
+            int on = 1;
+            return ioctl_f(fd, request, &on);
+        }
+    }
+    return ioctl_f(fd, request, arg);
+}
+
+int setsockopt(int sockfd, int level, int optname, const void* optval, socklen_t optlen)
+{
+    EnsureHook();
+    int rt = setsockopt_f(sockfd, level, optname, optval, optlen);
+    if (rt == 0 && level == SOL_SOCKET && (optname == SO_RCVTIMEO || optname == SO_SNDTIMEO)
+        && optval && optlen >= sizeof(timeval))
+    {
+        // 还没有初始化的fd在初始化时会从内核读取
+        FdCtx* ctx = FdMgr::getSingletion()->get(sockfd, false);
+        if (ctx && ctx->isInit())
+        {
+            ctx->setTimeout(optname, TimevalToMs((const timeval*)optval));
+        }
+    }
+    return rt;
+}
+
+}
@@ -0,0 +1,82 @@
+#ifndef __ZY_HOOK_H__
+#define __ZY_HOOK_H__
+
+#include <cstdint>
+#include <ctime>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// 系统调用hook
+// 链接hook.cpp之后，下面这些函数被替换成同名的包装，原函数通过dlsym(RTLD_NEXT)取得：
+//     read write recv send connect accept sleep usleep nanosleep
+// 以及为了维护fd状态需要的 socket close fcntl ioctl setsockopt
+// 只有在启用了hook的线程上、并且正在IOManager的协程里时，包装才会改变行为：
+//     socket上的读写在内核返回EAGAIN时把fd登记到IOManager上并挂起协程，就绪后重试，
+//     按fd的SO_RCVTIMEO/SO_SNDTIMEO用定时器限时，超时和内核一样返回EAGAIN(connect返回EINPROGRESS)；
+//     sleep类的函数用定时器挂起协程，不占用工作线程
+// 其他情况直接调用原函数，代价是一次线程局部变量的判断
+// 用户自己设置成非阻塞的socket不会被挂起，照常返回EAGAIN
+//
+// IOManager::setHookEnable(true)之后，它的工作线程在开始调度之前启用hook
+// 持有锁或者正在写日志时不能让出协程，用HookDisabler临时关闭当前线程的hook
+
+// 当前线程是否启用hook，放在头文件里，不链接hook.cpp的程序(例如只用日志)也能使用HookDisabler
+inline thread_local bool t_hook_enable = false;
+
+inline bool IsHookEnable() { return t_hook_enable; }
+inline void SetHookEnable(bool v) { t_hook_enable = v; }
+
+// 作用域内关闭当前线程的hook，离开时恢复原来的状态
+class HookDisabler
+{
+public:
+    HookDisabler() : m_old(t_hook_enable) { t_hook_enable = false; }
+    ~HookDisabler() { t_hook_enable = m_old; }
+
+    HookDisabler(const HookDisabler&) = delete;
+    HookDisabler& operator=(const HookDisabler&) = delete;
+private:
+    bool m_old;
+};
+
+extern "C"
+{
+
+// 被替换的原函数
+typedef ssize_t (*read_fun)(int fd, void* buf, size_t count);
+typedef ssize_t (*write_fun)(int fd, const void* buf, size_t count);
+typedef ssize_t (*recv_fun)(int sockfd, void* buf, size_t len, int flags);
+typedef ssize_t (*send_fun)(int sockfd, const void* buf, size_t len, int flags);
+typedef int (*connect_fun)(int sockfd, const struct sockaddr* addr, socklen_t addrlen);
+typedef int (*accept_fun)(int sockfd, struct sockaddr* addr, socklen_t* addrlen);
+typedef unsigned int (*sleep_fun)(unsigned int seconds);
+typedef int (*usleep_fun)(useconds_t usec);
+typedef int (*nanosleep_fun)(const struct timespec* req, struct timespec* rem);
+typedef int (*socket_fun)(int domain, int type, int protocol);
+typedef int (*close_fun)(int fd);
+typedef int (*fcntl_fun)(int fd, int cmd, ...);
+typedef int (*ioctl_fun)(int fd, unsigned long request, ...);
+typedef int (*setsockopt_fun)(int sockfd, int level, int optname, const void* optval, socklen_t optlen);
+
+extern read_fun read_f;
+extern write_fun write_f;
+extern recv_fun recv_f;
+extern send_fun send_f;
+extern connect_fun connect_f;
+extern accept_fun accept_f;
+extern sleep_fun sleep_f;
+extern usleep_fun usleep_f;
+extern nanosleep_fun nanosleep_f;
+extern socket_fun socket_f;
+extern close_fun close_f;
+extern fcntl_fun fcntl_f;
+extern ioctl_fun ioctl_f;
+extern setsockopt_fun setsockopt_f;
+
+}
+
+// 限时的connect，timeout_ms为~0时不限时；hook的connect用fd的SO_SNDTIMEO调用它
+int ConnectWithTimeout(int fd, const struct sockaddr* addr, socklen_t addrlen, uint64_t timeout_ms);
+
+#endif
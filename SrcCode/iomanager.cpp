@@ -0,0 +1,358 @@
+#include "iomanager.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "fd_manager.h"
+#include "hook.h"
+#include "log.h"
+
+IOManager::IOManager(size_t threads, const std::string& name)
+    : Scheduler(threads, name)
+{
+    m_epfd = epoll_create1(EPOLL_CLOEXEC);
+    m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_epfd < 0 || m_eventfd < 0)
+    {
+        LOG_ERROR(LOG_NAME("root"), "iomanager {} create epoll/eventfd failed: {}", name, strerror(errno));
+        return;
+    }
+    // eventfd的data.ptr为空，以此和fd上下文区分
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = nullptr;
+    if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_eventfd, &ev) != 0)
+    {
+        LOG_ERROR(LOG_NAME("root"), "iomanager {} add eventfd failed: {}", name, strerror(errno));
+    }
+}
+
+IOManager::~IOManager()
+{
+    // 工作线程还会调用idle和tickle，必须在本类的成员销毁之前停下来
+    stop();
+    if (m_epfd >= 0)
+    {
+        close(m_epfd);
+    }
+    if (m_eventfd >= 0)
+    {
+        close(m_eventfd);
+    }
+    for (int i = 0; i < MAX_CHUNKS; ++i)
+    {
+        FdContext* chunk = m_chunks[i].load(std::memory_order_relaxed);
+        if (!chunk)
+        {
+            continue;
+        }
+        // 登记过的fd之后由hook的close关闭时还会找记下的调度器，不能留下指向自己的指针
+        for (int j = 0; j < CHUNK_SIZE; ++j)
+        {
+            FdCtx* fdctx = FdMgr::getSingletion()->get(chunk[j].fd, false);
+            if (fdctx)
+            {
+                fdctx->detach(this);
+            }
+        }
+        delete[] chunk;
+    }
+}
+
+IOManager::FdContext* IOManager::getContext(int fd, bool create)
+{
+    if (fd < 0 || (size_t)fd >= (size_t)MAX_CHUNKS * CHUNK_SIZE)
+    {
+        return nullptr;
+    }
+    std::atomic<FdContext*>& slot = m_chunks[fd >> CHUNK_BITS];
+    FdContext* chunk = slot.load(std::memory_order_acquire);
+    if (!chunk)
+    {
+        if (!create)
+        {
+            return nullptr;
+        }
+        FdContext* fresh = new FdContext[CHUNK_SIZE];
+        for (int i = 0; i < CHUNK_SIZE; ++i)
+        {
+            fresh[i].fd = ((fd >> CHUNK_BITS) << CHUNK_BITS) + i;
+        }
+        // 多个线程同时分配同一段时只留一份
+        if (slot.compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel))
+        {
+            chunk = fresh;
+        }
+        else
+        {
+            delete[] fresh;
+        }
+    }
+    return &chunk[fd & (CHUNK_SIZE - 1)];
+}
+
+bool IOManager::updateEpoll(FdContext* ctx, uint32_t events)
+{
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLET | events;
+    ev.data.ptr = ctx;
+
+    int op = events == NONE ? EPOLL_CTL_DEL : (ctx->events == NONE ? EPOLL_CTL_ADD : EPOLL_CTL_MOD);
+    int rt = epoll_ctl(m_epfd, op, ctx->fd, &ev);
+    if (rt != 0 && op == EPOLL_CTL_MOD && errno == ENOENT)
+    {
+        // fd被关闭后内核已经把它从epoll中删掉了，当作新fd重新添加
+        op = EPOLL_CTL_ADD;
+        rt = epoll_ctl(m_epfd, op, ctx->fd, &ev);
+    }
+    if (rt != 0 && !(op == EPOLL_CTL_DEL && (errno == ENOENT || errno == EBADF)))
+    {
+        LOG_ERROR(LOG_NAME("root"), "epoll_ctl({}, {}, {}, {}) failed: {}",
+                  m_epfd, op, ctx->fd, ev.events, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool IOManager::addEvent(int fd, Event event, std::function<void()> cb)
+{
+    // hook的close靠fd状态里记下的调度器唤醒等待者，没有初始化过的fd在这里初始化
+    FdCtx* fdctx = FdMgr::getSingletion()->get(fd, true);
+    FdContext* ctx = getContext(fd, true);
+    if (!ctx)
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(ctx->mutex);
+    if (ctx->events & event)
+    {
+        LOG_ERROR(LOG_NAME("root"), "addEvent fd={} event={} already registered", fd, (uint32_t)event);
+        return false;
+    }
+    // 在锁内记下，close取消事件时也要拿这把锁：要么close看到这次登记并唤醒，要么这里看到fd已经在关闭
+    if (fdctx && !fdctx->attach(this))
+    {
+        return false;
+    }
+
+    EventContext& ec = ctx->get(event);
+    if (cb)
+    {
+        ec.cb = std::move(cb);
+    }
+    else
+    {
+        if (Fiber::GetFiberId() == 0)
+        {
+            return false;
+        }
+        ec.fiber = Fiber::GetThis();
+    }
+    if (!updateEpoll(ctx, ctx->events | event))
+    {
+        ec.cb = nullptr;
+        ec.fiber.reset();
+        return false;
+    }
+    ctx->events |= event;
+    m_pendingEvents.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void IOManager::trigger(FdContext* ctx, Event event)
+{
+    EventContext& ec = ctx->get(event);
+    ctx->events &= ~event;
+    if (ec.cb)
+    {
+        schedule(std::move(ec.cb));
+        ec.cb = nullptr;
+    }
+    else if (ec.fiber)
+    {
+        schedule(std::move(ec.fiber));
+        ec.fiber.reset();
+    }
+    // 先提交再减少计数，stopping看到计数归零时一定也能看到提交的任务
+    m_pendingEvents.fetch_sub(1, std::memory_order_seq_cst);
+}
+
+bool IOManager::removeEvent(int fd, Event event, bool fire)
+{
+    FdContext* ctx = getContext(fd, false);
+    if (!ctx)
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(ctx->mutex);
+    if (!(ctx->events & event))
+    {
+        return false;
+    }
+    updateEpoll(ctx, ctx->events & ~event);
+    if (fire)
+    {
+        trigger(ctx, event);
+    }
+    else
+    {
+        EventContext& ec = ctx->get(event);
+        ec.cb = nullptr;
+        ec.fiber.reset();
+        ctx->events &= ~event;
+        m_pendingEvents.fetch_sub(1, std::memory_order_seq_cst);
+    }
+    return true;
+}
+
+bool IOManager::delEvent(int fd, Event event)
+{
+    return removeEvent(fd, event, false);
+}
+
+bool IOManager::cancelEvent(int fd, Event event)
+{
+    return removeEvent(fd, event, true);
+}
+
+bool IOManager::cancelAll(int fd)
+{
+    FdContext* ctx = getContext(fd, false);
+    if (!ctx)
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(ctx->mutex);
+    if (ctx->events == NONE)
+    {
+        return false;
+    }
+    updateEpoll(ctx, NONE);
+    if (ctx->events & READ)
+    {
+        trigger(ctx, READ);
+    }
+    if (ctx->events & WRITE)
+    {
+        trigger(ctx, WRITE);
+    }
+    return true;
+}
+
+bool IOManager::wait(int fd, Event event)
+{
+    if (Scheduler::GetThis() != this || Fiber::GetFiberId() == 0)
+    {
+        return false;
+    }
+    if (!addEvent(fd, event))
+    {
+        return false;
+    }
+    Fiber::Yield();
+    return true;
+}
+
+IOManager* IOManager::GetThis()
+{
+    return dynamic_cast<IOManager*>(Scheduler::GetThis());
+}
+
+void IOManager::idle()
+{
+    epoll_event events[MAX_EVENTS];
+
+    // 和Scheduler::idle相同的配对：要么这里看到新任务，要么tickle看到有线程在等待
+    m_polling.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // 有任务时也要看一眼epoll，否则任务不断时IO事件永远得不到处理
+    int timeout = 0;
+    if (!hasWork() && !stopping())
+    {
+        uint64_t next = getNextTimeout();
+        timeout = next == NO_TIMEOUT ? -1 : (int)std::min<uint64_t>(next, INT_MAX);
+    }
+    int n = epoll_wait(m_epfd, events, MAX_EVENTS, timeout);
+    m_polling.fetch_sub(1, std::memory_order_relaxed);
+    if (n < 0 && errno != EINTR)
+    {
+        LOG_ERROR(LOG_NAME("root"), "epoll_wait({}) failed: {}", m_epfd, strerror(errno));
+        return;
+    }
+
+    std::vector<std::function<void()>> cbs;
+    listExpired(cbs);
+    for (auto& it : cbs)
+    {
+        schedule(std::move(it));
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+        epoll_event& ev = events[i];
+        if (!ev.data.ptr)
+        {
+            uint64_t val;
+            while (read(m_eventfd, &val, sizeof(val)) > 0)
+            {
+            }
+            continue;
+        }
+
+        FdContext* ctx = (FdContext*)ev.data.ptr;
+        std::lock_guard<std::mutex> lock(ctx->mutex);
+        uint32_t ready = ev.events;
+        if (ready & (EPOLLERR | EPOLLHUP))
+        {
+            // 出错或者对端关闭时两个方向都唤醒，由等待者自己去读写拿到错误
+            ready |= READ | WRITE;
+        }
+        ready &= ctx->events;
+        if (ready == NONE)
+        {
+            continue;
+        }
+        updateEpoll(ctx, ctx->events & ~ready);
+        if (ready & READ)
+        {
+            trigger(ctx, READ);
+        }
+        if (ready & WRITE)
+        {
+            trigger(ctx, WRITE);
+        }
+    }
+}
+
+void IOManager::tickle()
+{
+    if (m_polling.load(std::memory_order_seq_cst) == 0)
+    {
+        return;
+    }
+    uint64_t one = 1;
+    if (write(m_eventfd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN)
+    {
+        LOG_ERROR(LOG_NAME("root"), "write eventfd failed: {}", strerror(errno));
+    }
+}
+
+bool IOManager::stopping()
+{
+    return m_pendingEvents.load(std::memory_order_seq_cst) == 0 && !hasTimer() && Scheduler::stopping();
+}
+
+void IOManager::onTimerInsertedAtFront()
+{
+    tickle();
+}
+
+void IOManager::onWorkerStart()
+{
+    SetHookEnable(m_hookEnable);
+}
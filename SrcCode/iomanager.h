@@ -0,0 +1,124 @@
+#ifndef __ZY_IOMANAGER_H__
+#define __ZY_IOMANAGER_H__
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <sys/epoll.h>
+#include "fiber.h"
+#include "scheduler.h"
+#include "timer.h"
+
+// 基于epoll的IO调度器
+// 在Scheduler的基础上，工作线程空闲时不再睡在futex上，而是阻塞在epoll_wait里等待fd就绪；
+// 提交任务时向eventfd写一次把它唤醒
+// 同时也是定时器管理器：epoll_wait的超时取时间轮上下一个需要处理的时刻，醒来后把到期的回调提交执行
+// 停止时会等待登记的事件和定时器全部结束，循环定时器需要先取消
+//
+// 每个fd注册的事件是一次性的：就绪后把事件从epoll中删掉，再调度登记的回调或协程
+// epoll使用边缘触发，一个fd的读写两个方向分别登记，可以同时等待
+// fd的上下文按fd的值存放在分段的数组里，查找不加锁，只在第一次用到某一段时分配
+//
+// 用法：
+//     IOManager::ptr iom(new IOManager(4));
+//     iom->start();
+//     iom->schedule([]() {
+//         ...
+//         // 读到EAGAIN时挂起当前协程，fd可读时在某个工作线程上继续
+//         IOManager::GetThis()->wait(fd, IOManager::READ);
+//     });
+class IOManager : public Scheduler, public TimerManager
+{
+public:
+    typedef std::shared_ptr<IOManager> ptr;
+
+    enum Event
+    {
+        NONE = 0x0,
+        READ = EPOLLIN,
+        WRITE = EPOLLOUT
+    };
+
+    explicit IOManager(size_t threads = 0, const std::string& name = "iomanager");
+    ~IOManager();
+
+    // 登记fd的一次性事件，就绪时调度cb；cb为空时调度当前协程(当前必须在协程中)
+    // fd的同一事件已经登记过、fd无效、正在被关闭或者epoll_ctl失败时返回false
+    // 调度器记在fd的状态(FdCtx)里，hook的close在任何线程关闭fd都会唤醒等待者
+    bool addEvent(int fd, Event event, std::function<void()> cb = nullptr);
+    // 删除登记的事件，不触发
+    bool delEvent(int fd, Event event);
+    // 删除登记的事件，并立即触发一次(等待的协程会被唤醒)
+    bool cancelEvent(int fd, Event event);
+    // 删除并触发fd的所有事件，关闭fd之前调用
+    bool cancelAll(int fd);
+
+    // 挂起当前协程直到fd的事件就绪(或者被cancelEvent取消)，只能在本调度器的协程中调用
+    // 登记失败时立即返回false
+    bool wait(int fd, Event event);
+
+    // 工作线程是否启用系统调用hook(见hook.h)，默认不启用，必须在start之前调用
+    // 启用后工作线程上的协程可以直接调用阻塞的read/write/connect/sleep等，等待时让出而不是阻塞线程
+    void setHookEnable(bool v) { m_hookEnable = v; }
+    bool isHookEnable() const { return m_hookEnable; }
+
+    // 等待中的事件数
+    uint64_t getPendingEvents() const { return m_pendingEvents.load(std::memory_order_relaxed); }
+
+    // 当前线程所属的IO调度器，不是它的工作线程时为空
+    static IOManager* GetThis();
+
+protected:
+    virtual void idle() override;
+    virtual void tickle() override;
+    virtual bool stopping() override;
+    virtual void onTimerInsertedAtFront() override;
+    virtual void onWorkerStart() override;
+
+private:
+    // fd一个方向上等待的回调或协程
+    struct EventContext
+    {
+        Fiber::ptr fiber;
+        std::function<void()> cb;
+    };
+
+    struct FdContext
+    {
+        std::mutex mutex;
+        int fd = -1;
+        uint32_t events = NONE;                        // 已登记的事件，受mutex保护
+        EventContext read;
+        EventContext write;
+
+        EventContext& get(Event event) { return event == READ ? read : write; }
+    };
+
+    enum
+    {
+        CHUNK_BITS = 12,
+        CHUNK_SIZE = 1 << CHUNK_BITS,                  // 每段4096个fd
+        MAX_CHUNKS = 256,                              // 最多支持1M个fd
+        MAX_EVENTS = 256                               // 一次epoll_wait最多取出的事件数
+    };
+
+    // fd对应的上下文，create为真时按需分配所在的段；fd超出范围时返回空
+    FdContext* getContext(int fd, bool create);
+    // 修改fd在epoll中登记的事件，调用者持有ctx->mutex
+    bool updateEpoll(FdContext* ctx, uint32_t events);
+    // 取出事件上登记的回调或协程并调度，调用者持有ctx->mutex
+    void trigger(FdContext* ctx, Event event);
+    bool removeEvent(int fd, Event event, bool fire);
+
+private:
+    int m_epfd = -1;
+    int m_eventfd = -1;                                // tickle通过它唤醒epoll_wait
+    std::atomic<FdContext*> m_chunks[MAX_CHUNKS] = {};
+    std::atomic<uint64_t> m_pendingEvents{0};
+    std::atomic<uint32_t> m_polling{0};                // 阻塞在epoll_wait中的线程数
+    bool m_hookEnable = false;
+};
+
+#endif
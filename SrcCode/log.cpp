@@ -1,7 +1,13 @@
 
 #include "log.h"
+#include "hook.h"
 
 const std::string LogLevel::toString(LogLevel::Level level)
+{
+    return toChars(level);
+}
+
+const char* LogLevel::toChars(LogLevel::Level level)
 {
     switch (level)
     {
@@ -27,8 +33,215 @@ const std::string LogLevel::toString(LogLevel::Level level)
 }
 
 LogEvent::LogEvent(LogLevel::Level level, const char* file, int32_t line, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time, std::string logger_name)
-    : m_level(level), m_file(file), m_line(line), m_elapse(elapse), m_threadId(thread_id), m_fiberId(fiber_id), m_time(time), m_logger_name(logger_name)
-{}
+    : m_logger_name(logger_name)
+{
+    init(level, file, line, elapse, thread_id, fiber_id, time);
+}
+
+LogEvent::ptr LogEvent::Create(LogLevel::Level level, const char* file, int32_t line, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time, const std::string& logger_name)
+{
+    LogEvent* event = LogEventPool::Acquire();
+    event->init(level, file, line, elapse, thread_id, fiber_id, time);
+    // 复用的对象保留了上次的容量，assign和clear都不会重新分配内存
+    event->m_logger_name.assign(logger_name);
+    event->m_message.clear();
+    event->m_fmt = nullptr;
+    return ptr(event);
+}
+
+void LogEvent::renderDeferred() const
+{
+    // 参数就在m_message里，先展开到临时缓冲区再拷回来
+    LogStream text;
+    if (!LogArgs::Format(text, m_fmt, m_signature, m_message.data(), m_message.size()))
+    {
+        text << " <<bad arguments>>";
+    }
+    m_fmt = nullptr;
+    m_message.clear();
+    m_message.append(text.view());
+}
+
+void LogEvent::init(LogLevel::Level level, const char* file, int32_t line, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time)
+{
+    m_level = level;
+    m_file = file;
+    m_line = line;
+    m_elapse = elapse;
+    m_threadId = thread_id;
+    m_fiberId = fiber_id;
+    m_time = time;
+    m_usec = 0;
+    // 业务线程上只读一次计数器，换算成时间留给格式化的线程
+    m_ticks = time == 0 ? Clock::Now() : 0;
+    memcpy(m_threadName, ThreadInfo::GetThreadName(), sizeof(m_threadName));
+}
+
+void LogEvent::setThreadName(const char* name)
+{
+    strncpy(m_threadName, name, sizeof(m_threadName) - 1);
+    m_threadName[sizeof(m_threadName) - 1] = '\0';
+}
+
+void LogEvent::Recycler::operator()(LogEvent* event) const
+{
+    if (event->m_pool)
+    {
+        LogEventPool::Release(event);
+    }
+    else
+    {
+        delete event;
+    }
+}
+
+
+std::atomic<LogEvent*> LogEventPool::s_returned(nullptr);
+
+// 线程退出时对象池先于其他线程局部对象析构，之后再有事件归还就直接释放
+static thread_local LogEventPool t_event_pool;
+static thread_local bool t_event_pool_dead = false;
+
+LogEventPool::~LogEventPool()
+{
+    flushReturns();
+    while (m_free)
+    {
+        LogEvent* next = m_free->m_next;
+        delete m_free;
+        m_free = next;
+    }
+    m_freeCount = 0;
+    t_event_pool_dead = true;
+}
+
+LogEvent* LogEventPool::Acquire()
+{
+    if (t_event_pool_dead)
+    {
+        LogEvent* event = new LogEvent();
+        return event;
+    }
+    return t_event_pool.acquire();
+}
+
+void LogEventPool::Release(LogEvent* event)
+{
+    if (t_event_pool_dead)
+    {
+        // 本线程的池已经销毁，属于其他线程的事件直接挂到全局回收栈
+        if (event->m_pool == &t_event_pool)
+        {
+            delete event;
+            return;
+        }
+        event->m_next = s_returned.load(std::memory_order_relaxed);
+        while (!s_returned.compare_exchange_weak(event->m_next, event, std::memory_order_release, std::memory_order_relaxed))
+        {}
+        return;
+    }
+    t_event_pool.release(event);
+}
+
+void LogEventPool::FlushReturns()
+{
+    if (!t_event_pool_dead)
+    {
+        t_event_pool.flushReturns();
+    }
+}
+
+LogEvent* LogEventPool::acquire()
+{
+    if (!m_free)
+    {
+        // 本地用完了，把全局回收栈整个取过来。只有整体取走没有单个弹出，所以不存在ABA问题
+        // 线程很多时一个线程拿走全部会让其他线程只能重新分配，所以只留TAKE_BATCH条，其余整段挂回去
+        m_free = s_returned.exchange(nullptr, std::memory_order_acquire);
+        LogEvent* last = nullptr;
+        for (LogEvent* it = m_free; it && m_freeCount < TAKE_BATCH; it = it->m_next)
+        {
+            last = it;
+            ++m_freeCount;
+        }
+        if (last && last->m_next)
+        {
+            LogEvent* rest = last->m_next;
+            last->m_next = nullptr;
+            // 通常这期间没有人归还，栈还是空的，不用找剩余部分的尾
+            LogEvent* expected = nullptr;
+            if (!s_returned.compare_exchange_strong(expected, rest, std::memory_order_release, std::memory_order_relaxed))
+            {
+                LogEvent* tail = rest;
+                while (tail->m_next)
+                {
+                    tail = tail->m_next;
+                }
+                tail->m_next = expected;
+                while (!s_returned.compare_exchange_weak(tail->m_next, rest, std::memory_order_release, std::memory_order_relaxed))
+                {}
+            }
+        }
+    }
+
+    LogEvent* event;
+    if (m_free)
+    {
+        event = m_free;
+        m_free = event->m_next;
+        --m_freeCount;
+    }
+    else
+    {
+        event = new LogEvent();
+    }
+    event->m_next = nullptr;
+    event->m_pool = this;
+    return event;
+}
+
+void LogEventPool::release(LogEvent* event)
+{
+    if (event->m_pool == this)
+    {
+        if (m_freeCount >= MAX_FREE)
+        {
+            delete event;
+            return;
+        }
+        event->m_next = m_free;
+        m_free = event;
+        ++m_freeCount;
+        return;
+    }
+
+    // 其他线程的事件，先攒起来
+    event->m_next = m_returnHead;
+    m_returnHead = event;
+    if (!m_returnTail)
+    {
+        m_returnTail = event;
+    }
+    if (++m_returnCount >= RETURN_BATCH)
+    {
+        flushReturns();
+    }
+}
+
+void LogEventPool::flushReturns()
+{
+    if (!m_returnHead)
+    {
+        return;
+    }
+    // 整条链一次CAS挂上去
+    m_returnTail->m_next = s_returned.load(std::memory_order_relaxed);
+    while (!s_returned.compare_exchange_weak(m_returnTail->m_next, m_returnHead, std::memory_order_release, std::memory_order_relaxed))
+    {}
+    m_returnHead = nullptr;
+    m_returnTail = nullptr;
+    m_returnCount = 0;
+}
 
 const std::string LogEvent::getLocalTimeFromTimestamp(time_t timestamp)
 {
@@ -44,12 +257,129 @@ const std::string LogEvent::getLocalTimeFromTimestamp(time_t timestamp)
 }
 
 
+// DateTimeFormat的线程局部缓存，按对象id取模分槽
+struct DateTimeCacheSlot
+{
+    uint32_t id = 0;               // 0 表示无效
+    time_t sec = 0;
+    uint16_t head_len = 0;
+    uint16_t tail_len = 0;
+    char head[64];
+    char tail[32];
+};
+
+static thread_local DateTimeCacheSlot t_date_cache[4];
+
+DateTimeFormat::DateTimeFormat(const std::string& format)
+    : m_format(format.empty() ? "%Y-%m-%d %H:%M:%S" : format)
+{
+    static std::atomic<uint32_t> s_id(0);
+    m_id = ++s_id;
+
+    // 找到第一个亚秒格式，把格式串拆成前后两段，注意跳过 %% 这样的转义
+    size_t pos = std::string::npos;
+    for (size_t i = 0; i + 1 < m_format.size(); ++i)
+    {
+        if (m_format[i] != '%')
+        {
+            continue;
+        }
+        if (m_format[i + 1] == 'L' || m_format[i + 1] == 'f')
+        {
+            pos = i;
+            m_digits = m_format[i + 1] == 'L' ? 3 : 6;
+            break;
+        }
+        ++i;
+    }
+
+    if (pos == std::string::npos)
+    {
+        m_head = m_format;
+    }
+    else
+    {
+        m_head = m_format.substr(0, pos);
+        m_tail = m_format.substr(pos + 2);
+    }
+}
+
+// 写入亚秒部分，返回写入的长度
+static size_t WriteSubSecond(char* buf, size_t len, int digits, uint32_t usec)
+{
+    if ((size_t)digits > len)
+    {
+        return 0;
+    }
+    uint32_t val = digits == 3 ? usec / 1000 : usec;
+    for (int i = digits - 1; i >= 0; --i)
+    {
+        buf[i] = '0' + val % 10;
+        val /= 10;
+    }
+    return digits;
+}
+
+size_t DateTimeFormat::render(char* buf, size_t len, const struct tm& tm, uint32_t usec) const
+{
+    size_t n = 0;
+    if (!m_head.empty())
+    {
+        n = strftime(buf, len, m_head.c_str(), &tm);
+    }
+    n += WriteSubSecond(buf + n, len - n, m_digits, usec);
+    if (!m_tail.empty() && n < len)
+    {
+        n += strftime(buf + n, len - n, m_tail.c_str(), &tm);
+    }
+    return n;
+}
+
+size_t DateTimeFormat::format(char* buf, size_t len, time_t sec, uint32_t usec) const
+{
+    DateTimeCacheSlot& slot = t_date_cache[m_id & 3];
+    if (slot.id != m_id || slot.sec != sec)
+    {
+        // 这一秒第一次使用，重新渲染并缓存
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        size_t head = m_head.empty() ? 0 : strftime(slot.head, sizeof(slot.head), m_head.c_str(), &tm);
+        size_t tail = m_tail.empty() ? 0 : strftime(slot.tail, sizeof(slot.tail), m_tail.c_str(), &tm);
+        if ((!m_head.empty() && head == 0) || (!m_tail.empty() && tail == 0))
+        {
+            // 缓存放不下(或者结果为空)，不走缓存
+            slot.id = 0;
+            return render(buf, len, tm, usec);
+        }
+        slot.id = m_id;
+        slot.sec = sec;
+        slot.head_len = head;
+        slot.tail_len = tail;
+    }
+
+    if ((size_t)slot.head_len + m_digits + slot.tail_len > len)
+    {
+        return 0;
+    }
+    memcpy(buf, slot.head, slot.head_len);
+    size_t n = slot.head_len;
+    n += WriteSubSecond(buf + n, len - n, m_digits, usec);
+    memcpy(buf + n, slot.tail, slot.tail_len);
+    return n + slot.tail_len;
+}
+
+
 LogFormatter::LogFormatter(const std::string& pattern)
     : m_pattern(pattern)
 {
     init();
 }
 
+LogFormatter::LogFormatter(const std::string& pattern, NoParse)
+    : m_pattern(pattern)
+{
+}
+
 
 void LogFormatter::init()
 {
@@ -181,7 +511,8 @@ void LogFormatter::init()
     XX(f, FilenameFormatItem),
     XX(l, LineFormatItem),
     XX(T, TabFormatItem),
-    XX(F, FiberIdFormatItem)
+    XX(F, FiberIdFormatItem),
+    XX(N, ThreadNameFormatItem)
 
 #undef XX
     };
@@ -212,129 +543,1726 @@ void LogFormatter::init()
 }
 
 
-std::string LogFormatter::format(LogEvent::ptr event)
+void LogFormatter::format(LogStream& out, const LogEvent::ptr& event)
 {
-    // 通过stringstream来完成字符串之间的转换叠加
-    std::stringstream ss;
     for(auto& i : m_formats) 
     {
-        i->format(ss,event);
+        i->format(out, event);
     }
+}
+
+std::string LogFormatter::format(const LogEvent::ptr& event)
+{
+    // 先写进栈上的LogStream，只在最后构造一次string
+    LogStream ss;
+    format(ss, event);
     return ss.str();
 }
 
+size_t LogFormatter::format(char* buf, size_t len, const LogEvent::ptr& event)
+{
+    LogStream ss(buf, len);
+    format(ss, event);
+    return ss.needed();
+}
+
+
+static std::atomic<uint32_t> s_logger_id(0);
 
 Logger::Logger(const std::string name, LogLevel::Level level)
-    : m_name(name), m_level(level)
-{}
+    : m_name(name), m_id(++s_logger_id), m_level(level), m_levelSet(true), m_parent(nullptr),
+      m_appenders(new AppenderList()), m_async(nullptr)
+{
+}
+
+Logger::~Logger()
+{
+    // 后台排空时还会用到输出地和统计，最先停止；析构时不应再有线程使用本日志器
+    AsyncLogBackend* async = m_async.exchange(nullptr, std::memory_order_acq_rel);
+    if (async)
+    {
+        async->stop();
+        delete async;
+    }
+    delete m_appenders.load(std::memory_order_acquire);
+}
 
 void Logger::log(LogEvent::ptr event)
 {
+    if (event->getLevel() < getLevel())
+    {
+        return;
+    }
+
+    if (LogStats::IsEnabled())
+    {
+        uint64_t begin = Clock::Now();
+        dispatch(std::move(event));
+        LogStats::Shard& shard = m_stats.local();
+        shard.add(LogStats::EVENTS, 1);
+        shard.record(LogStats::LOG, Clock::ElapsedNs(begin, Clock::Now()));
+        return;
+    }
+    dispatch(std::move(event));
+}
+
+void Logger::dispatch(LogEvent::ptr event)
+{
+    // 输出地快照和异步后台都可能被并发的配置操作换下，整个分发过程在区间内
+    EpochGuard guard;
+
+    // 自己没有输出地时交给上级，由上级决定同步还是异步
+    Logger* target = this;
+    while (target->m_parent && target->getAppenders().empty())
+    {
+        target = target->m_parent;
+    }
+
+    AsyncLogBackend* async = target->m_async.load(std::memory_order_acquire);
+    if (!async)
+    {
+        target->doLog(event);
+        return;
+    }
+
+    LogLevel::Level level = event->getLevel();
+    if (!async->push(std::move(event)))
+    {
+        target->m_stats.add(LogStats::DROPS);
+    }
+    if (level == LogLevel::FATAL)
+    {
+        // FATAL之后进程可能马上退出，必须等待落地
+        async->flush();
+    }
+}
+
+void Logger::doLog(const LogEvent::ptr& event)
+{
+    // 同步输出时已经在dispatch的区间内，这里是为后台线程准备的
+    EpochGuard guard;
+    AppenderList* appenders = m_appenders.load(std::memory_order_acquire);
+
     // 如果当前日志器没有添加输出地，那么自动添加控制台输出
-    if (m_appenders.size() == 0)
+    if (appenders->empty())
     {
-        m_appenders.push_back(LogAppender::ptr(new StdoutLogAppender()));
+        appenders = installDefaultAppender(appenders);
     }
 
-    if (event->getLevel() >= m_level)
+    if (!LogStats::IsEnabled())
     {
-        for (int i = 0; i < m_appenders.size(); ++i)
+        for (auto& it : *appenders)
         {
-            m_appenders[i]->log(event);
+            it->log(event);
         }
+        return;
+    }
+
+    // 输出地内部的格式化通过LogStats::Current()记到本日志器上
+    LogStats::Shard* shard = &m_stats.local();
+    LogStats::Shard* prev = LogStats::Current();
+    LogStats::SetCurrent(shard);
+    // 上一个输出地的结束时刻就是下一个的开始时刻，少读一次时钟
+    uint64_t begin = Clock::Now();
+    for (auto& it : *appenders)
+    {
+        it->log(event);
+        uint64_t end = Clock::Now();
+        shard->record(LogStats::APPEND, Clock::ElapsedNs(begin, end));
+        begin = end;
     }
+    LogStats::SetCurrent(prev);
 }
 
-void Logger::setLevel(LogLevel::Level level)
+void Logger::setAppenders(AppenderList* list)
 {
-    m_level = level;
+    // 旧的快照可能还有线程在遍历，等它们离开区间后再释放
+    // 用exchange而不是store：doLog可能刚刚不加锁地换上了默认输出地，它的列表也要回收
+    AppenderList* old = m_appenders.exchange(list, std::memory_order_acq_rel);
+    EpochReclaimer::Retire(old);
 }
 
-void Logger::addAppender(LogAppender::ptr appender)
+Logger::AppenderList* Logger::installDefaultAppender(AppenderList* empty)
 {
-    m_appenders.push_back(appender);
+    // 不加m_mutex：setAsync/setSync在锁外排空后台队列，这里可能正在后台线程里
+    // 每个日志器一个控制台输出地，修改格式互不影响；行的完整性由StdoutLogAppender内部的锁保证
+    AppenderList* list = new AppenderList(1, LogAppender::ptr(new StdoutLogAppender()));
+    AppenderList* expected = empty;
+    if (m_appenders.compare_exchange_strong(expected, list, std::memory_order_acq_rel, std::memory_order_acquire))
+    {
+        EpochReclaimer::Retire(empty);
+        return list;
+    }
+    // 别的线程先换上了新的列表
+    delete list;
+    return expected;
 }
 
-void Logger::delAppender(LogAppender::ptr appender)
+// 换下的后台在锁外停止：stop会在当前线程排空队列，经过doLog写到输出地
+// 停止之后其他线程可能还拿着它的指针(投递时发现已经停止会同步输出)，等它们离开区间后再释放
+static void RetireBackend(AsyncLogBackend* old)
 {
-    for (int i = 0; i < m_appenders.size(); ++i)
+    if (old)
     {
-        if (m_appenders[i] == appender) 
-        {
-            m_appenders.erase(m_appenders.begin() + i);
-            break;
-        }
+        old->stop();
+        EpochReclaimer::Retire(old);
     }
 }
 
-void Logger::setFormat(LogFormatter::ptr format)
+void Logger::setAsync(size_t capacity, AsyncLogBackend::OverflowPolicy policy, AsyncLogBackend::Mode mode)
 {
-    for (auto& it : m_appenders)
+    AsyncLogBackend* worker = nullptr;
+    if (mode == AsyncLogBackend::PER_THREAD)
     {
-        it->setFormatter(format);
+        worker = new PerThreadLogWorker(this, capacity, policy);
+    }
+    else
+    {
+        worker = new AsyncLogWorker(this, capacity, policy);
+    }
+
+    AsyncLogBackend* old = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        old = m_async.exchange(worker, std::memory_order_acq_rel);
     }
+    // 旧后台中已经投递的日志在stop中写完，不会丢失
+    RetireBackend(old);
 }
 
-void StdoutLogAppender::log(LogEvent::ptr event)
+void Logger::setSync()
 {
-    if (!getFormatter().get())
+    AsyncLogBackend* old = nullptr;
     {
-        // 没有设置格式, 那就设置一个默认格式
-        setFormatter(LogFormatter::ptr(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T[%c]%T%f:%l%T%m%n")));
+        std::lock_guard<std::mutex> lock(m_mutex);
+        old = m_async.exchange(nullptr, std::memory_order_acq_rel);
     }
+    RetireBackend(old);
+}
 
-    cout << getFormatter()->format(event) << endl;
+uint64_t Logger::getDropped() const
+{
+    EpochGuard guard;
+    AsyncLogBackend* async = m_async.load(std::memory_order_acquire);
+    return async ? async->getDropped() : 0;
 }
 
-void FileAppender::log(LogEvent::ptr event) 
+void Logger::flush()
 {
-    cout << "输出到文件" << endl;
+    m_stats.add(LogStats::FLUSHES);
+    {
+        EpochGuard guard;
+        AsyncLogBackend* async = m_async.load(std::memory_order_acquire);
+        if (async)
+        {
+            async->flush();
+        }
+    }
+    flushAppenders();
+    // 配置操作时还有读者而没能释放的对象，在这里再试一次
+    EpochReclaimer::Reclaim();
 }
 
-FileAppender::FileAppender(const std::string file)
-    : m_file(file)
-{}
+void Logger::flushAppenders()
+{
+    EpochGuard guard;
+    for (auto& it : getAppenders())
+    {
+        it->flush();
+    }
+}
 
+void Logger::setLevel(LogLevel::Level level)
+{
+    m_levelSet.store(true, std::memory_order_relaxed);
+    inheritLevel(level);
+}
 
+void Logger::inheritLevel(LogLevel::Level level)
+{
+    m_level.store(level, std::memory_order_relaxed);
 
-LogEventWrap::LogEventWrap(Logger::ptr logger, LogEvent::ptr event)
-    : m_logger(logger), m_event(event)
-{}
+    // 自上而下加锁，与addChild的顺序一致，不会死锁
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& it : m_children)
+    {
+        if (!it->m_levelSet.load(std::memory_order_relaxed))
+        {
+            it->inheritLevel(level);
+        }
+    }
+}
 
-LogEventWrap::~LogEventWrap()
+void Logger::addChild(Logger* child)
 {
-    // 析构时自动调用log
-    m_logger->log(m_event);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // 在锁内读取等级，保证不会错过并发的setLevel
+    child->m_parent = this;
+    child->m_levelSet.store(false, std::memory_order_relaxed);
+    child->m_level.store(getLevel(), std::memory_order_relaxed);
+    m_children.push_back(child);
 }
 
+void Logger::addAppender(LogAppender::ptr appender)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // 当前快照可能被doLog安装默认输出地时换下
+    EpochGuard guard;
+    AppenderList* list = new AppenderList(getAppenders());
+    list->push_back(appender);
+    setAppenders(list);
+}
 
-std::stringstream& LogEventWrap::getSs()
+void Logger::delAppender(LogAppender::ptr appender)
 {
-    return m_event->getSs();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    EpochGuard guard;
+    const AppenderList& cur = getAppenders();
+    auto it = std::find(cur.begin(), cur.end(), appender);
+    if (it == cur.end())
+    {
+        return;
+    }
+    AppenderList* list = new AppenderList(cur);
+    list->erase(list->begin() + (it - cur.begin()));
+    setAppenders(list);
 }
 
+void Logger::setFormat(LogFormatter::ptr format)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    EpochGuard guard;
+    for (auto& it : getAppenders())
+    {
+        it->setFormatter(format);
+    }
+}
 
-LogManager::LogManager()
+LogAppender::LogAppender()
+    : m_formatter(nullptr)
 {
-    m_root = Logger::ptr(new Logger("root"));
+    setFormatter(LogFormatter::ptr(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T[%c]%T%f:%l%T%m%n")));
 }
 
+void LogAppender::setFormatter(LogFormatter::ptr val)
+{
+    if (!val)
+    {
+        return;
+    }
+    LogFormatter::ptr old;
+    {
+        std::lock_guard<std::mutex> lock(m_formatterMutex);
+        old.swap(m_current);
+        m_current = val;
+        m_formatter.store(val.get(), std::memory_order_release);
+    }
+    // 其他线程可能正在用旧的格式器，等它们离开区间后再释放
+    if (old)
+    {
+        EpochReclaimer::Retire([old]() mutable { old.reset(); });
+    }
+}
 
-Logger::ptr LogManager::getLogger(const std::string& name)
+void LogAppender::format(LogStream& out, const LogEvent::ptr& event)
 {
-    for (auto& it : m_loggers)
+    // 直接调用输出地(不经过日志器)时也要保证格式器不被并发的setFormatter释放
+    EpochGuard guard;
+    LogStats::Shard* shard = LogStats::Current();
+    if (!shard)
     {
-        if (it->getName() == name)
-        {
-            return it;
-        }
+        getFormatter()->format(out, event);
+        return;
     }
-    return nullptr;
+    size_t before = out.size();
+    uint64_t begin = Clock::Now();
+    getFormatter()->format(out, event);
+    shard->record(LogStats::FORMAT, Clock::ElapsedNs(begin, Clock::Now()));
+    shard->add(LogStats::BYTES, out.size() - before);
 }
 
-Logger::ptr LogManager::getRoot()
+size_t LogAppender::format(char* buf, size_t len, const LogEvent::ptr& event)
 {
-    return m_root;
+    EpochGuard guard;
+    LogStats::Shard* shard = LogStats::Current();
+    if (!shard)
+    {
+        return getFormatter()->format(buf, len, event);
+    }
+    uint64_t begin = Clock::Now();
+    size_t n = getFormatter()->format(buf, len, event);
+    shard->record(LogStats::FORMAT, Clock::ElapsedNs(begin, Clock::Now()));
+    // 空间不够时只是算出长度，没有真正输出
+    if (n <= len)
+    {
+        shard->add(LogStats::BYTES, n);
+    }
+    return n;
 }
 
+// 所有控制台输出地共用一把锁，保证不同日志器的行不会交错
+static std::mutex s_stdout_mutex;
+
+void StdoutLogAppender::log(const LogEvent::ptr& event)
+{
+    LogStream ss;
+    format(ss, event);
+    std::lock_guard<std::mutex> lock(s_stdout_mutex);
+    cout << ss.view() << endl;
+}
 
+MmapFileAppender::MmapFileAppender(const std::string& file, size_t window_size)
+    : m_file(file)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    m_windowSize = (window_size + page - 1) / page * page;
+    if (m_windowSize == 0)
+    {
+        m_windowSize = page;
+    }
+
+    m_fd = open(m_file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+    {
+        std::cout << "open log file error: " << m_file << " - " << strerror(errno) << std::endl;
+        return;
+    }
+    struct stat st;
+    if (fstat(m_fd, &st) == 0 && st.st_size > 0)
+    {
+        m_offset = findDataEnd(st.st_size);
+    }
+}
+
+MmapFileAppender::~MmapFileAppender()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_map)
+    {
+        munmap(m_map, m_mapSize);
+        m_map = nullptr;
+    }
+    if (m_fd >= 0)
+    {
+        // 去掉预分配但没有用到的部分
+        if (ftruncate(m_fd, m_offset) != 0)
+        {
+            std::cout << "truncate log file error: " << m_file << " - " << strerror(errno) << std::endl;
+        }
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+uint64_t MmapFileAppender::findDataEnd(uint64_t file_size)
+{
+    // 从文件尾部往前找最后一个非0字节，跳过上次崩溃时残留的预分配空间
+    char buf[64 * 1024];
+    uint64_t end = file_size;
+    while (end > 0)
+    {
+        size_t n = end < sizeof(buf) ? end : sizeof(buf);
+        ssize_t rt = pread(m_fd, buf, n, end - n);
+        if (rt != (ssize_t)n)
+        {
+            return file_size;
+        }
+        for (size_t i = n; i > 0; --i)
+        {
+            if (buf[i - 1] != 0)
+            {
+                return end - n + i;
+            }
+        }
+        end -= n;
+    }
+    return 0;
+}
+
+bool MmapFileAppender::remap(size_t need)
+{
+    if (m_map)
+    {
+        munmap(m_map, m_mapSize);
+        m_map = nullptr;
+    }
+
+    // 窗口起点按页对齐，大小至少能容纳这条日志
+    size_t page = sysconf(_SC_PAGESIZE);
+    m_mapOffset = m_offset / page * page;
+    size_t in_page = m_offset - m_mapOffset;
+    m_mapSize = m_windowSize;
+    if (in_page + need > m_mapSize)
+    {
+        m_mapSize = (in_page + need + page - 1) / page * page;
+    }
+
+    // 预分配磁盘空间，避免写映射区时因为空间不足收到SIGBUS
+    int rt = fallocate(m_fd, 0, m_mapOffset, m_mapSize);
+    if (rt != 0 && (errno == EOPNOTSUPP || errno == ENOSYS))
+    {
+        struct stat st;
+        if (fstat(m_fd, &st) == 0 && (uint64_t)st.st_size < m_mapOffset + m_mapSize)
+        {
+            rt = ftruncate(m_fd, m_mapOffset + m_mapSize);
+        }
+        else
+        {
+            rt = 0;
+        }
+    }
+    if (rt != 0)
+    {
+        std::cout << "allocate log file error: " << m_file << " - " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    void* addr = mmap(nullptr, m_mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, m_mapOffset);
+    if (addr == MAP_FAILED)
+    {
+        std::cout << "mmap log file error: " << m_file << " - " << strerror(errno) << std::endl;
+        return false;
+    }
+    m_map = (char*)addr;
+    ++m_remaps;
+    return true;
+}
+
+void MmapFileAppender::log(const LogEvent::ptr& event)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_fd < 0)
+    {
+        return;
+    }
+
+    size_t room = m_map ? m_mapOffset + m_mapSize - m_offset : 0;
+    char* cur = m_map ? m_map + (m_offset - m_mapOffset) : nullptr;
+    size_t n = cur ? format(cur, room, event) : room + 1;
+    if (n > room)
+    {
+        // 当前窗口放不下，先算出长度再映射下一段重新渲染
+        if (!cur)
+        {
+            char tmp[1];
+            n = format(tmp, 0, event);
+        }
+        if (!remap(n))
+        {
+            return;
+        }
+        cur = m_map + (m_offset - m_mapOffset);
+        n = format(cur, m_mapOffset + m_mapSize - m_offset, event);
+    }
+    m_offset += n;
+}
+
+void MmapFileAppender::flush()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_map)
+    {
+        msync(m_map, m_offset - m_mapOffset, MS_ASYNC);
+    }
+}
+
+FileAppender::FileAppender(const std::string file, size_t buffer_size, uint32_t flush_interval_ms)
+    : m_file(file), m_buffer(buffer_size < 4096 ? 4096 : buffer_size), m_flushInterval(flush_interval_ms)
+{
+    reopen();
+    m_lastFlush = NowMs();
+}
+
+FileAppender::FileAppender(size_t buffer_size, uint32_t flush_interval_ms)
+    : m_buffer(buffer_size < 4096 ? 4096 : buffer_size), m_flushInterval(flush_interval_ms)
+{
+    m_lastFlush = NowMs();
+}
+
+FileAppender::~FileAppender()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    flushLocked();
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+uint64_t FileAppender::NowMs()
+{
+    // 只用来判断定时写盘，粗粒度时钟足够
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+bool FileAppender::reopen()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return reopenLocked();
+}
+
+bool FileAppender::reopenLocked()
+{
+    flushLocked();
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+    }
+    m_fileSize = 0;
+    m_fd = open(m_file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+    {
+        std::cout << "open log file error: " << m_file << " - " << strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(m_fd, &st) == 0)
+    {
+        m_fileSize = st.st_size;
+    }
+    return true;
+}
+
+void FileAppender::log(const LogEvent::ptr& event) 
+{
+    // 在锁外格式化到栈上，加锁后只做一次拷贝
+    LogStream ss;
+    format(ss, event);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    beforeAppend(event, ss.size());
+    append(ss.data(), ss.size());
+
+    if (event->getLevel() == LogLevel::FATAL)
+    {
+        flushLocked();
+    }
+    else if (m_flushInterval > 0 && m_used > 0)
+    {
+        uint64_t now = NowMs();
+        if (now - m_lastFlush >= m_flushInterval)
+        {
+            flushLocked();
+        }
+    }
+}
+
+void FileAppender::append(const char* data, size_t len)
+{
+    m_fileSize += len;
+    if (m_used + len > m_buffer.size())
+    {
+        flushLocked();
+        if (len > m_buffer.size())
+        {
+            // 比整个缓冲区还大的日志直接写出
+            writeAll(data, len);
+            return;
+        }
+    }
+    memcpy(&m_buffer[m_used], data, len);
+    m_used += len;
+}
+
+void FileAppender::flush()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    flushLocked();
+}
+
+void FileAppender::flushLocked()
+{
+    m_lastFlush = NowMs();
+    if (m_used == 0)
+    {
+        return;
+    }
+    writeAll(&m_buffer[0], m_used);
+    m_used = 0;
+}
+
+bool FileAppender::writeAll(const char* data, size_t len)
+{
+    if (m_fd < 0)
+    {
+        return false;
+    }
+    // 调用者持有m_mutex，写文件时不能让出协程
+    HookDisabler no_hook;
+    while (len > 0)
+    {
+        ssize_t n = write(m_fd, data, len);
+        ++m_writes;
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            std::cout << "write log file error: " << m_file << " - " << strerror(errno) << std::endl;
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+
+LogFileCompressor::LogFileCompressor(size_t max_files, bool compress)
+    : m_maxFiles(max_files), m_compress(compress)
+{
+    m_thread = std::thread(&LogFileCompressor::run, this);
+}
+
+LogFileCompressor::~LogFileCompressor()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+        m_cond.notify_one();
+    }
+    m_thread.join();
+}
+
+void LogFileCompressor::submit(int fd, const std::string& file)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tasks.push_back(Task{fd, file});
+    m_cond.notify_one();
+}
+
+void LogFileCompressor::addHistory(const std::string& file, bool need_compress)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (need_compress && m_compress)
+    {
+        m_tasks.push_back(Task{-1, file});
+        m_cond.notify_one();
+        return;
+    }
+    m_history.push_back(file);
+    prune();
+}
+
+void LogFileCompressor::run()
+{
+    std::vector<Task> tasks;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (m_tasks.empty() && !m_stop)
+            {
+                m_cond.wait(lock);
+            }
+            if (m_tasks.empty() && m_stop)
+            {
+                break;
+            }
+            tasks.swap(m_tasks);
+        }
+
+        for (auto& it : tasks)
+        {
+            if (it.fd >= 0)
+            {
+                close(it.fd);
+            }
+
+            std::string archived = it.file;
+            if (m_compress)
+            {
+                std::string gz = it.file + ".gz";
+                if (compressFile(it.file, gz))
+                {
+                    unlink(it.file.c_str());
+                    archived = gz;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_history.push_back(archived);
+            prune();
+        }
+        tasks.clear();
+    }
+}
+
+bool LogFileCompressor::compressFile(const std::string& file, const std::string& gz)
+{
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    // 先写临时文件，完成后再改名，避免留下不完整的.gz
+    std::string tmp = gz + ".tmp";
+    gzFile out = gzopen(tmp.c_str(), "wb6");
+    if (!out)
+    {
+        close(fd);
+        return false;
+    }
+
+    bool ok = true;
+    std::vector<char> buf(256 * 1024);
+    while (true)
+    {
+        ssize_t n = read(fd, &buf[0], buf.size());
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            ok = n == 0;
+            break;
+        }
+        if (gzwrite(out, &buf[0], n) != n)
+        {
+            ok = false;
+            break;
+        }
+    }
+    close(fd);
+    if (gzclose(out) != Z_OK)
+    {
+        ok = false;
+    }
+
+    if (!ok || rename(tmp.c_str(), gz.c_str()) != 0)
+    {
+        std::cout << "compress log file error: " << file << std::endl;
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+void LogFileCompressor::prune()
+{
+    if (m_maxFiles == 0)
+    {
+        return;
+    }
+    while (m_history.size() > m_maxFiles)
+    {
+        unlink(m_history.front().c_str());
+        m_history.erase(m_history.begin());
+    }
+}
+
+
+RotatingFileAppender::RotatingFileAppender(const std::string& base, size_t max_size, RollPeriod period,
+                                           size_t max_files, bool compress,
+                                           size_t buffer_size, uint32_t flush_interval_ms)
+    : FileAppender(buffer_size, flush_interval_ms), m_base(base), m_maxSize(max_size),
+      m_period(period), m_compressor(max_files, compress)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    openPeriodLocked(time(0));
+    scanHistory();
+}
+
+RotatingFileAppender::~RotatingFileAppender()
+{
+    flush();
+}
+
+std::string RotatingFileAppender::periodStamp(time_t now, time_t* next) const
+{
+    struct tm tm;
+    localtime_r(&now, &tm);
+    char buf[32];
+    if (m_period == HOURLY)
+    {
+        strftime(buf, sizeof(buf), "%Y%m%d-%H", &tm);
+        tm.tm_min = 0;
+        tm.tm_sec = 0;
+        tm.tm_hour += 1;
+    }
+    else if (m_period == DAILY)
+    {
+        strftime(buf, sizeof(buf), "%Y%m%d", &tm);
+        tm.tm_hour = 0;
+        tm.tm_min = 0;
+        tm.tm_sec = 0;
+        tm.tm_mday += 1;
+    }
+    else
+    {
+        // 只按大小切分时用文件创建的时间区分
+        strftime(buf, sizeof(buf), "%Y%m%d-%H%M%S", &tm);
+        *next = std::numeric_limits<time_t>::max();
+        return buf;
+    }
+    tm.tm_isdst = -1;
+    *next = mktime(&tm);
+    return buf;
+}
+
+void RotatingFileAppender::openPeriodLocked(time_t now)
+{
+    std::string stamp = periodStamp(now, &m_nextRoll);
+    if (stamp != m_stamp)
+    {
+        m_stamp = stamp;
+        m_index = 0;
+    }
+    else
+    {
+        ++m_index;
+    }
+
+    // 跳过已经存在的文件，只有启动时(还没打开任何文件)才允许续写未写满的文件
+    bool startup = m_fd < 0 && m_rotates == 0;
+    while (true)
+    {
+        m_file = m_base + "." + m_stamp;
+        if (m_index > 0)
+        {
+            m_file += "." + std::to_string(m_index);
+        }
+
+        struct stat st;
+        bool exists = stat(m_file.c_str(), &st) == 0;
+        bool archived = access((m_file + ".gz").c_str(), F_OK) == 0;
+        if (archived || (exists && !(startup && (size_t)st.st_size < m_maxSize)))
+        {
+            ++m_index;
+            continue;
+        }
+        break;
+    }
+    reopenLocked();
+}
+
+void RotatingFileAppender::rotateLocked(time_t now)
+{
+    // 旧文件只做一次write，关闭和压缩都交给后台
+    flushLocked();
+    int old_fd = m_fd;
+    std::string old_file = m_file;
+    m_fd = -1;
+    ++m_rotates;
+    openPeriodLocked(now);
+    if (old_fd >= 0)
+    {
+        m_compressor.submit(old_fd, old_file);
+    }
+}
+
+void RotatingFileAppender::beforeAppend(const LogEvent::ptr& event, size_t len)
+{
+    time_t now = event->getTime();
+    if (now >= m_nextRoll || (m_fileSize > 0 && m_fileSize + len > m_maxSize))
+    {
+        rotateLocked(now);
+    }
+}
+
+// 检查base之后的部分是否是openPeriodLocked生成的文件名：
+//     .日期(8位数字) [-时(2位) 或 -时分秒(6位)] [.序号] [.gz 或 .gz.tmp]
+// 同名前缀的其他文件(例如base为server时的server.cpp、server.conf)不能当作历史日志删掉
+static bool IsHistorySuffix(const char* p)
+{
+    auto digits = [&p]() {
+        size_t n = 0;
+        while (p[n] >= '0' && p[n] <= '9')
+        {
+            ++n;
+        }
+        p += n;
+        return n;
+    };
+    if (*p++ != '.' || digits() != 8)
+    {
+        return false;
+    }
+    if (*p == '-')
+    {
+        ++p;
+        size_t n = digits();
+        if (n != 2 && n != 6)
+        {
+            return false;
+        }
+    }
+    if (*p == '.' && p[1] >= '0' && p[1] <= '9')
+    {
+        ++p;
+        digits();
+    }
+    return *p == '\0' || strcmp(p, ".gz") == 0 || strcmp(p, ".gz.tmp") == 0;
+}
+
+void RotatingFileAppender::scanHistory()
+{
+    // 把上次运行留下的文件按修改时间排序交给后台，未压缩的顺便压缩
+    glob_t g;
+    std::string pattern = m_base + ".[0-9]*";
+    if (glob(pattern.c_str(), 0, nullptr, &g) != 0)
+    {
+        return;
+    }
+
+    std::vector<std::pair<time_t, std::string>> files;
+    for (size_t i = 0; i < g.gl_pathc; ++i)
+    {
+        std::string file = g.gl_pathv[i];
+        struct stat st;
+        if (file == m_file || file.size() <= m_base.size() || !IsHistorySuffix(file.c_str() + m_base.size())
+            || stat(file.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            continue;
+        }
+        if (file.size() > 7 && file.compare(file.size() - 7, 7, ".gz.tmp") == 0)
+        {
+            // 上次压缩到一半的临时文件
+            unlink(file.c_str());
+            continue;
+        }
+        files.push_back(std::make_pair(st.st_mtime, file));
+    }
+    globfree(&g);
+
+    std::sort(files.begin(), files.end());
+    for (auto& it : files)
+    {
+        bool gz = it.second.size() > 3 && it.second.compare(it.second.size() - 3, 3, ".gz") == 0;
+        m_compressor.addHistory(it.second, !gz);
+    }
+}
+
+
+AsyncLogWorker::AsyncLogWorker(Logger* logger, size_t capacity, OverflowPolicy policy)
+    : m_logger(logger), m_policy(policy), m_queue(capacity),
+      m_pushed(0), m_done(0), m_dropped(0), m_sleeping(false), m_stop(false)
+{
+    m_thread = std::thread(&AsyncLogWorker::run, this);
+}
+
+AsyncLogWorker::~AsyncLogWorker()
+{
+    stop();
+}
+
+void AsyncLogWorker::stop()
+{
+    m_stop.store(true, std::memory_order_seq_cst);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cond.notify_one();
+    }
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+    // 与push中的检查配对，停止之后才入队的日志也不会留在队列里
+    drain();
+}
+
+void AsyncLogWorker::drain()
+{
+    LogEvent::ptr event;
+    while (m_queue.pop(event))
+    {
+        m_logger->doLog(event);
+        event.reset();
+        m_done.fetch_add(1, std::memory_order_release);
+    }
+}
+
+bool AsyncLogWorker::push(LogEvent::ptr event)
+{
+    while (!m_queue.push(std::move(event)))
+    {
+        if (m_stop.load(std::memory_order_acquire))
+        {
+            // 后台已经停止，没有人会再消费队列，直接在当前线程输出
+            m_logger->doLog(event);
+            return true;
+        }
+        if (m_policy == DROP_NEWEST)
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else if (m_policy == DROP_OLDEST)
+        {
+            // 从队头挤掉一条，再重试
+            LogEvent::ptr oldest;
+            if (m_queue.pop(oldest))
+            {
+                m_logger->getStats().add(LogStats::DROPS);
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                m_done.fetch_add(1, std::memory_order_release);
+            }
+        }
+        else
+        {
+            // 阻塞策略：先叫醒后台线程，再让出CPU等待空位
+            wakeup();
+            std::this_thread::yield();
+        }
+    }
+    m_pushed.fetch_add(1, std::memory_order_relaxed);
+
+    // 只有后台线程在睡眠时才需要通知，避免每条日志都进入内核
+    // 屏障与run中的屏障配对，保证不会出现双方都没看到对方的情况
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleeping.load(std::memory_order_relaxed))
+    {
+        wakeup();
+    }
+    if (m_stop.load(std::memory_order_relaxed))
+    {
+        // 入队时后台可能已经退出，自己把队列清空
+        drain();
+    }
+    return true;
+}
+
+void AsyncLogWorker::wakeup()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_cond.notify_one();
+}
+
+void AsyncLogWorker::flush()
+{
+    uint64_t target = m_pushed.load(std::memory_order_acquire);
+    wakeup();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_done.load(std::memory_order_acquire) < target)
+    {
+        m_doneCond.wait_for(lock, std::chrono::milliseconds(10));
+    }
+}
+
+void AsyncLogWorker::run()
+{
+    LogEvent::ptr event;
+    while (true)
+    {
+        size_t n = 0;
+        while (m_queue.pop(event))
+        {
+            m_logger->doLog(event);
+            event.reset();
+            m_done.fetch_add(1, std::memory_order_release);
+            ++n;
+        }
+
+        if (n > 0)
+        {
+            // 用完的事件整批还给业务线程的对象池
+            LogEventPool::FlushReturns();
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_doneCond.notify_all();
+            continue;
+        }
+
+        if (m_stop.load(std::memory_order_acquire))
+        {
+            // 生产者已经停止投递，此时队列为空就可以退出
+            if (m_queue.empty())
+            {
+                break;
+            }
+            continue;
+        }
+
+        // 队列为空，进入睡眠。超时是为了兜底生产者和睡眠标志之间的竞争
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool timeout = false;
+        if (m_queue.empty() && !m_stop.load(std::memory_order_acquire))
+        {
+            timeout = m_cond.wait_for(lock, std::chrono::milliseconds(100)) == std::cv_status::timeout;
+        }
+        m_sleeping.store(false, std::memory_order_release);
+        lock.unlock();
+
+        if (timeout)
+        {
+            // 空闲了一段时间，把输出地缓冲中的日志写出去
+            m_logger->flushAppenders();
+        }
+    }
+}
+
+
+
+static std::atomic<uint64_t> s_per_thread_worker_id(0);
+
+// 每个线程记录自己在各个PerThreadLogWorker中的队列
+struct PerThreadQueueCache
+{
+    struct Ref
+    {
+        uint64_t owner;
+        std::shared_ptr<PerThreadLogWorker::Queue> queue;
+    };
+
+    ~PerThreadQueueCache()
+    {
+        // 线程退出，剩下的事件由后台写完后回收队列
+        for (auto& it : refs)
+        {
+            it.queue->dead.store(true, std::memory_order_release);
+        }
+    }
+
+    uint64_t last_owner = 0;                           // 最近一次使用的后台，绝大多数线程只用一个
+    PerThreadLogWorker::Queue* last = nullptr;
+    std::vector<Ref> refs;
+};
+
+static thread_local PerThreadQueueCache t_queue_cache;
+
+PerThreadLogWorker::PerThreadLogWorker(Logger* logger, size_t capacity, OverflowPolicy policy)
+    : m_logger(logger), m_policy(policy == DROP_OLDEST ? DROP_NEWEST : policy), m_capacity(capacity),
+      m_id(++s_per_thread_worker_id), m_queuesVersion(0), m_retiredDropped(0),
+      m_sleeping(false), m_stop(false)
+{
+    m_thread = std::thread(&PerThreadLogWorker::run, this);
+}
+
+PerThreadLogWorker::~PerThreadLogWorker()
+{
+    stop();
+    std::lock_guard<std::mutex> lock(m_queuesMutex);
+    for (auto& it : m_queues)
+    {
+        it->closed.store(true, std::memory_order_release);
+    }
+}
+
+PerThreadLogWorker::Queue* PerThreadLogWorker::threadQueue()
+{
+    PerThreadQueueCache& cache = t_queue_cache;
+    if (cache.last_owner == m_id)
+    {
+        return cache.last;
+    }
+
+    for (auto& it : cache.refs)
+    {
+        if (it.owner == m_id)
+        {
+            cache.last_owner = m_id;
+            cache.last = it.queue.get();
+            return cache.last;
+        }
+    }
+
+    // 顺便清理已经销毁的后台留下的队列
+    for (size_t i = 0; i < cache.refs.size(); )
+    {
+        if (cache.refs[i].queue->closed.load(std::memory_order_acquire))
+        {
+            cache.refs[i] = std::move(cache.refs.back());
+            cache.refs.pop_back();
+        }
+        else
+        {
+            ++i;
+        }
+    }
+
+    std::shared_ptr<Queue> queue(new Queue(m_capacity));
+    cache.refs.push_back(PerThreadQueueCache::Ref{m_id, queue});
+    {
+        std::lock_guard<std::mutex> lock(m_queuesMutex);
+        m_queues.push_back(queue);
+        m_queuesVersion.fetch_add(1, std::memory_order_release);
+    }
+    cache.last_owner = m_id;
+    cache.last = queue.get();
+    return cache.last;
+}
+
+bool PerThreadLogWorker::push(LogEvent::ptr event)
+{
+    if (m_stop.load(std::memory_order_acquire))
+    {
+        m_logger->doLog(event);
+        return true;
+    }
+
+    Queue* queue = threadQueue();
+    while (!queue->ring.push(std::move(event)))
+    {
+        if (m_stop.load(std::memory_order_acquire))
+        {
+            m_logger->doLog(event);
+            return true;
+        }
+        if (m_policy != BLOCK)
+        {
+            queue->dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        // 叫醒后台，睡眠到它取走一批。后台出队之后在m_mutex下通知，这里在锁内检查是否仍然满，不会漏掉通知
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.notify_one();
+        if (queue->ring.pushed() - queue->ring.popped() >= queue->ring.capacity()
+            && !m_stop.load(std::memory_order_acquire))
+        {
+            m_doneCond.wait_for(lock, std::chrono::milliseconds(10));
+        }
+    }
+
+    // 与AsyncLogWorker相同，只有后台线程在睡眠时才通知
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleeping.load(std::memory_order_relaxed))
+    {
+        wakeup();
+    }
+    if (m_stop.load(std::memory_order_relaxed))
+    {
+        // 入队时后台可能已经退出，自己把队列清空
+        std::vector<std::shared_ptr<Queue>> queues;
+        {
+            std::lock_guard<std::mutex> lock(m_queuesMutex);
+            queues = m_queues;
+        }
+        std::lock_guard<std::mutex> lock(m_drainMutex);
+        while (drain(queues) > 0) {}
+    }
+    return true;
+}
+
+void PerThreadLogWorker::wakeup()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_cond.notify_one();
+}
+
+size_t PerThreadLogWorker::drain(std::vector<std::shared_ptr<Queue>>& queues)
+{
+    // 每个队列一次取走已有的全部事件(最多一整圈)，只发布一次出队位置，
+    // 生产者在后台格式化这一批的同时就可以继续写
+    m_batch.clear();
+    m_taken.clear();
+    for (auto& it : queues)
+    {
+        size_t n = it->ring.popBatch(m_batch, m_capacity);
+        if (n > 0)
+        {
+            m_taken.push_back(std::make_pair(it.get(), n));
+        }
+    }
+    if (m_batch.empty())
+    {
+        return 0;
+    }
+    if (m_policy == BLOCK)
+    {
+        // 队列满而睡眠的生产者现在有空位了
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_doneCond.notify_all();
+    }
+
+    {
+        // 整批共用一个区间，doLog里的EpochGuard只是嵌套，不再每条写一次记录
+        EpochGuard guard;
+        if (m_taken.size() > 1)
+        {
+            merge();
+        }
+        else
+        {
+            for (auto& it : m_batch)
+            {
+                m_logger->doLog(it);
+                it.reset();
+            }
+        }
+    }
+    for (auto& it : m_taken)
+    {
+        it.first->done.fetch_add(it.second, std::memory_order_release);
+    }
+    // 用完的事件整批还给业务线程的对象池
+    LogEventPool::FlushReturns();
+    return m_batch.size();
+}
+
+void PerThreadLogWorker::merge()
+{
+    // 时间戳先连续存放，归并时比较不用再逐个访问事件
+    m_ticks.resize(m_batch.size());
+    for (size_t i = 0; i < m_batch.size(); ++i)
+    {
+        m_ticks[i] = m_batch[i]->getTicks();
+    }
+    // 各段本来就有序，用小顶堆做k路归并，比较次数是n*log(k)，k为线程数
+    m_heap.clear();
+    size_t begin = 0;
+    for (auto& it : m_taken)
+    {
+        m_heap.push_back(MergeCursor{m_ticks[begin], begin, begin + it.second});
+        begin += it.second;
+    }
+    std::make_heap(m_heap.begin(), m_heap.end(), std::greater<MergeCursor>());
+    while (!m_heap.empty())
+    {
+        std::pop_heap(m_heap.begin(), m_heap.end(), std::greater<MergeCursor>());
+        MergeCursor& cur = m_heap.back();
+        // 堆顶的段连续输出，直到它的下一条晚于其他段中最早的一条
+        const MergeCursor* next = m_heap.size() > 1 ? &m_heap.front() : nullptr;
+        do
+        {
+            m_logger->doLog(m_batch[cur.pos]);
+            m_batch[cur.pos].reset();
+            ++cur.pos;
+        } while (cur.pos < cur.end
+                 && (!next || !(MergeCursor{m_ticks[cur.pos], cur.pos, cur.end} > *next)));
+        if (cur.pos < cur.end)
+        {
+            cur.ticks = m_ticks[cur.pos];
+            std::push_heap(m_heap.begin(), m_heap.end(), std::greater<MergeCursor>());
+        }
+        else
+        {
+            m_heap.pop_back();
+        }
+    }
+}
+
+void PerThreadLogWorker::run()
+{
+    std::vector<std::shared_ptr<Queue>> queues;
+    uint64_t version = 0;
+    while (true)
+    {
+        if (m_queuesVersion.load(std::memory_order_acquire) != version)
+        {
+            std::lock_guard<std::mutex> lock(m_queuesMutex);
+            queues = m_queues;
+            version = m_queuesVersion.load(std::memory_order_relaxed);
+        }
+
+        size_t n;
+        {
+            std::lock_guard<std::mutex> lock(m_drainMutex);
+            n = drain(queues);
+        }
+        if (n > 0)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_doneCond.notify_all();
+            continue;
+        }
+
+        // 回收已经退出的线程留下的空队列
+        bool removed = false;
+        {
+            std::lock_guard<std::mutex> lock(m_queuesMutex);
+            for (size_t i = 0; i < m_queues.size(); )
+            {
+                if (m_queues[i]->dead.load(std::memory_order_acquire) && m_queues[i]->ring.empty())
+                {
+                    m_retiredDropped.fetch_add(m_queues[i]->dropped.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                    m_queues[i] = std::move(m_queues.back());
+                    m_queues.pop_back();
+                    removed = true;
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+            if (removed)
+            {
+                m_queuesVersion.fetch_add(1, std::memory_order_release);
+            }
+        }
+
+        if (m_stop.load(std::memory_order_acquire))
+        {
+            // 剩下的由stop在调用线程写完
+            break;
+        }
+
+        // 所有队列都为空，进入睡眠。超时是为了兜底生产者和睡眠标志之间的竞争，以及发现新登记的队列
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool idle = true;
+        for (auto& it : queues)
+        {
+            if (!it->ring.empty())
+            {
+                idle = false;
+                break;
+            }
+        }
+        bool timeout = false;
+        if (idle && !m_stop.load(std::memory_order_acquire)
+            && m_queuesVersion.load(std::memory_order_acquire) == version)
+        {
+            timeout = m_cond.wait_for(lock, std::chrono::milliseconds(100)) == std::cv_status::timeout;
+        }
+        m_sleeping.store(false, std::memory_order_release);
+        lock.unlock();
+
+        if (timeout)
+        {
+            // 空闲了一段时间，把输出地缓冲中的日志写出去
+            m_logger->flushAppenders();
+        }
+    }
+}
+
+void PerThreadLogWorker::stop()
+{
+    m_stop.store(true, std::memory_order_seq_cst);
+    {
+        // 等待空位的生产者醒来后自己输出
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cond.notify_one();
+        m_doneCond.notify_all();
+    }
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+
+    std::vector<std::shared_ptr<Queue>> queues;
+    {
+        std::lock_guard<std::mutex> lock(m_queuesMutex);
+        queues = m_queues;
+    }
+    std::lock_guard<std::mutex> lock(m_drainMutex);
+    while (drain(queues) > 0) {}
+}
+
+void PerThreadLogWorker::flush()
+{
+    std::vector<std::pair<std::shared_ptr<Queue>, uint64_t>> targets;
+    {
+        std::lock_guard<std::mutex> lock(m_queuesMutex);
+        for (auto& it : m_queues)
+        {
+            targets.push_back(std::make_pair(it, it->ring.pushed()));
+        }
+    }
+    wakeup();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (auto& it : targets)
+    {
+        while (it.first->done.load(std::memory_order_acquire) < it.second)
+        {
+            m_doneCond.wait_for(lock, std::chrono::milliseconds(10));
+        }
+    }
+}
+
+uint64_t PerThreadLogWorker::getDropped() const
+{
+    uint64_t dropped = m_retiredDropped.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(m_queuesMutex);
+    for (auto& it : m_queues)
+    {
+        dropped += it->dropped.load(std::memory_order_relaxed);
+    }
+    return dropped;
+}
+
+size_t PerThreadLogWorker::getQueueCount()
+{
+    std::lock_guard<std::mutex> lock(m_queuesMutex);
+    return m_queues.size();
+}
+
+LogEventWrap::LogEventWrap(const Logger::ptr& logger, LogEvent::ptr event)
+    : m_logger(logger.get()), m_event(std::move(event))
+{}
+
+LogEventWrap::~LogEventWrap()
+{
+    // 析构时自动调用log，事件的所有权转交给日志器
+    m_logger->log(std::move(m_event));
+}
+
+
+LogStream& LogEventWrap::getSs()
+{
+    return m_event->getSs();
+}
+
+
+LogManager::Table::Table(size_t capacity)
+    : mask(capacity - 1), slots(new std::atomic<Entry*>[capacity])
+{
+    for (size_t i = 0; i < capacity; ++i)
+    {
+        slots[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+LogManager::LogManager()
+    : m_table(nullptr), m_count(0)
+{
+    m_root = Logger::ptr(new Logger("root"));
+
+    m_tables.emplace_back(new Table(64));
+    m_table.store(m_tables.back().get(), std::memory_order_release);
+
+    Entry* entry = new Entry{Hash(m_root->getName()), m_root};
+    m_entries.emplace_back(entry);
+    insert(entry);
+}
+
+size_t LogManager::Hash(std::string_view name)
+{
+    // FNV-1a，日志器名字都很短，没必要用更复杂的算法
+    size_t hash = 14695981039346656037ULL;
+    for (char c : name)
+    {
+        hash ^= (unsigned char)c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+const LogManager::Entry* LogManager::find(std::string_view name, size_t hash) const
+{
+    const Table* table = m_table.load(std::memory_order_acquire);
+    for (size_t i = hash & table->mask; ; i = (i + 1) & table->mask)
+    {
+        // 负载不超过一半，一定能遇到空槽位
+        const Entry* entry = table->slots[i].load(std::memory_order_acquire);
+        if (!entry)
+        {
+            return nullptr;
+        }
+        if (entry->hash == hash && entry->logger->getName() == name)
+        {
+            return entry;
+        }
+    }
+}
+
+void LogManager::insert(Entry* entry)
+{
+    Table* table = m_table.load(std::memory_order_relaxed);
+    if ((m_count + 1) * 2 > table->mask + 1)
+    {
+        // 新表填好之后再发布，查找方要么看到完整的旧表，要么看到完整的新表
+        Table* bigger = new Table((table->mask + 1) * 2);
+        m_tables.emplace_back(bigger);
+        for (size_t i = 0; i <= table->mask; ++i)
+        {
+            Entry* it = table->slots[i].load(std::memory_order_relaxed);
+            if (!it)
+            {
+                continue;
+            }
+            size_t j = it->hash & bigger->mask;
+            while (bigger->slots[j].load(std::memory_order_relaxed))
+            {
+                j = (j + 1) & bigger->mask;
+            }
+            bigger->slots[j].store(it, std::memory_order_relaxed);
+        }
+        m_table.store(bigger, std::memory_order_release);
+        table = bigger;
+    }
+
+    size_t i = entry->hash & table->mask;
+    while (table->slots[i].load(std::memory_order_relaxed))
+    {
+        i = (i + 1) & table->mask;
+    }
+    table->slots[i].store(entry, std::memory_order_release);
+    ++m_count;
+}
+
+Logger::ptr LogManager::findLogger(const std::string& name) const
+{
+    if (name.empty())
+    {
+        return m_root;
+    }
+    const Entry* entry = find(name, Hash(name));
+    return entry ? entry->logger : nullptr;
+}
+
+Logger::ptr LogManager::getLogger(const std::string& name)
+{
+    if (name.empty())
+    {
+        return m_root;
+    }
+
+    size_t hash = Hash(name);
+    const Entry* entry = find(name, hash);
+    if (entry)
+    {
+        return entry->logger;
+    }
+
+    // 先取得上级，上级同样可能需要创建
+    size_t dot = name.rfind('.');
+    Logger::ptr parent = dot == std::string::npos ? m_root : getLogger(name.substr(0, dot));
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // 可能已经被其他线程创建了
+    entry = find(name, hash);
+    if (entry)
+    {
+        return entry->logger;
+    }
+
+    Logger::ptr logger(new Logger(name));
+    parent->addChild(logger.get());
+    Entry* created = new Entry{hash, logger};
+    m_entries.emplace_back(created);
+    insert(created);
+    return logger;
+}
+
+Logger::ptr LogManager::getRoot()
+{
+    return m_root;
+}
+
+std::vector<LogStatsSnapshot> LogManager::getStats() const
+{
+    std::vector<Logger::ptr> loggers;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& it : m_entries)
+        {
+            loggers.push_back(it->logger);
+        }
+    }
+
+    std::vector<LogStatsSnapshot> stats;
+    for (auto& it : loggers)
+    {
+        LogStatsSnapshot snap = it->getStats().snapshot(it->getName());
+        if (!snap.empty())
+        {
+            stats.push_back(std::move(snap));
+        }
+    }
+    return stats;
+}
+
+std::string LogManager::dumpStats(bool json) const
+{
+    std::vector<LogStatsSnapshot> stats = getStats();
+    return json ? LogStats::ToJson(stats) : LogStats::ToText(stats);
+}
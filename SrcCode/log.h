@@ -5,6 +5,7 @@
 #include <iostream>
 #include <cstring>
 #include <string>
+#include <string_view>
 #include <memory>
 #include <vector>
 #include <tuple>
@@ -16,26 +17,76 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/syscall.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#include <limits>
+#include <algorithm>
+#include <cerrno>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "singleton.h"
+#include "ringbuffer.h"
+#include "log_stream.h"
+#include "log_args.h"
+#include "clock.h"
+#include "thread.h"
+#include "log_stats.h"
+#include "epoch.h"
 
 
 using std::cout;
 using std::endl;
 
 // 通过宏定义简化调用
+// 时间戳传0，由LogEvent自己读取带亚秒精度的当前时间
+// 先比较日志等级，被过滤掉的日志只付出一次分支判断的代价：
+// 不会构造LogEvent，<<右边的表达式也不会被求值
+// 线程号和协程号取自线程局部存储(ThreadInfo)，不会进入内核
+// 写成 if {} else 的形式是为了避免宏外层的else被错误地匹配到这里的if
 // c++风格的宏定义
 #define LOG_LEVEL_CPP(logger, level) \
-    LogEventWrap(logger, LogEvent::ptr(new LogEvent(                  \
+    if ((level) < (logger)->getLevel()) {} \
+    else LogEventWrap(logger, LogEvent::Create(                  \
                  level, __FILE__, __LINE__, 0,    \
-                syscall(SYS_gettid), 1, time(0), logger->getName())))                  \
+                ThreadInfo::GetThreadId(), ThreadInfo::GetFiberId(), 0, logger->getName()))                  \
                 .getSs()
 
 // C语言风格的宏定义
 #define LOG_LEVEL_C(logger, level, message) \
-    LogEventWrap(logger, LogEvent::ptr(new LogEvent(level, __FILE__, __LINE__, 0,    \
-                syscall(SYS_gettid), 1, time(0), logger->getName())))                  \
+    if ((level) < (logger)->getLevel()) {} \
+    else LogEventWrap(logger, LogEvent::Create(level, __FILE__, __LINE__, 0,    \
+                ThreadInfo::GetThreadId(), ThreadInfo::GetFiberId(), 0, logger->getName()))                  \
                 .getSs() << message
 
+// 延迟格式化的宏：LOG_INFO(logger, "user {} took {} ms", id, ms)
+// 参数按值编码进事件的内联缓冲区(编码方式见log_args.h)，转换成文本和拼接都推迟到
+// 第一次格式化这条日志时；异步模式下由后台线程完成，业务线程只做几次memcpy
+// 格式串必须是字符串字面量，事件中只保存它的指针；{}的个数与参数个数在编译期检查(LogFormatString)
+// 同样的参数用LOG_LEVEL_CPP的<<输出，得到的消息完全相同
+#define LOG_FMT(logger, level, fmt, ...) \
+    if ((level) < (logger)->getLevel()) {} \
+    else (logger)->log(LogEvent::CreateDeferred(level, __FILE__, __LINE__, (logger)->getName(), \
+                                                fmt __VA_OPT__(,) __VA_ARGS__))
+
+#define LOG_DEBUG(logger, fmt, ...) LOG_FMT(logger, LogLevel::DEBUG, fmt __VA_OPT__(,) __VA_ARGS__)
+#define LOG_INFO(logger, fmt, ...) LOG_FMT(logger, LogLevel::INFO, fmt __VA_OPT__(,) __VA_ARGS__)
+#define LOG_WARNING(logger, fmt, ...) LOG_FMT(logger, LogLevel::WARNING, fmt __VA_OPT__(,) __VA_ARGS__)
+#define LOG_ERROR(logger, fmt, ...) LOG_FMT(logger, LogLevel::ERROR, fmt __VA_OPT__(,) __VA_ARGS__)
+#define LOG_FATAL(logger, fmt, ...) LOG_FMT(logger, LogLevel::FATAL, fmt __VA_OPT__(,) __VA_ARGS__)
+
+// 按名字取日志器，结果缓存在调用点的静态变量里，之后再经过这里不需要任何查找
+// name必须在每次执行时都相同，例如字符串字面量：LOG_LEVEL_CPP(LOG_NAME("db.pool"), LogLevel::INFO) << ...
+#define LOG_NAME(name) \
+    ([]() -> const Logger::ptr& {                                               \
+        static const Logger::ptr s_logger = Manager::getSingletion()->getLogger(name); \
+        return s_logger;                                                        \
+    }())
+
 
 
 // 包含日志等级
@@ -53,6 +104,7 @@ public:
     };
 
     static const std::string toString(LogLevel::Level level);
+    static const char* toChars(LogLevel::Level level);        // 不分配内存的版本
 
 private:
 };
@@ -63,27 +115,102 @@ private:
 class LogEvent
 {
 public:
-    typedef std::shared_ptr<LogEvent> ptr;
+    // 从对象池取出的事件放回池中，直接new出来的事件delete掉
+    struct Recycler
+    {
+        void operator()(LogEvent* event) const;
+    };
+    // 独占所有权：同步输出时由LogEventWrap持有，异步输出时随队列转交给后台线程，
+    // 用完之后回到对象池，整个过程没有引用计数
+    typedef std::unique_ptr<LogEvent, Recycler> ptr;
 
+    // time为0时只记录当前的时钟计数(Clock::Now)，时间和运行时长在读取时才换算，
+    // 这时elapse传0表示由计数换算运行时长
     LogEvent(LogLevel::Level level, const char* file, int32_t m_line, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time, std::string logger_name);
 
+    // 从当前线程的对象池中取一个事件并初始化，参数含义与构造函数相同
+    static ptr Create(LogLevel::Level level, const char* file, int32_t line, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time, const std::string& logger_name);
+
+    // 延迟格式化的事件，参数编码后保存，消息在第一次读取时才生成，见LOG_FMT
+    template<class... Args>
+    static ptr CreateDeferred(LogLevel::Level level, const char* file, int32_t line, const std::string& logger_name,
+                              LogFormatString<std::type_identity_t<Args>...> fmt, const Args&... args)
+    {
+        ptr event = Create(level, file, line, 0, ThreadInfo::GetThreadId(), ThreadInfo::GetFiberId(), 0, logger_name);
+        event->setArgs<std::decay_t<decltype(LogArgs::Prepare(args))>...>(fmt.str, LogArgs::Prepare(args)...);
+        return event;
+    }
+
     // 一系列的set和get
     const char* getFile() const { return m_file;}
     int32_t getLine() const { return m_line;}
-    uint32_t getElapse() const { return m_elapse;}
+    uint32_t getElapse() const { return m_ticks && !m_elapse ? Clock::ToElapsedMs(m_ticks) : m_elapse; }
     uint32_t getThreadId() const { return m_threadId;}
     uint32_t getFiberId() const { return m_fiberId;}
-    uint64_t getTime() const { return m_time;}
+    const char* getThreadName() const { return m_threadName; }
+    uint64_t getTime() const { resolveTime(); return m_time; }
+    uint32_t getMicroseconds() const { resolveTime(); return m_usec; }   // 秒内的微秒数
+    uint64_t getTicks() const { return m_ticks; }                 // 创建时的时钟计数，指定了时间的事件为0
     LogLevel::Level getLevel() const { return m_level;}
-    std::string getLoggerName() const { return m_logger_name; }
-    std::string getContext() const { return m_message.str(); }
-    std::stringstream& getSs() { return m_message; }
+    const std::string& getLoggerName() const { return m_logger_name; }
+    // 延迟格式化的事件在第一次读取消息时生成文本
+    // 事件同一时刻只属于一个线程，所以在const函数里生成也不需要同步
+    std::string getContext() const { render(); return m_message.str(); }
+    std::string_view getMessage() const { render(); return m_message.view(); }  // 不拷贝的版本
+    LogStream& getSs() { render(); return m_message; }
+    bool isDeferred() const { return m_fmt != nullptr; }       // 消息是否还没有生成
+
+    // 直接指定时间，用于还原事先记录下来的事件
+    void setTime(uint64_t time, uint32_t usec) { m_ticks = 0; m_time = time; m_usec = usec; }
+    // 创建时取的是当前线程的名字，还原别的线程的事件时需要重新指定
+    void setThreadName(const char* name);
 
 
     // 提供时间戳转化成年月日
     static const std::string getLocalTimeFromTimestamp(time_t timestamp); 
 
 
+private:
+    LogEvent() {}
+
+    template<class... Args>
+    void setArgs(const char* fmt, const Args&... args)
+    {
+        char* p = m_message.extend(LogArgs::Size(args...));
+        if (!p)
+        {
+            m_message << fmt;
+            return;
+        }
+        LogArgs::Encode(p, args...);
+        m_fmt = fmt;
+        m_signature = BinaryArgSignature<Args...>::value;
+    }
+
+    void render() const
+    {
+        if (m_fmt)
+        {
+            renderDeferred();
+        }
+    }
+    void renderDeferred() const;
+
+    // 由计数换算时间只做一次，秒和微秒来自同一个锚点，锚点在两次读取之间更新也不会错开
+    void resolveTime() const
+    {
+        if (m_ticks && !m_time)
+        {
+            uint64_t ns = Clock::ToWallNanoseconds(m_ticks);
+            m_time = ns / 1000000000ULL;
+            m_usec = ns % 1000000000ULL / 1000;
+        }
+    }
+
+    void init(LogLevel::Level level, const char* file, int32_t line, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time);
+
+    friend class LogEventPool;
+
 private:
     LogLevel::Level m_level;       //日志级别           
     const char* m_file = nullptr;  //文件名
@@ -91,9 +218,51 @@ private:
     uint32_t m_elapse = 0;         //程序启动开始到现在的毫秒数
     uint32_t m_threadId = 0;       //线程id
     uint32_t m_fiberId = 0;        //协程id
-    uint64_t m_time = 0;           //时间戳
+    char m_threadName[ThreadInfo::NAME_SIZE] = {};  //线程名，拷贝一份，线程退出后仍然可以格式化
+    mutable uint64_t m_time = 0;   //时间戳，由计数换算时第一次读取时才填上
+    mutable uint32_t m_usec = 0;   //时间戳秒内的微秒数
+    uint64_t m_ticks = 0;          //创建时的时钟计数，不为0时时间戳由它换算
     std::string m_logger_name;     //日志器名称
-    std::stringstream m_message;   //定制消息 
+    mutable LogStream m_message;   //定制消息，短消息不需要堆分配；延迟格式化时先存放编码后的参数
+    mutable const char* m_fmt = nullptr;        //延迟格式化的格式串，生成消息后置空
+    const char* m_signature = nullptr;          //延迟格式化的参数签名
+
+    LogEvent* m_next = nullptr;    //对象池空闲链表
+    const void* m_pool = nullptr;  //所属对象池，直接new出来的为空
+};
+
+// LogEvent对象池
+// 每个线程一个空闲链表，本线程取、本线程还都不需要任何同步
+// 异步输出时事件在后台线程用完，先攒在后台线程本地，再整批挂到全局的回收栈上；
+// 业务线程的空闲链表用完时一次取走回收栈上的一段，所以平均每条日志不到一次原子操作
+class LogEventPool
+{
+public:
+    enum
+    {
+        MAX_FREE = 1024,                               // 每个线程最多缓存的空闲事件
+        RETURN_BATCH = 64,                             // 归还给其他线程时攒够多少条挂一次
+        TAKE_BATCH = 256                               // 从全局回收栈一次最多取走多少条
+    };
+
+    static LogEvent* Acquire();
+    static void Release(LogEvent* event);
+    // 把本线程攒下的、属于其他线程的事件挂到全局回收栈
+    static void FlushReturns();
+
+    ~LogEventPool();
+private:
+    LogEvent* acquire();
+    void release(LogEvent* event);
+    void flushReturns();
+
+private:
+    LogEvent* m_free = nullptr;                        // 本线程的空闲链表
+    size_t m_freeCount = 0;
+    LogEvent* m_returnHead = nullptr;                  // 待归还给其他线程的事件
+    LogEvent* m_returnTail = nullptr;
+    size_t m_returnCount = 0;
+    static std::atomic<LogEvent*> s_returned;          // 全局回收栈
 };
 
 
@@ -112,6 +281,7 @@ private:
 // *  %l 行号
 // *  %T 制表符
 // *  %F 协程id
+// *  %N 线程名
 
 class LogFormatter
 {
@@ -121,7 +291,14 @@ public:
 
     void init();                                                     // 初始化，解析传入的格式
 
-    std::string format(LogEvent::ptr event);
+    // 追加到out后面，子类只需要重写这一个
+    virtual void format(LogStream& out, const LogEvent::ptr& event);
+    std::string format(const LogEvent::ptr& event);
+    // 直接渲染到调用者提供的缓冲区，返回完整日志需要的长度
+    // 返回值大于len时缓冲区中的内容不完整，调用者应换一块足够大的缓冲区重试
+    size_t format(char* buf, size_t len, const LogEvent::ptr& event);
+
+    const std::string& getPattern() const { return m_pattern; }
 
 
     // 定义类，用于解析各种格式对应的内容
@@ -131,11 +308,15 @@ public:
         typedef std::shared_ptr<FormatItem> ptr;
         FormatItem() {}
         virtual ~FormatItem() {}
-        virtual void format(std::ostream& os, LogEvent::ptr ptr) = 0; 
+        virtual void format(LogStream& os, const LogEvent::ptr& ptr) = 0; 
     private:
     };
 
-    ~LogFormatter() {}
+    virtual ~LogFormatter() {}
+protected:
+    // 供在编译期解析格式的子类使用，只保存格式串，不做运行期解析，也不分配FormatItem
+    struct NoParse {};
+    LogFormatter(const std::string& pattern, NoParse);
 private:
     const std::string m_pattern;
     std::vector<std::tuple<std::string, std::string, int>> m_items;  // 存储形式 普通字符 其子串 是否存在     
@@ -147,9 +328,9 @@ class MessageFormatItem : public LogFormatter::FormatItem
 {
 public:
     MessageFormatItem(const std::string& str = "") {}
-    virtual void format(std::ostream& os, LogEvent::ptr event) override
+    virtual void format(LogStream& os, const LogEvent::ptr& event) override
     {
-        os << event->getContext();
+        os << event->getMessage();
     }
 private:
 };
@@ -157,7 +338,7 @@ private:
 class LevelFormatItem : public LogFormatter::FormatItem {
 public:
     LevelFormatItem(const std::string& str = "") {}
-    virtual void format(std::ostream& os, LogEvent::ptr event) override 
+    virtual void format(LogStream& os, const LogEvent::ptr& event) override 
     {
         os << LogLevel::toString(event->getLevel());
     }
@@ -167,7 +348,7 @@ public:
 class ElapseFormatItem : public LogFormatter::FormatItem {
 public:
     ElapseFormatItem(const std::string& str = "") {}
-    virtual void format(std::ostream& os, LogEvent::ptr event) override
+    virtual void format(LogStream& os, const LogEvent::ptr& event) override
     {
         os << event->getElapse();
     }
@@ -176,16 +357,25 @@ public:
 class NameFormatItem : public LogFormatter::FormatItem {
 public:
     NameFormatItem(const std::string& str = "") {}
-    virtual void format(std::ostream& os, LogEvent::ptr event) override 
+    virtual void format(LogStream& os, const LogEvent::ptr& event) override 
     {
         os << event->getLoggerName();
     }
 };
 
+class ThreadNameFormatItem : public LogFormatter::FormatItem {
+public:
+    ThreadNameFormatItem(const std::string& str = "") {}
+    virtual void format(LogStream& os, const LogEvent::ptr& event) override 
+    {
+        os << event->getThreadName();
+    }
+};
+
 class ThreadIdFormatItem : public LogFormatter::FormatItem {
 public:
     ThreadIdFormatItem(const std::string& str = "") {}
-    virtual void format(std::ostream& os, LogEvent::ptr event) override 
+    virtual void format(LogStream& os, const LogEvent::ptr& event) override 
     {
         os << event->getThreadId();
     }
@@ -194,38 +384,56 @@ public:
 class FiberIdFormatItem : public LogFormatter::FormatItem {
 public:
     FiberIdFormatItem(const std::string& str = "") {}
-    virtual void format(std::ostream& os, LogEvent::ptr event) override 
+    virtual void format(LogStream& os, const LogEvent::ptr& event) override 
     {
         os << event->getFiberId();
     }
 };
 
+// 时间格式化
+// 在strftime的基础上增加 %L(3位毫秒) 和 %f(6位微秒)，只识别第一个出现的亚秒格式
+// localtime_r在glibc里会对时区加全局锁，所以渲染结果按秒缓存在线程局部存储中，
+// 同一秒内的日志只在第一次时调用localtime_r和strftime，之后只拼接亚秒部分
+class DateTimeFormat
+{
+public:
+    DateTimeFormat(const std::string& format = "%Y-%m-%d %H:%M:%S");
+
+    // 写入buf，返回写入的长度
+    size_t format(char* buf, size_t len, time_t sec, uint32_t usec) const;
+
+    const std::string& getFormat() const { return m_format; }
+private:
+    size_t render(char* buf, size_t len, const struct tm& tm, uint32_t usec) const;
+
+private:
+    std::string m_format;
+    std::string m_head;            // 亚秒之前的strftime格式
+    std::string m_tail;            // 亚秒之后的strftime格式
+    int m_digits = 0;              // 亚秒位数，0、3或6
+    uint32_t m_id = 0;             // 缓存的键，每个对象唯一
+};
+
 class DateTimeFormatItem : public LogFormatter::FormatItem {
 public:
     DateTimeFormatItem(const std::string& format = "%Y-%m-%d %H:%M:%S")
-        :m_format(format) {
-        if(m_format.empty()) {
-            m_format = "%Y-%m-%d %H:%M:%S";
-        }
+        :m_format(format.empty() ? "%Y-%m-%d %H:%M:%S" : format) {
     }
 
-    virtual void format(std::ostream& os, LogEvent::ptr event) override 
+    virtual void format(LogStream& os, const LogEvent::ptr& event) override 
     {
-        struct tm tm;
-        time_t time = event->getTime();
-        localtime_r(&time, &tm);
-        char buf[64];
-        strftime(buf, sizeof(buf), m_format.c_str(), &tm);
-        os << buf;
+        char buf[128];
+        size_t len = m_format.format(buf, sizeof(buf), event->getTime(), event->getMicroseconds());
+        os.append(buf, len);
     }
 private:
-    std::string m_format;
+    DateTimeFormat m_format;
 };
 
 class FilenameFormatItem : public LogFormatter::FormatItem {
 public:
     FilenameFormatItem(const std::string& str = "") {}
-    virtual void format(std::ostream& os, LogEvent::ptr event) override 
+    virtual void format(LogStream& os, const LogEvent::ptr& event) override 
     {
         os << event->getFile();
     }
@@ -234,7 +442,7 @@ public:
 class LineFormatItem : public LogFormatter::FormatItem {
 public:
     LineFormatItem(const std::string& str = "") {}
-    virtual void format(std::ostream& os, LogEvent::ptr event) override 
+    virtual void format(LogStream& os, const LogEvent::ptr& event) override 
     {
         os << event->getLine();
     }
@@ -243,7 +451,7 @@ public:
 class NewLineFormatItem : public LogFormatter::FormatItem {
 public:
     NewLineFormatItem(const std::string& str = "") {}
-    virtual void format(std::ostream& os, LogEvent::ptr event) override 
+    virtual void format(LogStream& os, const LogEvent::ptr& event) override 
     {
         os << std::endl;
     }
@@ -253,7 +461,7 @@ class StringFormatItem : public LogFormatter::FormatItem {
 public:
     StringFormatItem(const std::string& str)
         :m_string(str) {}
-    virtual void format(std::ostream& os, LogEvent::ptr event) override 
+    virtual void format(LogStream& os, const LogEvent::ptr& event) override 
     {
         os << m_string;
     }
@@ -264,7 +472,7 @@ private:
 class TabFormatItem : public LogFormatter::FormatItem {
 public:
     TabFormatItem(const std::string& str = "") {}
-    virtual void format(std::ostream& os, LogEvent::ptr event) override 
+    virtual void format(LogStream& os, const LogEvent::ptr& event) override 
     {
         os << "\t";
     }
@@ -274,49 +482,385 @@ private:
 
 
 // 日志输出器
+// 格式器通过原子指针读取，被替换下来的格式器一直保留到输出器销毁，
+// 所以写日志时读格式器不需要加锁；真正写出时由各个子类按需加锁
 class LogAppender
 {
 public:
     typedef std::shared_ptr<LogAppender> ptr;
-    virtual void log(LogEvent::ptr event) = 0; 
+    LogAppender();                                     // 使用默认格式
+    virtual void log(const LogEvent::ptr& event) = 0; 
+    virtual void flush() {}                            // 把缓冲中的日志写出去，默认没有缓冲
     virtual ~LogAppender() {}
-    void setFormatter(LogFormatter::ptr val) { m_formatter = val;}
-    LogFormatter::ptr& getFormatter() { return m_formatter; }
+    void setFormatter(LogFormatter::ptr val);
+    // 当前格式器，只在EpochGuard区间内有效，旧的格式器由EpochReclaimer回收
+    LogFormatter* getFormatter() const { return m_formatter.load(std::memory_order_acquire); }
+protected:
+    // 用当前格式器格式化，统计打开时记录格式化的耗时和字节数，子类应通过它们格式化
+    void format(LogStream& out, const LogEvent::ptr& event);
+    size_t format(char* buf, size_t len, const LogEvent::ptr& event);
 private:
-    LogFormatter::ptr m_formatter;
+    std::atomic<LogFormatter*> m_formatter;
+    std::mutex m_formatterMutex;
+    LogFormatter::ptr m_current;                       // 持有当前格式器，受m_formatterMutex保护
 };
 
 // 输出到控制台
 class StdoutLogAppender : public LogAppender
 {
 public:
-    virtual void log(LogEvent::ptr event) override;
+    virtual void log(const LogEvent::ptr& event) override;
     virtual ~StdoutLogAppender() {}
+};
+
+// 基于内存映射的文件输出
+// 文件用fallocate预先分配空间，映射一段滑动窗口，格式器直接把日志渲染进映射区，
+// 省去format返回的std::string以及write的内核拷贝；窗口写满后映射下一段
+// 数据写进映射区后就已经在page cache中，进程崩溃也不会丢失(机器掉电除外)
+// 正常关闭时把文件截断到实际长度；崩溃后文件尾部会残留预分配的0，下次打开时会跳过
+class MmapFileAppender : public LogAppender
+{
+public:
+    typedef std::shared_ptr<MmapFileAppender> ptr;
+    MmapFileAppender(const std::string& file, size_t window_size = 64 * 1024 * 1024);
+    virtual ~MmapFileAppender();
+    virtual void log(const LogEvent::ptr& event) override;
+    virtual void flush() override;                     // 通知内核异步回写，不会阻塞
+
+    const std::string& getFile() const { return m_file; }
+    uint64_t getRemapCount() const { return m_remaps; }
 private:
+    bool remap(size_t need);                           // 调用者需持有m_mutex
+    uint64_t findDataEnd(uint64_t file_size);
+
+private:
+    std::string m_file;
+    int m_fd = -1;
+    std::mutex m_mutex;
+    size_t m_windowSize;
+    char* m_map = nullptr;                             // 当前窗口的起始地址
+    uint64_t m_mapOffset = 0;                          // 当前窗口在文件中的偏移
+    size_t m_mapSize = 0;
+    uint64_t m_offset = 0;                             // 下一条日志写入的文件偏移
+    uint64_t m_remaps = 0;
 };
 
 // 输出到文件
+// 文件以O_APPEND只打开一次，格式化后的日志先积累在用户态缓冲区中，
+// 缓冲区写满或者距上次写盘超过flush_interval_ms时，用一次write批量写出
+// FATAL日志会立即写出，保证进程随后崩溃也不会丢失
 class FileAppender : public LogAppender
 {
 public:
-    FileAppender(const std::string file);
-    virtual void log(LogEvent::ptr event) override;
-    virtual ~FileAppender() {}
-private:
+    typedef std::shared_ptr<FileAppender> ptr;
+    FileAppender(const std::string file, size_t buffer_size = 1024 * 1024, uint32_t flush_interval_ms = 1000);
+    virtual void log(const LogEvent::ptr& event) override;
+    virtual void flush() override;
+    virtual ~FileAppender();
+
+    bool reopen();                                     // 重新打开文件，例如文件被外部移走之后
+    const std::string& getFile() const { return m_file; }
+    uint64_t getWriteCount() const { return m_writes; } // write系统调用的次数
+protected:
+    // 供子类使用，不打开任何文件
+    FileAppender(size_t buffer_size, uint32_t flush_interval_ms);
+
+    // 每条日志写入缓冲之前调用，调用者持有m_mutex，子类可以在这里切换文件
+    virtual void beforeAppend(const LogEvent::ptr& event, size_t len) {}
+
+    bool reopenLocked();                               // 以下函数调用者需持有m_mutex
+    void append(const char* data, size_t len);
+    void flushLocked();
+    bool writeAll(const char* data, size_t len);
+    static uint64_t NowMs();
+
+protected:
     std::string m_file;                                // 目的文件名称
+    int m_fd = -1;
+    uint64_t m_fileSize = 0;                           // 当前文件大小，包括缓冲中还未写出的部分
+    std::mutex m_mutex;
+    std::vector<char> m_buffer;                        // 用户态缓冲区
+    size_t m_used = 0;                                 // 缓冲区已使用的字节数
+    uint32_t m_flushInterval;                          // 定时写盘的间隔(毫秒)
+    uint64_t m_lastFlush = 0;                          // 上次写盘的时间(毫秒)
+    uint64_t m_writes = 0;
+};
+
+// 后台压缩线程，负责关闭被切换掉的日志文件、压缩成.gz，并只保留最近的若干份
+class LogFileCompressor
+{
+public:
+    LogFileCompressor(size_t max_files, bool compress);
+    ~LogFileCompressor();
+
+    // 把已经写完的文件交给后台，fd由后台关闭
+    void submit(int fd, const std::string& file);
+    // 启动时发现的历史文件，按时间从旧到新的顺序加入
+    void addHistory(const std::string& file, bool need_compress);
+
+private:
+    void run();
+    bool compressFile(const std::string& file, const std::string& gz);
+    void prune();                                      // 删除超出保留数量的旧文件，调用者需持有m_mutex
+
+private:
+    struct Task
+    {
+        int fd;
+        std::string file;
+    };
+
+    size_t m_maxFiles;                                 // 保留的历史文件数量，0表示不限制
+    bool m_compress;
+    bool m_stop = false;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::vector<Task> m_tasks;
+    std::vector<std::string> m_history;                // 已归档的文件，从旧到新
+    std::thread m_thread;
+};
+
+// 按大小和时间切分的文件输出
+// 当前写入的文件名为 base.时间段[.序号]，例如按天切分时为 app.log.20231018、app.log.20231018.1
+// 切换时只需要打开一个新文件，不需要rename；旧文件的关闭、压缩和清理都交给后台线程
+class RotatingFileAppender : public FileAppender
+{
+public:
+    typedef std::shared_ptr<RotatingFileAppender> ptr;
+
+    // 按时间切分的周期
+    enum RollPeriod
+    {
+        NONE = 0,         // 只按大小切分
+        HOURLY = 1,
+        DAILY = 2
+    };
+
+    RotatingFileAppender(const std::string& base, size_t max_size = 256 * 1024 * 1024,
+                         RollPeriod period = DAILY, size_t max_files = 7, bool compress = true,
+                         size_t buffer_size = 1024 * 1024, uint32_t flush_interval_ms = 1000);
+    virtual ~RotatingFileAppender();
+
+    const std::string& getBase() const { return m_base; }
+    uint64_t getRotateCount() const { return m_rotates; }
+protected:
+    virtual void beforeAppend(const LogEvent::ptr& event, size_t len) override;
+
+private:
+    void rotateLocked(time_t now);                     // 调用者需持有m_mutex
+    void openPeriodLocked(time_t now);                 // 打开now所在时间段的文件
+    void scanHistory();
+    std::string periodStamp(time_t now, time_t* next) const;
+
+private:
+    std::string m_base;
+    size_t m_maxSize;
+    RollPeriod m_period;
+    std::string m_stamp;                               // 当前时间段
+    time_t m_nextRoll = 0;                             // 下一次按时间切分的时刻
+    uint32_t m_index = 0;                              // 同一时间段内按大小切分的序号
+    uint64_t m_rotates = 0;
+    LogFileCompressor m_compressor;
+};
+
+class Logger;
+
+// 异步日志后台的接口
+// 调用线程只把日志事件交给后台，由后台线程格式化并写入各个输出地
+// 这样业务线程的延迟不再受终端或磁盘速度的影响
+class AsyncLogBackend
+{
+public:
+    typedef std::shared_ptr<AsyncLogBackend> ptr;
+
+    // 队列满时的处理策略
+    enum OverflowPolicy
+    {
+        BLOCK = 0,          // 阻塞等待，直到队列有空位
+        DROP_NEWEST = 1,    // 丢弃当前这条日志
+        DROP_OLDEST = 2     // 丢弃队列中最旧的日志，为当前这条腾出位置
+    };
+
+    // 后台的实现方式
+    enum Mode
+    {
+        SHARED_QUEUE = 0,   // 所有线程共用一个无锁队列，见AsyncLogWorker
+        PER_THREAD = 1      // 每个线程一个单生产者队列，见PerThreadLogWorker
+    };
+
+    virtual ~AsyncLogBackend() {}
+
+    // 投递日志事件，被丢弃时返回false；后台已经停止时在调用线程同步输出
+    virtual bool push(LogEvent::ptr event) = 0;
+
+    // 写完队列中剩余的日志并回收后台线程，可以重复调用
+    virtual void stop() = 0;
+
+    // 阻塞直到调用前投递的日志全部被后台线程处理完毕
+    virtual void flush() = 0;
+
+    virtual uint64_t getDropped() const = 0;
+};
+
+// 共享队列的异步后台
+// 所有线程把事件压入同一个有界无锁队列(多生产者)，由一个后台线程取出
+class AsyncLogWorker : public AsyncLogBackend
+{
+public:
+    typedef std::shared_ptr<AsyncLogWorker> ptr;
+
+    AsyncLogWorker(Logger* logger, size_t capacity = 8192, OverflowPolicy policy = BLOCK);
+    ~AsyncLogWorker();
+
+    virtual bool push(LogEvent::ptr event) override;
+    virtual void stop() override;
+    virtual void flush() override;
+
+    OverflowPolicy getPolicy() const { return m_policy; }
+    virtual uint64_t getDropped() const override { return m_dropped.load(std::memory_order_relaxed); }
+    size_t getCapacity() const { return m_queue.capacity(); }
+
+private:
+    void run();
+    void wakeup();
+    void drain();                                      // 在当前线程写完队列中的日志
+
+private:
+    Logger* m_logger;                                  // 所属日志器，生命周期长于本对象
+    OverflowPolicy m_policy;
+    RingBuffer<LogEvent::ptr> m_queue;
+    std::atomic<uint64_t> m_pushed;                    // 成功入队的数量
+    std::atomic<uint64_t> m_done;                      // 已处理(包括被挤掉)的数量
+    std::atomic<uint64_t> m_dropped;                   // 被丢弃的数量
+    std::atomic<bool> m_sleeping;                      // 后台线程是否在等待
+    std::atomic<bool> m_stop;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;                    // 唤醒后台线程
+    std::condition_variable m_doneCond;                // 通知flush的调用者
+    std::thread m_thread;
+};
+
+// 每个线程一个队列的异步后台
+// 线程第一次写日志时创建自己的单生产者单消费者队列并登记到后台，之后投递只写自己的队列，
+// 线程之间没有共享的写位置，线程很多时也不会在队尾上竞争
+// 后台线程每轮把各个队列中已有的事件整段取出，各段本来就按时间有序，k路归并后整批交给输出地，
+// 同一线程的日志保持原有顺序，不同线程之间按创建时刻排序
+// 队列只能由后台线程出队，所以DROP_OLDEST按DROP_NEWEST处理
+// BLOCK策略下队列满的线程睡眠等待后台取走一批，不空转，线程数多于CPU时不和后台抢时间片
+class PerThreadLogWorker : public AsyncLogBackend
+{
+public:
+    typedef std::shared_ptr<PerThreadLogWorker> ptr;
+
+    // capacity为每个线程的队列长度
+    PerThreadLogWorker(Logger* logger, size_t capacity = 1024, OverflowPolicy policy = BLOCK);
+    ~PerThreadLogWorker();
+
+    virtual bool push(LogEvent::ptr event) override;
+    virtual void stop() override;
+    virtual void flush() override;
+    virtual uint64_t getDropped() const override;
+
+    OverflowPolicy getPolicy() const { return m_policy; }
+    size_t getCapacity() const { return m_capacity; }
+    size_t getQueueCount();                            // 当前登记的队列数
+
+    // 一个线程的队列，由线程局部存储和后台共同持有
+    struct Queue
+    {
+        explicit Queue(size_t capacity) : ring(capacity) {}
+
+        SpscRingBuffer<LogEvent::ptr> ring;
+        std::atomic<uint64_t> done{0};                 // 已经写到输出地的数量
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<bool> dead{false};                 // 所属线程已经退出
+        std::atomic<bool> closed{false};               // 所属后台已经销毁，线程局部存储据此清理
+    };
+
+private:
+    // 归并时一段的当前位置，按(时间戳, 位置)比较，时间相同时先输出前面队列的
+    struct MergeCursor
+    {
+        uint64_t ticks;
+        size_t pos;
+        size_t end;
+
+        bool operator>(const MergeCursor& rhs) const
+        {
+            return ticks != rhs.ticks ? ticks > rhs.ticks : pos > rhs.pos;
+        }
+    };
+
+    Queue* threadQueue();                              // 当前线程的队列，第一次调用时创建并登记
+    void run();
+    void wakeup();
+    size_t drain(std::vector<std::shared_ptr<Queue>>& queues);  // 取出一批事件归并输出，返回条数
+    void merge();                                      // 按时间戳归并输出m_batch中的各段
+
+private:
+    Logger* m_logger;                                  // 所属日志器，生命周期长于本对象
+    OverflowPolicy m_policy;
+    size_t m_capacity;
+    uint64_t m_id;                                     // 进程内唯一，线程局部存储用它找到自己的队列
+
+    mutable std::mutex m_queuesMutex;
+    std::vector<std::shared_ptr<Queue>> m_queues;      // 受m_queuesMutex保护
+    std::atomic<uint64_t> m_queuesVersion;             // m_queues每次变化加一
+    std::atomic<uint64_t> m_retiredDropped;            // 已经回收的队列的丢弃数
+
+    // 出队只能有一个线程，平时是后台线程，停止之后是调用stop或push的线程
+    std::mutex m_drainMutex;
+    std::vector<LogEvent::ptr> m_batch;                // 归并用，受m_drainMutex保护
+    std::vector<std::pair<Queue*, uint64_t>> m_taken;  // 本批从各个队列取出的数量，受m_drainMutex保护
+    std::vector<uint64_t> m_ticks;                     // m_batch中各个事件的时间戳，归并时连续读取，受m_drainMutex保护
+    std::vector<MergeCursor> m_heap;                   // 归并用的小顶堆，每段一项，受m_drainMutex保护
+
+    std::atomic<bool> m_sleeping;
+    std::atomic<bool> m_stop;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;                    // 唤醒后台线程
+    std::condition_variable m_doneCond;                // 通知flush的调用者以及等待空位的生产者
+    std::thread m_thread;
 };
 
 // 日志器
 // 1. 对日志进行过滤
 // 2. 对符合条件的日志进行输出
+// 多线程安全，且写日志的路径上不加锁：
+// 等级是原子变量；输出地列表采用写时复制，修改时生成新的列表再原子地替换指针，
+// 旧列表保留到日志器销毁，所以正在遍历旧列表的线程不受影响
+//
+// 由LogManager创建的日志器按名字中的'.'组成层级，例如db.pool.conn的上级是db.pool：
+// 没有单独设置过等级时跟随上级的等级；自己没有输出地时交给上级的输出地
 class Logger
 {
 public:
     typedef std::shared_ptr<Logger> ptr;
+    typedef std::vector<LogAppender::ptr> AppenderList;
+
     Logger(const std::string name = "root", LogLevel::Level level = LogLevel::Level::DEBUG);
+    ~Logger();
     void log(LogEvent::ptr event);                     // 参数是代表当前想要输出的日志等级，如果低于当前日志器的level则不会输出  
-    
-    void setLevel(LogLevel::Level level);              // 重新设置过滤等级  
+    void doLog(const LogEvent::ptr& event);            // 直接写入各个输出地，异步模式下由后台线程调用
+
+    void setLevel(LogLevel::Level level);              // 重新设置过滤等级，同时传给没有单独设置等级的下级
+    LogLevel::Level getLevel() const { return m_level.load(std::memory_order_relaxed); }
+
+    Logger* getParent() const { return m_parent; }     // 上级日志器，根日志器和单独创建的日志器为空
+
+    // 开启异步模式，capacity为队列长度(PER_THREAD模式下为每个线程的队列长度)，
+    // policy为队列满时的处理策略，mode为后台的实现方式
+    // 切换模式属于配置操作，并发写入的日志不会丢失
+    void setAsync(size_t capacity = 8192, AsyncLogBackend::OverflowPolicy policy = AsyncLogBackend::BLOCK,
+                  AsyncLogBackend::Mode mode = AsyncLogBackend::SHARED_QUEUE);
+    // 关闭异步模式，关闭前会把队列中的日志全部写完
+    void setSync();
+    bool isAsync() const { return m_async.load(std::memory_order_acquire) != nullptr; }
+    uint64_t getDropped() const;
+
+    // 等待异步队列中的日志写完，并把各个输出地的缓冲写出
+    void flush();
+    void flushAppenders();                             // 只写出各个输出地的缓冲
 
     void setFormat(LogFormatter::ptr format);
     
@@ -324,40 +868,108 @@ public:
     void delAppender(LogAppender::ptr appender);       // 删除输出地
 
     const std::string& getName() { return m_name; }    
+    uint32_t getId() const { return m_id; }            // 进程内唯一的编号，从1开始
+
+    // 当前输出地列表的快照，只在EpochGuard区间内有效，换下的快照由EpochReclaimer回收
+    const AppenderList& getAppenders() const { return *m_appenders.load(std::memory_order_acquire); }
+
+    // 运行统计，LogStats::IsEnabled()为真时才会记录
+    LogStats& getStats() { return m_stats; }
+    const LogStats& getStats() const { return m_stats; }
+private:
+    friend class LogManager;
+    void dispatch(LogEvent::ptr event);                // 交给自己或上级的输出地，同步输出或投递到异步后台
+    void setAppenders(AppenderList* list);             // 调用者需持有m_mutex
+    AppenderList* installDefaultAppender(AppenderList* empty);
+    void addChild(Logger* child);                      // 挂上下级，下级从此跟随本日志器的等级
+    void inheritLevel(LogLevel::Level level);          // 上级等级变化时调用
+
 private:
     std::string m_name;                                // 日志过滤器的名称
+    uint32_t m_id;
 
-    LogLevel::Level m_level;                           // 日志过滤器的等级，低于该等级的日志不会被输出
+    std::atomic<LogLevel::Level> m_level;              // 日志过滤器的等级，低于该等级的日志不会被输出
+    std::atomic<bool> m_levelSet;                      // 是否单独设置过等级，否则跟随上级
 
-    std::vector<LogAppender::ptr> m_appenders;         // 输出目的地
+    Logger* m_parent;                                  // 上级，由LogManager持有，生命周期长于本对象
+    std::vector<Logger*> m_children;                   // 下级，受m_mutex保护
+
+    std::atomic<AppenderList*> m_appenders;            // 输出目的地，当前使用的快照
+
+    std::mutex m_mutex;                                // 修改配置时使用
+
+    LogStats m_stats;                                  // 运行统计，在后台之后析构，后台线程停止前一直有效
+
+    std::atomic<AsyncLogBackend*> m_async;             // 异步后台，为空表示同步输出；换下的后台停止后由EpochReclaimer回收
 };
 
 
 class LogEventWrap
 {
 public:
-    LogEventWrap(Logger::ptr logger, LogEvent::ptr event);
-    std::stringstream& getSs();
+    // 日志器由调用方的表达式保证在整条语句内有效，这里只保存裸指针
+    LogEventWrap(const Logger::ptr& logger, LogEvent::ptr event);
+    LogStream& getSs();
     ~LogEventWrap(); 
 private:
-    Logger::ptr m_logger; 
+    Logger* m_logger; 
     LogEvent::ptr m_event;
 };
 
 
 // 日志管理
+// 日志器按名字存放在开放寻址(线性探测)的哈希表中，查找不加锁：
+// 每个槽位是一个原子指针，创建日志器时在锁内写好条目再发布指针；
+// 扩容时建一张新表整体替换，旧表保留到管理器销毁，正在查旧表的线程不受影响
+// 日志器创建之后不会被删除
 class LogManager
 {
 public:
     LogManager();
     
+    // 取名字对应的日志器，不存在时自动创建，沿着名字中的'.'挂到上级下面
+    // 空名字和"root"都返回根日志器
     Logger::ptr getLogger(const std::string& name);
 
+    // 只查找不创建，不存在时返回空
+    Logger::ptr findLogger(const std::string& name) const;
+
     Logger::ptr getRoot();
 
+    // 运行统计，对所有日志器生效，默认关闭
+    void setStatsEnabled(bool enabled) { LogStats::SetEnabled(enabled); }
+    bool isStatsEnabled() const { return LogStats::IsEnabled(); }
+    // 有数据的日志器的统计，按创建顺序排列
+    std::vector<LogStatsSnapshot> getStats() const;
+    // 输出成文本，json为真时输出JSON
+    std::string dumpStats(bool json = false) const;
+
+private:
+    struct Entry
+    {
+        size_t hash;
+        Logger::ptr logger;
+    };
+
+    struct Table
+    {
+        explicit Table(size_t capacity);
+
+        size_t mask;
+        std::unique_ptr<std::atomic<Entry*>[]> slots;
+    };
+
+    static size_t Hash(std::string_view name);
+    const Entry* find(std::string_view name, size_t hash) const;
+    void insert(Entry* entry);                         // 调用者需持有m_mutex
+
 private:
+    mutable std::mutex m_mutex;                        // 创建日志器时使用
     Logger::ptr m_root;
-    std::vector<Logger::ptr> m_loggers; 
+    std::atomic<Table*> m_table;                       // 当前使用的哈希表
+    size_t m_count;                                    // 已有的日志器数量，受m_mutex保护
+    std::vector<std::unique_ptr<Table>> m_tables;      // 所有用过的哈希表
+    std::vector<std::unique_ptr<Entry>> m_entries;     // 所有条目
 };
 
 typedef SingletionPtr<LogManager> Manager;
@@ -0,0 +1,118 @@
+#include "log_args.h"
+
+#include <algorithm>
+#include <cstring>
+
+bool LogArgs::Format(LogStream& out, std::string_view fmt, std::string_view signature, const char* args, size_t len)
+{
+    const char* end = args + len;
+    size_t arg = 0;
+
+    // 依次输出下一个参数，参数用完时原样输出{}
+    auto next = [&]() {
+        if (arg >= signature.size())
+        {
+            out.append("{}", 2);
+            return true;
+        }
+        char code = signature[arg++];
+        if (code == 's')
+        {
+            uint32_t n;
+            if (end - args < 4)
+            {
+                return false;
+            }
+            memcpy(&n, args, 4);
+            if ((size_t)(end - args - 4) < n)
+            {
+                return false;
+            }
+            out.append(args + 4, n);
+            args += 4 + n;
+            return true;
+        }
+        if (end - args < 8)
+        {
+            return false;
+        }
+        uint64_t v;
+        memcpy(&v, args, 8);
+        args += 8;
+        switch (code)
+        {
+        case 'i': out << (int64_t)v; break;
+        case 'u': out << v; break;
+        case 'b': out << (bool)v; break;
+        case 'c': out.push_back((char)v); break;
+        case 'p': out << (const void*)(uintptr_t)v; break;
+        case 'f':
+        {
+            float f;
+            memcpy(&f, &v, 4);
+            out << f;
+            break;
+        }
+        case 'd':
+        {
+            double d;
+            memcpy(&d, &v, 8);
+            out << d;
+            break;
+        }
+        default:
+            return false;
+        }
+        return true;
+    };
+
+    // 两个大括号之间的普通文字整段输出，大括号用memchr查找，
+    // 记下下一个'{'和'}'的位置，走过之后才重新查找
+    const char* begin = fmt.data();
+    size_t n = fmt.size();
+    auto find = [&](char c, size_t from) {
+        const void* p = memchr(begin + from, c, n - from);
+        return p ? (size_t)((const char*)p - begin) : n;
+    };
+    size_t next_open = find('{', 0);
+    size_t next_close = find('}', 0);
+    size_t i = 0;
+    while (i < n)
+    {
+        if (next_open < i)
+        {
+            next_open = find('{', i);
+        }
+        if (next_close < i)
+        {
+            next_close = find('}', i);
+        }
+        size_t pos = std::min(next_open, next_close);
+        if (pos == n)
+        {
+            out.append(begin + i, n - i);
+            break;
+        }
+        out.append(fmt.data() + i, pos - i);
+        char c = fmt[pos];
+        if (c == '{' && pos + 1 < fmt.size() && fmt[pos + 1] == '}')
+        {
+            if (!next())
+            {
+                return false;
+            }
+            i = pos + 2;
+        }
+        else if (pos + 1 < fmt.size() && fmt[pos + 1] == c)
+        {
+            out.push_back(c);
+            i = pos + 2;
+        }
+        else
+        {
+            out.push_back(c);
+            i = pos + 1;
+        }
+    }
+    return true;
+}
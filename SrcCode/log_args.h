@@ -0,0 +1,226 @@
+#ifndef __ZY_LOG_ARGS_H__
+#define __ZY_LOG_ARGS_H__
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include "log_stream.h"
+
+// 日志参数的原始编码，二进制日志(LOG_BINARY)和延迟格式化的日志(LOG_INFO等)共用
+// 每个参数按类型编码成一个签名字符和一段字节：
+//     i/u/b/c/p  8字节整数(有符号、无符号、bool、字符、指针)
+//     f          8字节，低4字节为float，单独编码是为了按float的最短表示输出
+//     d          8字节double
+//     s          u32长度加字符串内容，C字符串和std::string都按值拷贝
+// 有LogFormatTraits的自定义类型在调用线程上用它转换成字符串，再按s编码
+// 还原时各类型的输出与LogStream的<<完全相同，两种写法得到的日志内容一致
+//
+// 格式串中的 {} 依次被参数替换，{{ 和 }} 输出大括号本身
+// 通过LogFormatString在编译期检查：大括号必须成对，{}的个数必须等于参数个数
+
+// 单个参数的编码方式
+template<class T, class Enable = void>
+struct BinaryArg
+{
+    static_assert(sizeof(T) == 0, "unsupported log argument type");
+};
+
+template<class T>
+struct BinaryArg<T, std::enable_if_t<std::is_integral_v<T> || std::is_enum_v<T>>>
+{
+    // 三种char与LogStream一样按字符输出
+    static constexpr char code = std::is_same_v<T, bool> ? 'b'
+                               : std::is_same_v<T, char> || std::is_same_v<T, signed char> ||
+                                 std::is_same_v<T, unsigned char> ? 'c'
+                               : std::is_enum_v<T> || std::is_signed_v<T> ? 'i' : 'u';
+    static size_t Size(T) { return 8; }
+    static char* Encode(char* p, T v)
+    {
+        uint64_t val;
+        if constexpr (std::is_enum_v<T>)
+        {
+            val = (uint64_t)(int64_t)static_cast<std::underlying_type_t<T>>(v);
+        }
+        else if constexpr (std::is_signed_v<T>)
+        {
+            val = (uint64_t)(int64_t)v;
+        }
+        else
+        {
+            val = (uint64_t)v;
+        }
+        memcpy(p, &val, 8);
+        return p + 8;
+    }
+};
+
+template<class T>
+struct BinaryArg<T, std::enable_if_t<std::is_floating_point_v<T>>>
+{
+    static constexpr char code = std::is_same_v<T, float> ? 'f' : 'd';
+    static size_t Size(T) { return 8; }
+    static char* Encode(char* p, T v)
+    {
+        if constexpr (std::is_same_v<T, float>)
+        {
+            memset(p, 0, 8);
+            memcpy(p, &v, 4);
+        }
+        else
+        {
+            // long double按double输出
+            double val = v;
+            memcpy(p, &val, 8);
+        }
+        return p + 8;
+    }
+};
+
+// 字符串，过长的部分截掉，保证单条记录不会超过缓冲区
+struct BinaryStringArg
+{
+    enum { MAX_LEN = 16 * 1024 };
+
+    static constexpr char code = 's';
+    static size_t Size(std::string_view v) { return 4 + std::min<size_t>(v.size(), MAX_LEN); }
+    static char* Encode(char* p, std::string_view v)
+    {
+        uint32_t len = std::min<size_t>(v.size(), MAX_LEN);
+        memcpy(p, &len, 4);
+        memcpy(p + 4, v.data(), len);
+        return p + 4 + len;
+    }
+};
+
+template<class T>
+struct BinaryArg<T, std::enable_if_t<std::is_pointer_v<T>>>
+{
+    typedef std::remove_cv_t<std::remove_pointer_t<T>> Pointee;
+    static constexpr bool is_str = std::is_same_v<Pointee, char>;
+
+    static constexpr char code = is_str ? 's' : 'p';
+    static size_t Size(T v)
+    {
+        if constexpr (is_str)
+        {
+            return BinaryStringArg::Size(v ? std::string_view(v) : std::string_view());
+        }
+        return 8;
+    }
+    static char* Encode(char* p, T v)
+    {
+        if constexpr (is_str)
+        {
+            return BinaryStringArg::Encode(p, v ? std::string_view(v) : std::string_view());
+        }
+        uint64_t val = (uint64_t)(uintptr_t)v;
+        memcpy(p, &val, 8);
+        return p + 8;
+    }
+};
+
+template<>
+struct BinaryArg<std::string> : BinaryStringArg {};
+
+template<>
+struct BinaryArg<std::string_view> : BinaryStringArg {};
+
+// 一组参数的签名，每个参数一个字符
+template<class... Args>
+struct BinaryArgSignature
+{
+    static constexpr char value[sizeof...(Args) + 1] = { BinaryArg<Args>::code..., 0 };
+};
+
+// 编译期检查过的格式串，Args为对应的参数类型
+// 用法与std::format_string相同，作为函数参数时写成LogFormatString<std::type_identity_t<Args>...>，
+// 用字符串字面量隐式构造，格式错误时编译失败
+template<class... Args>
+struct LogFormatString
+{
+    template<size_t N>
+    consteval LogFormatString(const char (&s)[N])
+        : str(s), size(N - 1)
+    {
+        size_t count = 0;
+        for (size_t i = 0; i + 1 < N; ++i)
+        {
+            if (s[i] == '{')
+            {
+                if (s[i + 1] == '{')
+                {
+                    ++i;
+                }
+                else if (s[i + 1] == '}')
+                {
+                    ++count;
+                    ++i;
+                }
+                else
+                {
+                    throw "only {} placeholders are supported, use {{ for a literal brace";
+                }
+            }
+            else if (s[i] == '}')
+            {
+                if (s[i + 1] != '}')
+                {
+                    throw "unmatched } in log format string, use }} for a literal brace";
+                }
+                ++i;
+            }
+        }
+        if (count != sizeof...(Args))
+        {
+            throw "number of {} placeholders does not match the number of arguments";
+        }
+    }
+
+    const char* str;
+    size_t size;
+};
+
+// 一组参数的编码和还原
+struct LogArgs
+{
+    // 编码前的转换：有LogFormatTraits的类型转换成字符串，其余原样返回引用
+    template<class T>
+    static decltype(auto) Prepare(const T& v)
+    {
+        if constexpr (HasLogFormatTraits<T>)
+        {
+            LogStream out;
+            LogFormatTraits<T>::Format(out, v);
+            return out.str();
+        }
+        else
+        {
+            return (v);
+        }
+    }
+
+
+    template<class... Args>
+    static size_t Size(const Args&... args)
+    {
+        size_t size = 0;
+        ((size += BinaryArg<Args>::Size(args)), ...);
+        return size;
+    }
+
+    // p处至少要有Size(args...)字节，返回写完后的位置
+    template<class... Args>
+    static char* Encode(char* p, const Args&... args)
+    {
+        ((p = BinaryArg<Args>::Encode(p, args)), ...);
+        return p;
+    }
+
+    // 按格式串和签名把编码后的参数展开成文本，参数不完整时返回false
+    static bool Format(LogStream& out, std::string_view fmt, std::string_view signature, const char* args, size_t len);
+};
+
+#endif
@@ -0,0 +1,696 @@
+#include "log_binary.h"
+
+#include <cmath>
+#include <cstddef>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static const char s_magic[8] = { 'Z', 'Y', 'B', 'L', 'O', 'G', '0', '1' };
+
+std::atomic<bool> BinaryLog::s_open(false);
+
+BinaryLogBuffer::BinaryLogBuffer(size_t size)
+    : m_data(nullptr), m_size(size), m_write(0), m_read(0), m_dead(false)
+{
+    m_data = (char*)malloc(m_size);
+}
+
+BinaryLogBuffer::~BinaryLogBuffer()
+{
+    free(m_data);
+}
+
+char* BinaryLogBuffer::reserve(size_t len)
+{
+    size_t pos = m_writeLocal & (m_size - 1);
+    size_t contiguous = m_size - pos;
+    // 尾部放不下就整段填充，记录从头开始写
+    size_t need = len <= contiguous ? len : contiguous + len;
+
+    while (m_size - (m_writeLocal - m_readCache) < need)
+    {
+        m_readCache = m_read.load(std::memory_order_acquire);
+        if (m_size - (m_writeLocal - m_readCache) >= need)
+        {
+            break;
+        }
+        if (!BinaryLog::IsOpen())
+        {
+            return nullptr;
+        }
+        // 缓冲区满，等后台线程取走数据
+        std::this_thread::yield();
+    }
+
+    if (len > contiguous)
+    {
+        // 位置和长度都是8的倍数，尾部至少能放下一个记录头
+        BinaryRecordHeader pad = { BinaryRecordHeader::PAD, 0, 0, (uint32_t)contiguous };
+        memcpy(m_data + pos, &pad, sizeof(pad));
+        m_writeLocal += contiguous;
+        pos = 0;
+    }
+    return m_data + pos;
+}
+
+size_t BinaryLogBuffer::peek(const char** first, size_t* first_len, const char** second, size_t* second_len) const
+{
+    uint64_t read = m_read.load(std::memory_order_relaxed);
+    uint64_t write = m_write.load(std::memory_order_acquire);
+    size_t len = write - read;
+    size_t pos = read & (m_size - 1);
+
+    *first = m_data + pos;
+    *first_len = std::min(len, m_size - pos);
+    *second = m_data;
+    *second_len = len - *first_len;
+    return len;
+}
+
+
+namespace
+{
+
+// 后台写线程以及全局的登记信息
+class BinaryLogWriter
+{
+public:
+    ~BinaryLogWriter() { close(); }
+
+    bool open(const std::string& file);
+    void close();
+    void flush();
+
+    uint32_t registerSite(BinaryLogSite& site, const char* signature);
+    uint32_t registerLogger(Logger* logger);
+    void registerThread(uint32_t tid, const char* name);
+    void addBuffer(const BinaryLogBuffer::ptr& buffer);
+
+    std::atomic<uint64_t> m_dropped{0};
+
+private:
+    void run();
+    bool drain();
+    void appendDictionary(BinaryRecordHeader::Kind kind, const std::string& body);
+    bool writeClock(const Clock::Calibration& clock);
+    bool writeAll(const char* data, size_t len);
+
+private:
+    std::mutex m_mutex;                                // 保护以下全部成员
+    std::vector<BinaryLogBuffer::ptr> m_buffers;
+    std::string m_dictionary;                          // 登记过的全部调用点和日志器
+    size_t m_dictionaryWritten = 0;                    // 已经写进当前文件的部分
+    uint32_t m_siteCount = 0;
+    std::vector<bool> m_loggers;                       // 已经登记过的日志器编号
+    uint64_t m_clockGeneration = 0;                    // 写进当前文件的最后一个时钟锚点
+
+    std::mutex m_openMutex;                            // 串行化open和close
+    int m_fd = -1;
+    std::atomic<bool> m_stop{false};
+    std::thread m_thread;
+};
+
+BinaryLogWriter& Writer()
+{
+    static BinaryLogWriter s_writer;
+    return s_writer;
+}
+
+// 线程退出时标记缓冲区，由后台线程写完后释放
+struct ThreadBufferHolder
+{
+    ~ThreadBufferHolder()
+    {
+        if (buffer)
+        {
+            buffer->setDead();
+        }
+    }
+
+    BinaryLogBuffer::ptr buffer;
+    uint32_t name_version = 0;                         // 登记时的线程名版本
+};
+
+static thread_local ThreadBufferHolder t_buffer;
+static thread_local std::vector<bool> t_loggers;       // 本线程确认过已登记的日志器
+
+bool BinaryLogWriter::open(const std::string& file)
+{
+    std::lock_guard<std::mutex> open_lock(m_openMutex);
+    if (m_fd >= 0)
+    {
+        m_stop.store(true, std::memory_order_release);
+        m_thread.join();
+        ::close(m_fd);
+        m_fd = -1;
+    }
+
+    int fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        std::cout << "open binary log file " << file << " failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_fd = fd;
+    // 之前登记过的调用点和日志器在新文件里也要有
+    m_dictionaryWritten = 0;
+    if (!writeAll(s_magic, sizeof(s_magic)) || !writeClock(Clock::Get()))
+    {
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    m_stop.store(false, std::memory_order_relaxed);
+    m_thread = std::thread(&BinaryLogWriter::run, this);
+    return true;
+}
+
+void BinaryLogWriter::close()
+{
+    std::lock_guard<std::mutex> open_lock(m_openMutex);
+    if (m_fd < 0)
+    {
+        return;
+    }
+    // 后台线程退出前会把所有缓冲区写完
+    m_stop.store(true, std::memory_order_release);
+    m_thread.join();
+    ::close(m_fd);
+    m_fd = -1;
+}
+
+void BinaryLogWriter::flush()
+{
+    std::vector<std::pair<BinaryLogBuffer::ptr, uint64_t>> targets;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& it : m_buffers)
+        {
+            targets.push_back(std::make_pair(it, it->getWritten()));
+        }
+    }
+    for (auto& it : targets)
+    {
+        while (it.first->getRead() < it.second && BinaryLog::IsOpen())
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+}
+
+uint32_t BinaryLogWriter::registerSite(BinaryLogSite& site, const char* signature)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint32_t id = site.id.load(std::memory_order_relaxed);
+    if (id)
+    {
+        return id;
+    }
+    id = ++m_siteCount;
+
+    std::string body;
+    uint32_t line = site.line;
+    uint16_t file_len = strlen(site.file);
+    uint16_t fmt_len = strlen(site.fmt);
+    uint16_t sig_len = strlen(signature);
+    body.append((const char*)&id, 4);
+    body.append((const char*)&line, 4);
+    body.append((const char*)&file_len, 2);
+    body.append((const char*)&fmt_len, 2);
+    body.append((const char*)&sig_len, 2);
+    body.append(site.file, file_len);
+    body.append(site.fmt, fmt_len);
+    body.append(signature, sig_len);
+    appendDictionary(BinaryRecordHeader::SITE, body);
+
+    site.id.store(id, std::memory_order_release);
+    return id;
+}
+
+uint32_t BinaryLogWriter::registerLogger(Logger* logger)
+{
+    uint32_t id = logger->getId();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (id >= m_loggers.size())
+    {
+        m_loggers.resize(id + 1);
+    }
+    if (!m_loggers[id])
+    {
+        m_loggers[id] = true;
+        std::string body;
+        uint16_t len = logger->getName().size();
+        body.append((const char*)&id, 4);
+        body.append((const char*)&len, 2);
+        body.append(logger->getName(), 0, len);
+        appendDictionary(BinaryRecordHeader::LOGGER, body);
+    }
+    return id;
+}
+
+void BinaryLogWriter::registerThread(uint32_t tid, const char* name)
+{
+    std::string body;
+    uint16_t len = strlen(name);
+    body.append((const char*)&tid, 4);
+    body.append((const char*)&len, 2);
+    body.append(name, len);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    appendDictionary(BinaryRecordHeader::THREAD, body);
+}
+
+void BinaryLogWriter::appendDictionary(BinaryRecordHeader::Kind kind, const std::string& body)
+{
+    size_t size = (sizeof(BinaryRecordHeader) + body.size() + 7) & ~(size_t)7;
+    BinaryRecordHeader header = { (uint8_t)kind, 0, 0, (uint32_t)size };
+    m_dictionary.append((const char*)&header, sizeof(header));
+    m_dictionary.append(body);
+    m_dictionary.append(size - sizeof(header) - body.size(), '\0');
+}
+
+void BinaryLogWriter::addBuffer(const BinaryLogBuffer::ptr& buffer)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_buffers.push_back(buffer);
+}
+
+bool BinaryLogWriter::writeAll(const char* data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = ::write(m_fd, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            std::cout << "write binary log failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool BinaryLogWriter::writeClock(const Clock::Calibration& clock)
+{
+    BinaryClockRecord record = { clock.base_ticks, clock.base_real_ns, clock.ns_per_tick, clock.base_elapsed_ns };
+    BinaryRecordHeader header = { BinaryRecordHeader::CLOCK, 0, 0, (uint32_t)(sizeof(header) + sizeof(record)) };
+    m_clockGeneration = clock.generation;
+    return writeAll((const char*)&header, sizeof(header)) && writeAll((const char*)&record, sizeof(record));
+}
+
+bool BinaryLogWriter::drain()
+{
+    std::vector<BinaryLogBuffer::ptr> buffers;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // 锚点更新后追加一条CLOCK记录，解码时每条日志按它之前最近的锚点换算
+        // 只写二进制日志时没有别的线程换算时间，Get同时负责按时更新锚点
+        Clock::Calibration clock = Clock::Get();
+        if (clock.generation != m_clockGeneration)
+        {
+            writeClock(clock);
+        }
+        if (m_dictionaryWritten < m_dictionary.size())
+        {
+            // 字典和日志的先后不重要，解码时会先收集全部字典
+            writeAll(m_dictionary.data() + m_dictionaryWritten, m_dictionary.size() - m_dictionaryWritten);
+            m_dictionaryWritten = m_dictionary.size();
+        }
+        buffers = m_buffers;
+    }
+
+    bool busy = false;
+    for (auto& it : buffers)
+    {
+        const char* first;
+        const char* second;
+        size_t first_len;
+        size_t second_len;
+        size_t len = it->peek(&first, &first_len, &second, &second_len);
+        if (len == 0)
+        {
+            continue;
+        }
+        // 两段一起写，整块记录在文件中不会被其他线程的数据隔开
+        struct iovec iov[2] = { { (void*)first, first_len }, { (void*)second, second_len } };
+        ssize_t n;
+        do
+        {
+            n = ::writev(m_fd, iov, second_len ? 2 : 1);
+        } while (n < 0 && errno == EINTR);
+        if (n >= 0 && (size_t)n < len)
+        {
+            // 短写很少见，剩下的部分同步写完，保证文件中的记录完整
+            size_t done = n;
+            if (done < first_len)
+            {
+                writeAll(first + done, first_len - done);
+                done = first_len;
+            }
+            writeAll(second + (done - first_len), len - done);
+        }
+        it->consume(len);
+        busy = true;
+    }
+
+    // 回收已经退出并且写完的线程的缓冲区
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < m_buffers.size(); )
+    {
+        if (m_buffers[i]->isDead() && m_buffers[i]->getRead() == m_buffers[i]->getWritten())
+        {
+            m_buffers[i] = m_buffers.back();
+            m_buffers.pop_back();
+        }
+        else
+        {
+            ++i;
+        }
+    }
+    return busy;
+}
+
+void BinaryLogWriter::run()
+{
+    while (!m_stop.load(std::memory_order_acquire))
+    {
+        if (!drain())
+        {
+            // 业务线程只写内存，不通知后台线程，这里定时轮询
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    // 关闭之后业务线程不再写入，最后取一次
+    drain();
+}
+
+}
+
+
+bool BinaryLog::Open(const std::string& file)
+{
+    // 先让业务线程停止写入，等待中的写入会直接返回
+    s_open.store(false, std::memory_order_release);
+    bool ok = Writer().open(file);
+    s_open.store(ok, std::memory_order_release);
+    return ok;
+}
+
+void BinaryLog::Close()
+{
+    s_open.store(false, std::memory_order_release);
+    Writer().close();
+}
+
+void BinaryLog::Flush()
+{
+    Writer().flush();
+}
+
+uint64_t BinaryLog::GetDropped()
+{
+    return Writer().m_dropped.load(std::memory_order_relaxed);
+}
+
+uint32_t BinaryLog::RegisterSite(BinaryLogSite& site, const char* signature)
+{
+    return Writer().registerSite(site, signature);
+}
+
+uint32_t BinaryLog::LoggerId(Logger* logger)
+{
+    uint32_t id = logger->getId();
+    if (id < t_loggers.size() && t_loggers[id])
+    {
+        return id;
+    }
+    Writer().registerLogger(logger);
+    if (id >= t_loggers.size())
+    {
+        t_loggers.resize(id + 1);
+    }
+    t_loggers[id] = true;
+    return id;
+}
+
+BinaryLogBuffer* BinaryLog::ThreadBuffer()
+{
+    if (!t_buffer.buffer)
+    {
+        t_buffer.buffer.reset(new BinaryLogBuffer(BUFFER_SIZE));
+        Writer().addBuffer(t_buffer.buffer);
+        t_buffer.name_version = ThreadInfo::GetNameVersion();
+        Writer().registerThread(ThreadInfo::GetThreadId(), ThreadInfo::GetThreadName());
+    }
+    else if (t_buffer.name_version != ThreadInfo::GetNameVersion())
+    {
+        // 线程改过名字，重新登记
+        t_buffer.name_version = ThreadInfo::GetNameVersion();
+        Writer().registerThread(ThreadInfo::GetThreadId(), ThreadInfo::GetThreadName());
+    }
+    return t_buffer.buffer.get();
+}
+
+void BinaryLog::Drop()
+{
+    Writer().m_dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+bool BinaryLogDecoder::load(const std::string& file)
+{
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        std::cout << "open " << file << " failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    m_data.resize(st.st_size);
+    size_t done = 0;
+    while (done < m_data.size())
+    {
+        ssize_t n = ::read(fd, m_data.data() + done, m_data.size() - done);
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        done += n;
+    }
+    ::close(fd);
+    m_data.resize(done);
+
+    if (m_data.size() < sizeof(s_magic) || memcmp(m_data.data(), s_magic, sizeof(s_magic)) != 0)
+    {
+        std::cout << file << " is not a binary log file" << std::endl;
+        return false;
+    }
+
+    // 先收集字典，日志记录只记下位置，解码时再按时间排序
+    m_sites.clear();
+    m_loggers.clear();
+    m_records.clear();
+    m_clocks.clear();
+    m_threads.clear();
+    size_t pos = sizeof(s_magic);
+    while (pos + sizeof(BinaryRecordHeader) <= m_data.size())
+    {
+        BinaryRecordHeader header;
+        memcpy(&header, m_data.data() + pos, sizeof(header));
+        if (header.size < sizeof(header) || pos + header.size > m_data.size())
+        {
+            // 进程崩溃时最后一块可能没写完整
+            std::cout << "truncated record at offset " << pos << std::endl;
+            break;
+        }
+        // 长度字段来自文件，每种记录先检查最小长度，再检查每个字符串不超出记录的剩余部分
+        const char* body = m_data.data() + pos + sizeof(header);
+        size_t remain = header.size - sizeof(header);
+        bool valid = true;
+        if (header.kind == BinaryRecordHeader::SITE)
+        {
+            uint32_t id;
+            uint32_t line;
+            uint16_t file_len;
+            uint16_t fmt_len;
+            uint16_t sig_len;
+            if (remain < 14)
+            {
+                valid = false;
+            }
+            else
+            {
+                memcpy(&id, body, 4);
+                memcpy(&line, body + 4, 4);
+                memcpy(&file_len, body + 8, 2);
+                memcpy(&fmt_len, body + 10, 2);
+                memcpy(&sig_len, body + 12, 2);
+                // 编号连续分配，每个编号至少占一条SITE记录，超过文件能容纳的记录数说明编号是坏的
+                valid = (size_t)file_len + fmt_len + sig_len <= remain - 14
+                     && id <= m_data.size() / (sizeof(header) + 14);
+            }
+            if (valid)
+            {
+                if (id >= m_sites.size())
+                {
+                    m_sites.resize(id + 1);
+                }
+                Site& site = m_sites[id];
+                site.line = line;
+                site.file.assign(body + 14, file_len);
+                site.fmt.assign(body + 14 + file_len, fmt_len);
+                site.signature.assign(body + 14 + file_len + fmt_len, sig_len);
+            }
+        }
+        else if (header.kind == BinaryRecordHeader::LOGGER)
+        {
+            uint32_t id;
+            uint16_t len;
+            if (remain < 6)
+            {
+                valid = false;
+            }
+            else
+            {
+                memcpy(&id, body, 4);
+                memcpy(&len, body + 4, 2);
+                valid = len <= remain - 6;
+            }
+            if (valid)
+            {
+                m_loggers[id].assign(body + 6, len);
+            }
+        }
+        else if (header.kind == BinaryRecordHeader::LOG)
+        {
+            // 参数部分的长度由decode按记录长度计算，这里保证它不会下溢
+            valid = remain >= sizeof(BinaryLogRecord);
+            if (valid)
+            {
+                m_records.push_back(pos);
+            }
+        }
+        else if (header.kind == BinaryRecordHeader::THREAD)
+        {
+            uint32_t tid;
+            uint16_t len;
+            if (remain < 6)
+            {
+                valid = false;
+            }
+            else
+            {
+                memcpy(&tid, body, 4);
+                memcpy(&len, body + 4, 2);
+                valid = len <= remain - 6;
+            }
+            if (valid)
+            {
+                m_threads[tid].assign(body + 6, len);
+            }
+        }
+        else if (header.kind == BinaryRecordHeader::CLOCK)
+        {
+            BinaryClockRecord clock = {};
+            size_t old_size = offsetof(BinaryClockRecord, base_elapsed_ns);
+            valid = remain >= old_size;
+            if (valid)
+            {
+                memcpy(&clock, body, std::min(remain, sizeof(clock)));
+                // 换算时要转成整数，比例不是正的有限值时转换没有定义
+                valid = std::isfinite(clock.ns_per_tick) && clock.ns_per_tick > 0;
+            }
+            if (valid)
+            {
+                m_clocks.push_back(clock);
+            }
+        }
+        if (!valid)
+        {
+            // 长度字段自相矛盾，跳过这一条，记录本身的长度没有越界，后面的记录仍可以解析
+            std::cout << "bad record of kind " << (int)header.kind << " at offset " << pos << std::endl;
+        }
+        pos += header.size;
+    }
+    std::sort(m_clocks.begin(), m_clocks.end(), [](const BinaryClockRecord& a, const BinaryClockRecord& b) {
+        return a.base_ticks < b.base_ticks;
+    });
+    return true;
+}
+
+size_t BinaryLogDecoder::decode(LogFormatter& formatter, std::ostream& out)
+{
+    auto timestamp = [this](size_t pos) {
+        uint64_t ts;
+        memcpy(&ts, m_data.data() + pos + sizeof(BinaryRecordHeader) + offsetof(BinaryLogRecord, timestamp), 8);
+        return ts;
+    };
+    // 同一线程内本来就有序，稳定排序保证时间相同的日志保持原来的先后
+    std::stable_sort(m_records.begin(), m_records.end(), [&](size_t a, size_t b) {
+        return timestamp(a) < timestamp(b);
+    });
+
+    static const Site s_unknown_site = { "<unknown site>", 0, "", "" };
+    static const std::string s_unknown_logger = "<unknown logger>";
+    static const BinaryClockRecord s_raw_clock = { 0, 0, 1.0, 0 };   // 没有CLOCK记录时按计数即纳秒处理
+
+    LogStream line;
+    for (size_t pos : m_records)
+    {
+        BinaryRecordHeader header;
+        BinaryLogRecord record;
+        memcpy(&header, m_data.data() + pos, sizeof(header));
+        memcpy(&record, m_data.data() + pos + sizeof(header), sizeof(record));
+
+        const Site& site = record.site < m_sites.size() && !m_sites[record.site].file.empty()
+                         ? m_sites[record.site] : s_unknown_site;
+        auto logger_it = m_loggers.find(record.logger);
+        const std::string& logger = logger_it != m_loggers.end() ? logger_it->second : s_unknown_logger;
+
+        // 按写日志的进程在这条日志之前最近的锚点换算，早于第一个锚点的按第一个往回推
+        auto it = std::upper_bound(m_clocks.begin(), m_clocks.end(), record.timestamp,
+                                   [](uint64_t ts, const BinaryClockRecord& c) { return ts < c.base_ticks; });
+        const BinaryClockRecord& clock = m_clocks.empty() ? s_raw_clock : it == m_clocks.begin() ? *it : *(it - 1);
+        // 坏文件里的计数和比例可能很大，先限制范围再转成整数
+        double delta = (double)(int64_t)(record.timestamp - clock.base_ticks) * clock.ns_per_tick;
+        int64_t delta_ns = (int64_t)std::max(-4e18, std::min(delta, 4e18));
+        uint64_t elapse_ns = clock.base_elapsed_ns + (uint64_t)delta_ns;
+        elapse_ns = (int64_t)elapse_ns > 0 ? elapse_ns : 0;
+        uint64_t wall_ns = clock.base_real_ns + delta_ns;
+
+        LogEvent::ptr event(new LogEvent((LogLevel::Level)header.level, site.file.c_str(), site.line, elapse_ns / 1000000,
+                                         record.thread_id, record.fiber_id, wall_ns / 1000000000ULL, logger));
+        event->setTime(wall_ns / 1000000000ULL, wall_ns % 1000000000ULL / 1000);
+        auto thread = m_threads.find(record.thread_id);
+        event->setThreadName(thread != m_threads.end() ? thread->second.c_str() : "");
+
+        const char* args = m_data.data() + pos + sizeof(header) + sizeof(record);
+        size_t len = header.size - sizeof(header) - sizeof(record);
+        if (!LogArgs::Format(event->getSs(), site.fmt, site.signature, args, len))
+        {
+            event->getSs() << " <<bad arguments>>";
+        }
+
+        line.clear();
+        formatter.format(line, event);
+        out.write(line.data(), line.size());
+    }
+    return m_records.size();
+}
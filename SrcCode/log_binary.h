@@ -0,0 +1,243 @@
+#ifndef __ZY_LOG_BINARY_H__
+#define __ZY_LOG_BINARY_H__
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include "log.h"
+
+// 二进制日志 (NanoLog的思路)
+// 写日志时不做任何格式化：调用点的文件、行号、格式串只在第一次执行时登记一次，
+// 之后每次只把 调用点编号、时间戳、线程号、参数的原始字节 追加到本线程的缓冲区，
+// 后台线程把各个线程的缓冲区原样写进文件，由离线工具logdecoder还原成文本
+//
+// 用法：
+//     BinaryLog::Open("/tmp/app.blog");
+//     LOG_BINARY(logger, LogLevel::INFO, "user {} login from {}", uid, ip);
+//     BinaryLog::Close();
+//     ./logdecoder /tmp/app.blog ["%d%T%p%T%m%n"]
+//
+// 格式串中的 {} 依次被参数替换，{{ 和 }} 输出大括号本身，格式在编译期检查
+// 支持的参数类型：整数、枚举、浮点、bool、char、指针、C字符串、std::string、std::string_view，
+// 以及特化了LogFormatTraits的类型(在调用线程上转换成字符串)
+// 没有调用Open时日志直接丢弃
+//
+// 文件格式 (小端，所有记录按8字节对齐)：
+//     文件头  "ZYBLOG01"
+//     记录    BinaryRecordHeader + 内容，size为包含头部和填充在内的总长度
+//       PAD    无内容，缓冲区回绕时填充尾部，解码时跳过
+//       CLOCK  BinaryClockRecord，紧跟在文件头后面，用于把时钟计数换算成时间
+//       SITE   u32编号 u32行号 u16文件名长度 u16格式串长度 u16参数签名长度 + 三个字符串
+//       LOGGER u32编号 u16名字长度 + 名字
+//       THREAD u32线程号 u16名字长度 + 线程名，线程第一次写日志和改名后登记，解码时用最后登记的名字
+//       LOG    BinaryLogRecord + 参数
+// 参数按调用点登记的签名依次存放，编码方式见log_args.h
+// 各线程的记录在文件中按块交错，解码时按时间戳重新排序
+
+#define LOG_BINARY(logger, level, fmt, ...) \
+    if ((level) < (logger)->getLevel()) {} \
+    else [&]() {                                                                \
+        static BinaryLogSite s_site(__FILE__, __LINE__, fmt);                   \
+        BinaryLog::Write(s_site, (logger).get(), level, fmt __VA_OPT__(,) __VA_ARGS__); \
+    }()
+
+// 调用点，由宏定义成静态变量，常量初始化，不需要线程安全的静态初始化检查
+struct BinaryLogSite
+{
+    constexpr BinaryLogSite(const char* file_, int line_, const char* fmt_)
+        : file(file_), line(line_), fmt(fmt_), id(0) {}
+
+    const char* file;
+    int line;
+    const char* fmt;
+    std::atomic<uint32_t> id;                          // 登记后的编号，0表示还没登记
+};
+
+struct BinaryRecordHeader
+{
+    enum Kind : uint8_t
+    {
+        PAD = 0,
+        SITE = 1,
+        LOGGER = 2,
+        LOG = 3,
+        CLOCK = 4,
+        THREAD = 5
+    };
+
+    uint8_t kind;
+    uint8_t level;
+    uint16_t reserved;
+    uint32_t size;
+};
+
+struct BinaryLogRecord
+{
+    uint32_t site;
+    uint32_t logger;
+    uint32_t thread_id;
+    uint32_t fiber_id;
+    uint64_t timestamp;                                // 时钟计数(Clock::Now)，解码时按CLOCK记录换算
+};
+
+// 写日志的进程的时钟锚点，见Clock::Calibration
+// 打开文件时写一条，之后锚点每更新一次追加一条
+struct BinaryClockRecord
+{
+    uint64_t base_ticks;
+    uint64_t base_real_ns;
+    double ns_per_tick;
+    uint64_t base_elapsed_ns;                          // 后来加的字段，旧文件里没有，按0处理
+};
+
+// 每个线程一个的单生产者单消费者字节环形缓冲区
+// 业务线程写入整条记录后才发布写位置，后台线程每次取走 [读位置, 写位置) 之间的全部字节
+class BinaryLogBuffer
+{
+public:
+    typedef std::shared_ptr<BinaryLogBuffer> ptr;
+
+    explicit BinaryLogBuffer(size_t size);
+    ~BinaryLogBuffer();
+
+    // 预留len字节(8的倍数)的连续空间，空间不够时等待后台线程取走数据
+    // 日志已经关闭时返回nullptr
+    char* reserve(size_t len);
+    void commit(size_t len)
+    {
+        m_writeLocal += len;
+        m_write.store(m_writeLocal, std::memory_order_release);
+    }
+
+    size_t capacity() const { return m_size; }
+
+    // 以下由后台线程调用
+    // 取出可读的数据，最多两段(回绕时)，返回总长度
+    size_t peek(const char** first, size_t* first_len, const char** second, size_t* second_len) const;
+    void consume(size_t len) { m_read.store(m_read.load(std::memory_order_relaxed) + len, std::memory_order_release); }
+    uint64_t getWritten() const { return m_write.load(std::memory_order_acquire); }
+    uint64_t getRead() const { return m_read.load(std::memory_order_acquire); }
+
+    void setDead() { m_dead.store(true, std::memory_order_release); }
+    bool isDead() const { return m_dead.load(std::memory_order_acquire); }
+
+private:
+    char* m_data;
+    size_t m_size;                                     // 2的幂
+
+    alignas(64) uint64_t m_writeLocal = 0;             // 生产者私有的写位置
+    uint64_t m_readCache = 0;                          // 生产者看到的读位置，减少跨核读取
+    std::atomic<uint64_t> m_write;                     // 发布给后台线程的写位置
+
+    alignas(64) std::atomic<uint64_t> m_read;
+    std::atomic<bool> m_dead;                          // 所属线程已经退出
+};
+
+// 二进制日志的入口，全部为静态函数
+class BinaryLog
+{
+public:
+    enum { BUFFER_SIZE = 1024 * 1024 };                // 每个线程的缓冲区大小
+
+    // 打开输出文件并启动后台线程，已经打开时先关闭
+    static bool Open(const std::string& file);
+    // 写完所有缓冲区中的日志后关闭文件
+    static void Close();
+    static bool IsOpen() { return s_open.load(std::memory_order_acquire); }
+    // 等待调用时刻之前写入的日志全部落到文件
+    static void Flush();
+    // 因单条记录过大而被丢弃的数量
+    static uint64_t GetDropped();
+
+    // fmt与site中的格式串相同，只用于编译期检查
+    template<class... Args>
+    static void Write(BinaryLogSite& site, Logger* logger, LogLevel::Level level,
+                      LogFormatString<std::type_identity_t<Args>...>, const Args&... args)
+    {
+        Emit<std::decay_t<decltype(LogArgs::Prepare(args))>...>(site, logger, level, LogArgs::Prepare(args)...);
+    }
+
+private:
+    template<class... Args>
+    static void Emit(BinaryLogSite& site, Logger* logger, LogLevel::Level level, const Args&... args)
+    {
+        if (!IsOpen())
+        {
+            return;
+        }
+
+        uint32_t site_id = site.id.load(std::memory_order_acquire);
+        if (site_id == 0)
+        {
+            site_id = RegisterSite(site, BinaryArgSignature<Args...>::value);
+        }
+
+        size_t size = sizeof(BinaryRecordHeader) + sizeof(BinaryLogRecord);
+        size += LogArgs::Size(args...);
+        size = (size + 7) & ~(size_t)7;
+
+        BinaryLogBuffer* buffer = ThreadBuffer();
+        if (size > buffer->capacity() / 2)
+        {
+            Drop();
+            return;
+        }
+
+        uint32_t logger_id = LoggerId(logger);
+        char* p = buffer->reserve(size);
+        if (!p)
+        {
+            return;
+        }
+
+        BinaryRecordHeader header = { BinaryRecordHeader::LOG, (uint8_t)level, 0, (uint32_t)size };
+        BinaryLogRecord record = { site_id, logger_id, ThreadInfo::GetThreadId(), ThreadInfo::GetFiberId(), Clock::Now() };
+        memcpy(p, &header, sizeof(header));
+        memcpy(p + sizeof(header), &record, sizeof(record));
+        LogArgs::Encode(p + sizeof(header) + sizeof(record), args...);
+        buffer->commit(size);
+    }
+
+    static uint32_t RegisterSite(BinaryLogSite& site, const char* signature);
+    static uint32_t LoggerId(Logger* logger);
+    static BinaryLogBuffer* ThreadBuffer();
+    static void Drop();
+
+private:
+    static std::atomic<bool> s_open;
+};
+
+// 读取二进制日志文件并还原成文本
+class BinaryLogDecoder
+{
+public:
+    struct Site
+    {
+        std::string file;
+        int line = 0;
+        std::string fmt;
+        std::string signature;
+    };
+
+    bool load(const std::string& file);
+
+    // 按时间顺序把全部日志用formatter格式化后写到out，返回日志条数
+    size_t decode(LogFormatter& formatter, std::ostream& out);
+
+private:
+    std::vector<char> m_data;
+    std::vector<Site> m_sites;                         // 按编号存放，编号从1连续分配
+    std::map<uint32_t, std::string> m_loggers;         // 日志器编号到名字，编号是进程内的，不连续
+    std::map<uint32_t, std::string> m_threads;         // 线程号到线程名
+    std::vector<size_t> m_records;                     // LOG记录在m_data中的偏移
+    std::vector<BinaryClockRecord> m_clocks;           // 按base_ticks排序
+};
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef __ZY_LOG_RATELIMIT_H__
+#define __ZY_LOG_RATELIMIT_H__
+
+#include <atomic>
+#include <cstdint>
+#include "log.h"
+#include "clock.h"
+
+// 按调用点采样和限流
+// 每个调用点有一份静态状态(常量初始化，没有静态初始化检查)，判断只需要一两次原子操作，
+// 被拦下的日志不会构造LogEvent，<<右边的表达式也不会被求值
+// 被拦下的条数会累计起来，下一次放行时先输出一行汇总：suppressed N messages since last output
+//
+// 用法与LOG_LEVEL_CPP相同：
+//     LOG_EVERY_N(logger, LogLevel::WARNING, 1000) << "queue full, size=" << size;
+//     LOG_FIRST_N(logger, LogLevel::INFO, 10) << ...;          // 只输出前10次
+//     LOG_FIRST_N_EVERY_M(logger, LogLevel::INFO, 10, 100) << ...;   // 前10次，之后每100次一次
+//     LOG_EVERY_MS(logger, LogLevel::ERROR, 1000) << ...;      // 每秒最多一次
+//     LOG_RATE_LIMIT(logger, LogLevel::ERROR, 100, 20) << ...; // 令牌桶，每秒100条，允许20条的突发
+// 参数可以是运行期的值，但同一调用点每次应该相同
+
+// 调用点的状态
+#define LOG_RATE_SITE() \
+    ([]() -> LogRateState& { static LogRateState s_state; return s_state; }())
+
+#define LOG_RATE_LIMITED(logger, level, check, ...) \
+    if ((level) < (logger)->getLevel()) {} \
+    else if (uint64_t zy_suppressed_ = 0; !LOG_RATE_SITE().check(&zy_suppressed_, __VA_ARGS__)) {} \
+    else LogEventWrap(logger, LogRateState::Begin(logger, level, __FILE__, __LINE__, zy_suppressed_)).getSs()
+
+#define LOG_EVERY_N(logger, level, n) \
+    LOG_RATE_LIMITED(logger, level, everyN, (n))
+
+#define LOG_FIRST_N(logger, level, n) \
+    LOG_RATE_LIMITED(logger, level, firstN, (n))
+
+#define LOG_FIRST_N_EVERY_M(logger, level, n, m) \
+    LOG_RATE_LIMITED(logger, level, firstNEveryM, (n), (m))
+
+#define LOG_EVERY_MS(logger, level, ms) \
+    LOG_RATE_LIMITED(logger, level, everyInterval, (uint64_t)(ms) * 1000000ULL)
+
+#define LOG_RATE_LIMIT(logger, level, per_second, burst) \
+    LOG_RATE_LIMITED(logger, level, tokenBucket, (per_second), (burst))
+
+class LogRateState
+{
+public:
+    constexpr LogRateState() {}
+
+    // 以下判断函数返回是否放行，放行时把之前被拦下的条数写到suppressed
+
+    // 第1、n+1、2n+1...次放行
+    bool everyN(uint64_t* suppressed, uint64_t n)
+    {
+        uint64_t c = m_count.fetch_add(1, std::memory_order_relaxed);
+        return decide(n <= 1 || c % n == 0, suppressed);
+    }
+
+    // 只放行前n次，之后连计数都不再增加
+    bool firstN(uint64_t* suppressed, uint64_t n)
+    {
+        if (m_count.load(std::memory_order_relaxed) >= n)
+        {
+            return decide(false, suppressed);
+        }
+        return decide(m_count.fetch_add(1, std::memory_order_relaxed) < n, suppressed);
+    }
+
+    // 放行前n次，之后每m次放行一次
+    bool firstNEveryM(uint64_t* suppressed, uint64_t n, uint64_t m)
+    {
+        uint64_t c = m_count.fetch_add(1, std::memory_order_relaxed);
+        return decide(c < n || m <= 1 || (c - n + 1) % m == 0, suppressed);
+    }
+
+    // 两次放行之间至少间隔interval_ns纳秒
+    bool everyInterval(uint64_t* suppressed, uint64_t interval_ns)
+    {
+        uint64_t now = Clock::ToNanoseconds(Clock::Now()) + 1;   // 加1让0表示从未放行
+        uint64_t last = m_time.load(std::memory_order_relaxed);
+        if (last != 0 && now - last < interval_ns)
+        {
+            return decide(false, suppressed);
+        }
+        // 多个线程同时到期时只有一个能放行
+        return decide(m_time.compare_exchange_strong(last, now, std::memory_order_relaxed), suppressed);
+    }
+
+    // 令牌桶，用GCRA实现：只维护一个"理论到达时间"，一次CAS完成取令牌
+    // 每秒补充per_second个令牌，桶容量burst
+    bool tokenBucket(uint64_t* suppressed, uint64_t per_second, uint64_t burst)
+    {
+        if (per_second == 0)
+        {
+            return decide(false, suppressed);
+        }
+        uint64_t interval = 1000000000ULL / per_second;
+        uint64_t tolerance = interval * (burst > 0 ? burst - 1 : 0);
+        uint64_t now = Clock::ToNanoseconds(Clock::Now());
+        uint64_t tat = m_time.load(std::memory_order_relaxed);
+        while (true)
+        {
+            uint64_t base = tat > now ? tat : now;
+            if (base - now > tolerance)
+            {
+                return decide(false, suppressed);
+            }
+            if (m_time.compare_exchange_weak(tat, base + interval, std::memory_order_relaxed))
+            {
+                return decide(true, suppressed);
+            }
+        }
+    }
+
+    // 创建本次要输出的事件，有被拦下的日志时先输出一行汇总
+    static LogEvent::ptr Begin(const Logger::ptr& logger, LogLevel::Level level, const char* file, int32_t line, uint64_t suppressed)
+    {
+        if (suppressed > 0)
+        {
+            LogEvent::ptr summary = LogEvent::Create(level, file, line, 0, ThreadInfo::GetThreadId(),
+                                                     ThreadInfo::GetFiberId(), 0, logger->getName());
+            summary->getSs() << "suppressed " << suppressed << " messages since last output";
+            logger->log(std::move(summary));
+        }
+        return LogEvent::Create(level, file, line, 0, ThreadInfo::GetThreadId(),
+                                ThreadInfo::GetFiberId(), 0, logger->getName());
+    }
+
+    uint64_t getSuppressed() const { return m_suppressed.load(std::memory_order_relaxed); }
+
+private:
+    // 拦下时计数；放行时取走累计的条数
+    bool decide(bool pass, uint64_t* suppressed)
+    {
+        if (!pass)
+        {
+            m_suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (m_suppressed.load(std::memory_order_relaxed) != 0)
+        {
+            *suppressed = m_suppressed.exchange(0, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+private:
+    std::atomic<uint64_t> m_count{0};                  // 经过的次数
+    std::atomic<uint64_t> m_suppressed{0};             // 上次放行之后被拦下的条数
+    std::atomic<uint64_t> m_time{0};                   // 上次放行的时刻，或令牌桶的理论到达时间(纳秒)
+};
+
+#endif
@@ -0,0 +1,277 @@
+#ifndef __ZY_LOG_STATIC_FORMAT_H__
+#define __ZY_LOG_STATIC_FORMAT_H__
+
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+#include "log.h"
+
+// 编译期解析的日志格式器
+// 格式串作为模板参数，在编译期被拆成一组格式项，format时按顺序直接展开成
+// 一串append调用：没有虚函数分发，没有shared_ptr拷贝，也没有流插入
+// 支持的格式字符与LogFormatter相同，不认识的格式字符或者没闭合的大括号会直接编译失败
+// 用法：
+//     typedef StaticLogFormatter<"%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"> MyFormatter;
+//     appender->setFormatter(LogFormatter::ptr(new MyFormatter));
+// 运行期配置的格式仍然使用LogFormatter
+
+// 可以作为模板参数的字符串字面量
+template<size_t N>
+struct FixedString
+{
+    char data[N] = {};
+
+    constexpr FixedString(const char (&str)[N])
+    {
+        for (size_t i = 0; i < N; ++i)
+        {
+            data[i] = str[i];
+        }
+    }
+
+    constexpr size_t size() const { return N - 1; }
+};
+
+// 编译期解析出的一个格式项
+struct StaticPatternItem
+{
+    char type = 0;        // 0 表示普通字符串，否则为%后的格式字符
+    size_t begin = 0;     // 普通字符串在格式串中的起始位置，或者大括号内子格式的起始位置
+    size_t len = 0;       // 对应的长度
+};
+
+// 编译期解析用到的辅助函数
+struct StaticPatternParser
+{
+    static constexpr bool IsKnownItem(char c)
+    {
+        switch (c)
+        {
+        case 'm': case 'p': case 'r': case 'c': case 't': case 'n':
+        case 'd': case 'f': case 'l': case 'T': case 'F': case 'N':
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // 解析格式串，out为nullptr时只计数
+    // 出错时抛异常，在常量求值中等价于编译错误
+    static constexpr size_t Parse(const char* p, size_t n, StaticPatternItem* out)
+    {
+        size_t count = 0;
+        size_t text_begin = 0;
+        size_t i = 0;
+
+        auto emit = [&](char type, size_t begin, size_t len) {
+            if (out)
+            {
+                out[count] = StaticPatternItem{type, begin, len};
+            }
+            ++count;
+        };
+
+        while (i < n)
+        {
+            if (p[i] != '%')
+            {
+                ++i;
+                continue;
+            }
+
+            if (i + 1 < n && p[i + 1] == '%')
+            {
+                // "%%" 输出一个%，把第一个%算进前面的普通字符串
+                emit(0, text_begin, i + 1 - text_begin);
+                i += 2;
+                text_begin = i;
+                continue;
+            }
+
+            if (i > text_begin)
+            {
+                emit(0, text_begin, i - text_begin);
+            }
+
+            if (i + 1 >= n)
+            {
+                throw "pattern ends with a single %";
+            }
+
+            char type = p[i + 1];
+            if (!IsKnownItem(type))
+            {
+                throw "unknown pattern item";
+            }
+
+            size_t fmt_begin = 0;
+            size_t fmt_len = 0;
+            i += 2;
+            if (i < n && p[i] == '{')
+            {
+                fmt_begin = i + 1;
+                while (i < n && p[i] != '}')
+                {
+                    ++i;
+                }
+                if (i == n)
+                {
+                    throw "unclosed { in pattern";
+                }
+                fmt_len = i - fmt_begin;
+                ++i;
+            }
+            emit(type, fmt_begin, fmt_len);
+            text_begin = i;
+        }
+
+        if (i > text_begin)
+        {
+            emit(0, text_begin, i - text_begin);
+        }
+        return count;
+    }
+
+    template<class Out, class T>
+    static void AppendInt(Out& out, T val)
+    {
+        char buf[24];
+        auto res = std::to_chars(buf, buf + sizeof(buf), val);
+        out.append(buf, res.ptr - buf);
+    }
+
+    template<class Out>
+    static void AppendCStr(Out& out, const char* str)
+    {
+        if (str)
+        {
+            out.append(str);
+        }
+    }
+};
+
+template<FixedString P>
+struct StaticParsedPattern
+{
+    static constexpr size_t count = StaticPatternParser::Parse(P.data, P.size(), nullptr);
+
+    static constexpr std::array<StaticPatternItem, count> items = [] {
+        std::array<StaticPatternItem, count> arr{};
+        StaticPatternParser::Parse(P.data, P.size(), arr.data());
+        return arr;
+    }();
+};
+
+// 把大括号内的子格式拷贝成以0结尾的数组，供strftime使用
+template<FixedString P, StaticPatternItem It>
+struct StaticSubFormat
+{
+    static constexpr std::array<char, (It.len ? It.len : 17) + 1> value = [] {
+        std::array<char, (It.len ? It.len : 17) + 1> arr{};
+        const char* def = "%Y-%m-%d %H:%M:%S";
+        for (size_t i = 0; i < (It.len ? It.len : 17); ++i)
+        {
+            arr[i] = It.len ? P.data[It.begin + i] : def[i];
+        }
+        return arr;
+    }();
+};
+
+template<FixedString P>
+class StaticLogFormatter : public LogFormatter
+{
+public:
+    typedef StaticParsedPattern<P> Parsed;
+
+    // 基类只保存一份格式串，便于getPattern查询，不做运行期解析
+    StaticLogFormatter()
+        : LogFormatter(P.data, NoParse())
+    {}
+
+    using LogFormatter::format;
+
+    virtual void format(LogStream& out, const LogEvent::ptr& event) override
+    {
+        formatTo(out, *event);
+    }
+
+    // 把事件追加到out后面，Out可以是LogStream或std::string
+    template<class Out>
+    static void formatTo(Out& out, const LogEvent& event)
+    {
+        formatImpl(out, event, std::make_index_sequence<Parsed::count>());
+    }
+
+private:
+    template<class Out, size_t... I>
+    static void formatImpl(Out& out, const LogEvent& event, std::index_sequence<I...>)
+    {
+        (formatItem<Parsed::items[I]>(out, event), ...);
+    }
+
+    template<StaticPatternItem It, class Out>
+    static void formatItem(Out& out, const LogEvent& event)
+    {
+        typedef StaticPatternParser H;
+        if constexpr (It.type == 0)
+        {
+            out.append(P.data + It.begin, It.len);
+        }
+        else if constexpr (It.type == 'm')
+        {
+            out.append(event.getMessage());
+        }
+        else if constexpr (It.type == 'p')
+        {
+            out.append(LogLevel::toChars(event.getLevel()));
+        }
+        else if constexpr (It.type == 'r')
+        {
+            H::AppendInt(out, event.getElapse());
+        }
+        else if constexpr (It.type == 'c')
+        {
+            out.append(event.getLoggerName());
+        }
+        else if constexpr (It.type == 't')
+        {
+            H::AppendInt(out, event.getThreadId());
+        }
+        else if constexpr (It.type == 'n')
+        {
+            out.push_back('\n');
+        }
+        else if constexpr (It.type == 'd')
+        {
+            static const DateTimeFormat s_format(StaticSubFormat<P, It>::value.data());
+            char buf[128];
+            out.append(buf, s_format.format(buf, sizeof(buf), event.getTime(), event.getMicroseconds()));
+        }
+        else if constexpr (It.type == 'f')
+        {
+            H::AppendCStr(out, event.getFile());
+        }
+        else if constexpr (It.type == 'l')
+        {
+            H::AppendInt(out, event.getLine());
+        }
+        else if constexpr (It.type == 'T')
+        {
+            out.push_back('\t');
+        }
+        else if constexpr (It.type == 'F')
+        {
+            H::AppendInt(out, event.getFiberId());
+        }
+        else if constexpr (It.type == 'N')
+        {
+            out.append(event.getThreadName());
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,248 @@
+#include "log_stats.h"
+
+#include <algorithm>
+#include <cstdio>
+
+std::atomic<bool> LogStats::s_enabled(false);
+
+static std::atomic<uint64_t> s_stats_id(0);
+
+// 每个线程记录自己在各个LogStats中的分片，与PerThreadQueueCache的做法相同
+struct LogStatsShardCache
+{
+    struct Ref
+    {
+        uint64_t owner;
+        std::shared_ptr<LogStats::Shard> shard;
+    };
+
+    ~LogStatsShardCache()
+    {
+        // 线程退出，分片交还给LogStats，已经记下的数据保留
+        for (auto& it : refs)
+        {
+            it.shard->used.store(false, std::memory_order_release);
+        }
+    }
+
+    uint64_t last_owner = 0;
+    LogStats::Shard* last = nullptr;
+    std::vector<Ref> refs;
+};
+
+static thread_local LogStatsShardCache t_shard_cache;
+
+LogStats::LogStats()
+    : m_id(++s_stats_id)
+{
+}
+
+LogStats::~LogStats()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& it : m_shards)
+    {
+        it->closed.store(true, std::memory_order_release);
+    }
+}
+
+LogStats::Shard& LogStats::local()
+{
+    LogStatsShardCache& cache = t_shard_cache;
+    if (cache.last_owner == m_id)
+    {
+        return *cache.last;
+    }
+
+    for (auto& it : cache.refs)
+    {
+        if (it.owner == m_id)
+        {
+            cache.last_owner = m_id;
+            cache.last = it.shard.get();
+            return *cache.last;
+        }
+    }
+
+    // 顺便清理已经销毁的LogStats留下的分片
+    for (size_t i = 0; i < cache.refs.size(); )
+    {
+        if (cache.refs[i].shard->closed.load(std::memory_order_acquire))
+        {
+            cache.refs[i] = std::move(cache.refs.back());
+            cache.refs.pop_back();
+        }
+        else
+        {
+            ++i;
+        }
+    }
+
+    std::shared_ptr<Shard> shard;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // 优先复用已退出线程的分片，线程频繁创建销毁时分片数不会一直增长
+        for (auto& it : m_shards)
+        {
+            bool expected = false;
+            if (it->used.compare_exchange_strong(expected, true, std::memory_order_acquire))
+            {
+                shard = it;
+                break;
+            }
+        }
+        if (!shard)
+        {
+            shard.reset(new Shard);
+            m_shards.push_back(shard);
+        }
+    }
+    cache.refs.push_back(LogStatsShardCache::Ref{m_id, shard});
+    cache.last_owner = m_id;
+    cache.last = shard.get();
+    return *cache.last;
+}
+
+LogStatsSnapshot LogStats::snapshot(const std::string& logger) const
+{
+    LogStatsSnapshot snap;
+    snap.logger = logger;
+    for (auto& it : snap.latency)
+    {
+        it.buckets.assign(LatencyHistogram::BUCKETS, 0);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& shard : m_shards)
+    {
+        snap.events += shard->counters[EVENTS].load(std::memory_order_relaxed);
+        snap.bytes += shard->counters[BYTES].load(std::memory_order_relaxed);
+        snap.drops += shard->counters[DROPS].load(std::memory_order_relaxed);
+        snap.flushes += shard->counters[FLUSHES].load(std::memory_order_relaxed);
+        for (int m = 0; m < METRIC_COUNT; ++m)
+        {
+            const LatencyHistogram& hist = shard->latency[m];
+            LogStatsSnapshot::Latency& out = snap.latency[m];
+            out.count += hist.getCount();
+            out.total_ns += hist.getTotal();
+            out.max_ns = std::max(out.max_ns, hist.getMax());
+            for (size_t i = 0; i < LatencyHistogram::BUCKETS; ++i)
+            {
+                out.buckets[i] += hist.getBucket(i);
+            }
+        }
+    }
+    return snap;
+}
+
+uint64_t LogStatsSnapshot::Latency::percentile(double p) const
+{
+    // 各个桶和总数不是同一时刻读到的，以桶的合计为准
+    uint64_t total = 0;
+    for (uint64_t it : buckets)
+    {
+        total += it;
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(p * total);
+    if (rank >= total)
+    {
+        rank = total - 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i)
+    {
+        seen += buckets[i];
+        if (seen > rank)
+        {
+            return std::min(LatencyHistogram::BucketUpper(i), max_ns);
+        }
+    }
+    return max_ns;
+}
+
+static const char* s_metric_names[LogStats::METRIC_COUNT] = { "log", "format", "append" };
+
+std::string LogStats::ToText(const std::vector<LogStatsSnapshot>& stats)
+{
+    std::string out;
+    char buf[256];
+    for (auto& it : stats)
+    {
+        snprintf(buf, sizeof(buf), "logger %s: events=%llu bytes=%llu drops=%llu flushes=%llu\n",
+                 it.logger.c_str(), (unsigned long long)it.events, (unsigned long long)it.bytes,
+                 (unsigned long long)it.drops, (unsigned long long)it.flushes);
+        out.append(buf);
+        for (int m = 0; m < METRIC_COUNT; ++m)
+        {
+            const LogStatsSnapshot::Latency& lat = it.latency[m];
+            if (lat.count == 0)
+            {
+                continue;
+            }
+            snprintf(buf, sizeof(buf), "  %-8s count=%llu mean=%.0fns p50=%lluns p99=%lluns p999=%lluns max=%lluns\n",
+                     s_metric_names[m], (unsigned long long)lat.count, lat.mean(),
+                     (unsigned long long)lat.percentile(0.5), (unsigned long long)lat.percentile(0.99),
+                     (unsigned long long)lat.percentile(0.999), (unsigned long long)lat.max_ns);
+            out.append(buf);
+        }
+    }
+    return out;
+}
+
+static void AppendJsonString(std::string& out, const std::string& str)
+{
+    out.push_back('"');
+    for (char c : str)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out.push_back('\\');
+            out.push_back(c);
+        }
+        else if ((unsigned char)c < 0x20)
+        {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out.append(buf);
+        }
+        else
+        {
+            out.push_back(c);
+        }
+    }
+    out.push_back('"');
+}
+
+std::string LogStats::ToJson(const std::vector<LogStatsSnapshot>& stats)
+{
+    std::string out = "{\"loggers\": [";
+    char buf[256];
+    for (size_t i = 0; i < stats.size(); ++i)
+    {
+        const LogStatsSnapshot& it = stats[i];
+        out.append(i ? ", {\"name\": " : "{\"name\": ");
+        AppendJsonString(out, it.logger);
+        snprintf(buf, sizeof(buf), ", \"events\": %llu, \"bytes\": %llu, \"drops\": %llu, \"flushes\": %llu, \"latency\": {",
+                 (unsigned long long)it.events, (unsigned long long)it.bytes,
+                 (unsigned long long)it.drops, (unsigned long long)it.flushes);
+        out.append(buf);
+        for (int m = 0; m < METRIC_COUNT; ++m)
+        {
+            const LogStatsSnapshot::Latency& lat = it.latency[m];
+            snprintf(buf, sizeof(buf), "%s\"%s\": {\"count\": %llu, \"mean_ns\": %.1f, \"p50_ns\": %llu, "
+                     "\"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}",
+                     m ? ", " : "", s_metric_names[m], (unsigned long long)lat.count, lat.mean(),
+                     (unsigned long long)lat.percentile(0.5), (unsigned long long)lat.percentile(0.99),
+                     (unsigned long long)lat.percentile(0.999), (unsigned long long)lat.max_ns);
+            out.append(buf);
+        }
+        out.append("}}");
+    }
+    out.append("]}\n");
+    return out;
+}
@@ -0,0 +1,189 @@
+#ifndef __ZY_LOG_STATS_H__
+#define __ZY_LOG_STATS_H__
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// 日志系统自身的运行统计
+// 每个日志器一份LogStats，记录事件数、字节数、丢弃数、flush次数，以及三类耗时的直方图：
+//     LOG     Logger::log整个调用(异步模式下只是入队)
+//     FORMAT  输出地调用格式器
+//     APPEND  单个输出地的log调用(包括其中的格式化)
+// 计数和直方图按线程分片，写入时只改本线程的分片(普通的读加写，没有加锁指令)，
+// 查询时把所有分片加起来
+// 默认关闭，关闭时热路径上只多一次原子变量的读取；通过LogManager::setStatsEnabled打开
+//
+// 事件数、LOG耗时、flush次数记在被调用的日志器上；
+// 字节数、FORMAT、APPEND、丢弃数记在实际执行输出的日志器上(没有输出地的日志器会交给上级输出)
+// 输出地需要通过LogAppender::format格式化，FORMAT和字节数才会被记录
+
+// 对数线性分桶的延迟直方图(HDR Histogram的简化版)
+// 小于8ns的值各占一个桶，之后每个2的幂区间分成8个桶，相对误差不超过12.5%
+// 超过2^40ns(约18分钟)的值记在最后一个桶
+class LatencyHistogram
+{
+public:
+    enum
+    {
+        SUB_BITS = 3,
+        SUB_COUNT = 1 << SUB_BITS,
+        MAX_BITS = 40,
+        BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT
+    };
+
+    static size_t BucketOf(uint64_t ns)
+    {
+        if (ns < SUB_COUNT)
+        {
+            return ns;
+        }
+        if (ns >= (1ULL << MAX_BITS))
+        {
+            return BUCKETS - 1;
+        }
+        int exp = 63 - __builtin_clzll(ns);
+        return (exp - SUB_BITS + 1) * SUB_COUNT + ((ns >> (exp - SUB_BITS)) & (SUB_COUNT - 1));
+    }
+
+    // 桶内的最大值，分位数按它报告
+    static uint64_t BucketUpper(size_t idx)
+    {
+        if (idx < SUB_COUNT)
+        {
+            return idx;
+        }
+        int exp = idx / SUB_COUNT + SUB_BITS - 1;
+        uint64_t lower = (uint64_t)(SUB_COUNT + idx % SUB_COUNT) << (exp - SUB_BITS);
+        return lower + (1ULL << (exp - SUB_BITS)) - 1;
+    }
+
+    // 只由分片所属的线程调用
+    void record(uint64_t ns)
+    {
+        Bump(m_buckets[BucketOf(ns)], 1);
+        Bump(m_count, 1);
+        Bump(m_total, ns);
+        if (ns > m_max.load(std::memory_order_relaxed))
+        {
+            m_max.store(ns, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t getCount() const { return m_count.load(std::memory_order_relaxed); }
+    uint64_t getTotal() const { return m_total.load(std::memory_order_relaxed); }
+    uint64_t getMax() const { return m_max.load(std::memory_order_relaxed); }
+    uint64_t getBucket(size_t idx) const { return m_buckets[idx].load(std::memory_order_relaxed); }
+
+    // 单写者的计数，不需要原子的读改写
+    static void Bump(std::atomic<uint64_t>& val, uint64_t n)
+    {
+        val.store(val.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> m_buckets[BUCKETS] = {};
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<uint64_t> m_total{0};
+    std::atomic<uint64_t> m_max{0};
+};
+
+// 一个日志器某一时刻的统计，由各分片汇总而来
+struct LogStatsSnapshot
+{
+    struct Latency
+    {
+        uint64_t count = 0;
+        uint64_t total_ns = 0;
+        uint64_t max_ns = 0;
+        std::vector<uint64_t> buckets;
+
+        double mean() const { return count ? (double)total_ns / count : 0; }
+        // p取0到1之间，返回对应桶的上界，最大不超过max_ns
+        uint64_t percentile(double p) const;
+    };
+
+    std::string logger;
+    uint64_t events = 0;
+    uint64_t bytes = 0;
+    uint64_t drops = 0;
+    uint64_t flushes = 0;
+    Latency latency[3];                                // 按LogStats::Metric存放
+
+    bool empty() const { return events == 0 && bytes == 0 && drops == 0 && flushes == 0; }
+};
+
+class LogStats
+{
+public:
+    enum Metric
+    {
+        LOG = 0,
+        FORMAT = 1,
+        APPEND = 2,
+        METRIC_COUNT = 3
+    };
+
+    enum Counter
+    {
+        EVENTS = 0,
+        BYTES = 1,
+        DROPS = 2,
+        FLUSHES = 3,
+        COUNTER_COUNT = 4
+    };
+
+    // 一个线程的分片，线程退出后分片留给之后的新线程复用
+    struct Shard
+    {
+        void add(Counter counter, uint64_t n) { LatencyHistogram::Bump(counters[counter], n); }
+        void record(Metric metric, uint64_t ns) { latency[metric].record(ns); }
+
+        std::atomic<uint64_t> counters[COUNTER_COUNT] = {};
+        LatencyHistogram latency[METRIC_COUNT];
+        std::atomic<bool> used{true};                  // 是否有线程正在使用
+        std::atomic<bool> closed{false};               // 所属的LogStats已经销毁
+    };
+
+    LogStats();
+    ~LogStats();
+    LogStats(const LogStats&) = delete;
+    LogStats& operator=(const LogStats&) = delete;
+
+    static bool IsEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+    static void SetEnabled(bool enabled) { s_enabled.store(enabled, std::memory_order_relaxed); }
+
+    // 当前线程的分片
+    Shard& local();
+
+    void add(Counter counter, uint64_t n = 1)
+    {
+        if (IsEnabled())
+        {
+            local().add(counter, n);
+        }
+    }
+
+    LogStatsSnapshot snapshot(const std::string& logger) const;
+
+    // 输出地格式化时把耗时和字节数记到这个分片上，由Logger::doLog在调用输出地前设置
+    static Shard* Current() { return t_current; }
+    static void SetCurrent(Shard* shard) { t_current = shard; }
+
+    // 汇总结果输出成文本或JSON
+    static std::string ToText(const std::vector<LogStatsSnapshot>& stats);
+    static std::string ToJson(const std::vector<LogStatsSnapshot>& stats);
+
+private:
+    uint64_t m_id;
+    mutable std::mutex m_mutex;
+    std::vector<std::shared_ptr<Shard>> m_shards;      // 所有分片，受m_mutex保护
+
+    static std::atomic<bool> s_enabled;
+    static inline thread_local Shard* t_current = nullptr;
+};
+
+#endif
@@ -0,0 +1,289 @@
+#ifndef __ZY_LOG_STREAM_H__
+#define __ZY_LOG_STREAM_H__
+
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// 日志专用的输出流
+// 代替std::stringstream：不依赖locale，不做虚函数调用，数字用std::to_chars直接转换
+// 默认先写进对象内部的小缓冲区，放不下时才转到堆上，所以常见长度的日志不需要任何堆分配
+// 也可以包装调用者提供的固定缓冲区(例如内存映射区)，写满后只统计长度，不再写入
+//
+// 支持 std::endl(输出'\n')、std::hex/std::oct/std::dec(影响之后的整数)，
+// 其余操纵符会被忽略；自定义类型优先使用LogFormatTraits，
+// 否则如果重载了std::ostream的<<，则借助ostringstream转换
+class LogStream;
+
+// 自定义类型的输出方式，特化之后LogStream的<<和LOG_INFO等宏的{}都按它输出：
+//     template<>
+//     struct LogFormatTraits<Point>
+//     {
+//         static void Format(LogStream& out, const Point& p) { out << '(' << p.x << ", " << p.y << ')'; }
+//     };
+template<class T>
+struct LogFormatTraits;
+
+template<class T>
+concept HasLogFormatTraits = requires(LogStream& out, const T& v) { LogFormatTraits<T>::Format(out, v); };
+
+class LogStream
+{
+public:
+    enum { INLINE_SIZE = 256 };
+
+    LogStream()
+        : m_begin(m_inline), m_cur(m_inline), m_end(m_inline + INLINE_SIZE) {}
+
+    // 包装外部缓冲区，不会扩容
+    LogStream(char* buf, size_t len)
+        : m_begin(buf), m_cur(buf), m_end(buf + len), m_fixed(true) {}
+
+    ~LogStream()
+    {
+        if (m_heap)
+        {
+            free(m_begin);
+        }
+    }
+
+    LogStream(const LogStream&) = delete;
+    LogStream& operator=(const LogStream&) = delete;
+
+    const char* data() const { return m_begin; }
+    size_t size() const { return m_cur - m_begin; }
+    bool empty() const { return m_cur == m_begin; }
+    std::string_view view() const { return std::string_view(m_begin, m_cur - m_begin); }
+    std::string str() const { return std::string(m_begin, m_cur - m_begin); }
+
+    // 完整内容需要的长度；只有外部缓冲区写满时才会大于size()
+    size_t needed() const { return size() + m_overflow; }
+    bool overflowed() const { return m_overflow > 0; }
+
+    // 清空内容，已经申请的堆内存保留下来复用
+    void clear()
+    {
+        m_cur = m_begin;
+        m_overflow = 0;
+        m_base = 10;
+    }
+
+    void append(const char* str, size_t len)
+    {
+        if ((size_t)(m_end - m_cur) < len && !reserve(len))
+        {
+            size_t room = m_end - m_cur;
+            memcpy(m_cur, str, room);
+            m_cur = m_end;
+            m_overflow += len - room;
+            return;
+        }
+        memcpy(m_cur, str, len);
+        m_cur += len;
+    }
+    void append(std::string_view str) { append(str.data(), str.size()); }
+    // 在末尾留出len字节由调用者直接写入，空间不够且无法扩容时返回nullptr
+    char* extend(size_t len)
+    {
+        if ((size_t)(m_end - m_cur) < len && !reserve(len))
+        {
+            return nullptr;
+        }
+        char* p = m_cur;
+        m_cur += len;
+        return p;
+    }
+    void append(const char* str) { append(str, strlen(str)); }
+    void append(const std::string& str) { append(str.data(), str.size()); }
+    void push_back(char c)
+    {
+        if (m_cur < m_end || reserve(1))
+        {
+            *m_cur++ = c;
+        }
+        else
+        {
+            ++m_overflow;
+        }
+    }
+
+    LogStream& operator<<(bool v) { push_back(v ? '1' : '0'); return *this; }
+    LogStream& operator<<(char v) { push_back(v); return *this; }
+    LogStream& operator<<(signed char v) { push_back(v); return *this; }
+    LogStream& operator<<(unsigned char v) { push_back(v); return *this; }
+    LogStream& operator<<(short v) { return appendInt(v); }
+    LogStream& operator<<(unsigned short v) { return appendInt(v); }
+    LogStream& operator<<(int v) { return appendInt(v); }
+    LogStream& operator<<(unsigned int v) { return appendInt(v); }
+    LogStream& operator<<(long v) { return appendInt(v); }
+    LogStream& operator<<(unsigned long v) { return appendInt(v); }
+    LogStream& operator<<(long long v) { return appendInt(v); }
+    LogStream& operator<<(unsigned long long v) { return appendInt(v); }
+    LogStream& operator<<(float v) { return appendFloat(v); }
+    LogStream& operator<<(double v) { return appendFloat(v); }
+    LogStream& operator<<(long double v) { return appendFloat(v); }
+
+    LogStream& operator<<(const char* v)
+    {
+        if (v)
+        {
+            append(v, strlen(v));
+        }
+        return *this;
+    }
+    LogStream& operator<<(const std::string& v) { append(v.data(), v.size()); return *this; }
+    LogStream& operator<<(std::string_view v) { append(v.data(), v.size()); return *this; }
+
+    LogStream& operator<<(const void* v)
+    {
+        if (!v)
+        {
+            push_back('0');
+            return *this;
+        }
+        char buf[2 + 16];
+        buf[0] = '0';
+        buf[1] = 'x';
+        auto res = std::to_chars(buf + 2, buf + sizeof(buf), (uintptr_t)v, 16);
+        append(buf, res.ptr - buf);
+        return *this;
+    }
+
+    // 操纵符
+    LogStream& operator<<(std::ostream& (*pf)(std::ostream&))
+    {
+        if (pf == static_cast<std::ostream& (*)(std::ostream&)>(std::endl))
+        {
+            push_back('\n');
+        }
+        return *this;
+    }
+    LogStream& operator<<(std::ios_base& (*pf)(std::ios_base&))
+    {
+        if (pf == static_cast<std::ios_base& (*)(std::ios_base&)>(std::hex))
+        {
+            m_base = 16;
+        }
+        else if (pf == static_cast<std::ios_base& (*)(std::ios_base&)>(std::oct))
+        {
+            m_base = 8;
+        }
+        else if (pf == static_cast<std::ios_base& (*)(std::ios_base&)>(std::dec))
+        {
+            m_base = 10;
+        }
+        return *this;
+    }
+
+    // 其他类型：有LogFormatTraits的按它输出，枚举按整数输出，重载了std::ostream<<的类型走ostringstream
+    template<class T>
+        requires (!std::is_arithmetic_v<T>) &&
+                 (HasLogFormatTraits<T> || std::is_enum_v<T> || requires(std::ostream& os, const T& v) { os << v; })
+    LogStream& operator<<(const T& v)
+    {
+        if constexpr (HasLogFormatTraits<T>)
+        {
+            LogFormatTraits<T>::Format(*this, v);
+            return *this;
+        }
+        else if constexpr (std::is_enum_v<T>)
+        {
+            return appendInt(static_cast<std::underlying_type_t<T>>(v));
+        }
+        else if constexpr (std::is_pointer_v<T>)
+        {
+            // 非const的char*也按字符串输出，其余指针输出地址
+            if constexpr (std::is_same_v<std::remove_cv_t<std::remove_pointer_t<T>>, char>)
+            {
+                return *this << static_cast<const char*>(v);
+            }
+            else
+            {
+                return *this << static_cast<const void*>(v);
+            }
+        }
+        else
+        {
+            static thread_local std::ostringstream t_ss;
+            t_ss.str(std::string());
+            t_ss.clear();
+            t_ss << v;
+            append(t_ss.view());
+            return *this;
+        }
+    }
+
+private:
+    template<class T>
+    LogStream& appendInt(T v)
+    {
+        char buf[72];
+        auto res = std::to_chars(buf, buf + sizeof(buf), v, m_base);
+        append(buf, res.ptr - buf);
+        return *this;
+    }
+
+    template<class T>
+    LogStream& appendFloat(T v)
+    {
+        // 最短的可往返表示
+        char buf[128];
+        auto res = std::to_chars(buf, buf + sizeof(buf), v);
+        append(buf, res.ptr - buf);
+        return *this;
+    }
+
+    // 保证至少还有len字节的空间，外部缓冲区无法扩容时返回false
+    bool reserve(size_t len)
+    {
+        if (m_fixed)
+        {
+            return false;
+        }
+        size_t used = m_cur - m_begin;
+        size_t cap = m_end - m_begin;
+        while (cap < used + len)
+        {
+            cap *= 2;
+        }
+        char* buf;
+        if (m_heap)
+        {
+            buf = (char*)realloc(m_begin, cap);
+        }
+        else
+        {
+            buf = (char*)malloc(cap);
+            if (buf)
+            {
+                memcpy(buf, m_begin, used);
+            }
+        }
+        if (!buf)
+        {
+            return false;
+        }
+        m_heap = true;
+        m_begin = buf;
+        m_cur = buf + used;
+        m_end = buf + cap;
+        return true;
+    }
+
+private:
+    char* m_begin;
+    char* m_cur;
+    char* m_end;
+    size_t m_overflow = 0;             // 外部缓冲区写不下的字节数
+    int m_base = 10;                   // 整数的进制
+    bool m_heap = false;               // m_begin是否为堆上申请的内存
+    bool m_fixed = false;              // 是否为外部缓冲区
+    char m_inline[INLINE_SIZE];
+};
+
+#endif
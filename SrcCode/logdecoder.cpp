@@ -0,0 +1,27 @@
+#include <iostream>
+
+#include "log_binary.h"
+
+// 把二进制日志还原成文本
+// 用法: ./logdecoder <binary log file> [pattern]
+// pattern与LogFormatter相同，默认和控制台输出的格式一致
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cout << "usage: " << argv[0] << " <binary log file> [pattern]" << std::endl;
+        return 1;
+    }
+
+    std::string pattern = argc > 2 ? argv[2] : "%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T[%c]%T%f:%l%T%m%n";
+    LogFormatter formatter(pattern);
+
+    BinaryLogDecoder decoder;
+    if (!decoder.load(argv[1]))
+    {
+        return 1;
+    }
+    decoder.decode(formatter, std::cout);
+    return 0;
+}
@@ -0,0 +1,220 @@
+#ifndef __ZY_RINGBUFFER_H__
+#define __ZY_RINGBUFFER_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// 有界无锁环形队列 (Dmitry Vyukov 的 bounded MPMC 算法)
+// 每个槽位带一个序号，生产者和消费者各自通过 CAS 抢占位置，不需要任何锁
+// 多生产者单消费者是主要用法，但 pop 同样支持并发调用，
+// 这样 "丢弃最旧" 策略下生产者也可以安全地从队头弹出元素
+template<class T>
+class RingBuffer
+{
+public:
+    // 容量会被向上取整为 2 的幂，方便用掩码代替取模
+    explicit RingBuffer(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        m_mask = size - 1;
+        m_cells = new Cell[size];
+        for (size_t i = 0; i < size; ++i)
+        {
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+        m_head.store(0, std::memory_order_relaxed);
+        m_tail.store(0, std::memory_order_relaxed);
+    }
+
+    ~RingBuffer() { delete[] m_cells; }
+
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    // 队列满时返回false，不会阻塞
+    bool push(T&& val)
+    {
+        Cell* cell;
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                // 该槽位还没被消费，说明队列已满
+                return false;
+            }
+            else
+            {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = std::move(val);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 队列空时返回false
+    bool pop(T& val)
+    {
+        Cell* cell;
+        size_t pos = m_head.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0)
+            {
+                if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+        val = std::move(cell->data);
+        cell->seq.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t capacity() const { return m_mask + 1; }
+
+    // 近似值，仅用于统计和判断是否需要唤醒
+    size_t size() const
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t head = m_head.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    // 头尾指针放在不同的缓存行，避免生产者和消费者互相伪共享
+    alignas(64) std::atomic<size_t> m_head;
+    alignas(64) std::atomic<size_t> m_tail;
+    alignas(64) Cell* m_cells = nullptr;
+    size_t m_mask = 0;
+};
+
+// 单生产者单消费者的有界环形队列
+// 生产者只写尾、消费者只写头，各自缓存对方的位置，只有缓存的位置不够用时才去读对方的缓存行
+template<class T>
+class SpscRingBuffer
+{
+public:
+    // 容量会被向上取整为 2 的幂
+    explicit SpscRingBuffer(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        m_mask = size - 1;
+        m_data = new T[size];
+        m_head.store(0, std::memory_order_relaxed);
+        m_tail.store(0, std::memory_order_relaxed);
+    }
+
+    ~SpscRingBuffer() { delete[] m_data; }
+
+    SpscRingBuffer(const SpscRingBuffer&) = delete;
+    SpscRingBuffer& operator=(const SpscRingBuffer&) = delete;
+
+    // 只能由生产者调用，队列满时返回false，不会移动val
+    bool push(T&& val)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_headCache > m_mask)
+        {
+            m_headCache = m_head.load(std::memory_order_acquire);
+            if (tail - m_headCache > m_mask)
+            {
+                return false;
+            }
+        }
+        m_data[tail & m_mask] = std::move(val);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 只能由消费者调用，队列空时返回false
+    bool pop(T& val)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tailCache)
+        {
+            m_tailCache = m_tail.load(std::memory_order_acquire);
+            if (head == m_tailCache)
+            {
+                return false;
+            }
+        }
+        val = std::move(m_data[head & m_mask]);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 只能由消费者调用，把已有的元素一次取出最多max个追加到out，只发布一次头位置
+    // 返回取出的数量
+    template<class Container>
+    size_t popBatch(Container& out, size_t max)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        m_tailCache = m_tail.load(std::memory_order_acquire);
+        size_t n = m_tailCache - head < max ? m_tailCache - head : max;
+        for (size_t i = 0; i < n; ++i)
+        {
+            out.push_back(std::move(m_data[(head + i) & m_mask]));
+        }
+        m_head.store(head + n, std::memory_order_release);
+        return n;
+    }
+
+    size_t capacity() const { return m_mask + 1; }
+
+    // 累计入队和出队的数量，可以在任意线程读取
+    size_t pushed() const { return m_tail.load(std::memory_order_acquire); }
+    size_t popped() const { return m_head.load(std::memory_order_acquire); }
+    bool empty() const { return popped() == pushed(); }
+
+private:
+    alignas(64) std::atomic<size_t> m_head;            // 消费者写
+    size_t m_tailCache = 0;                            // 消费者看到的尾
+    alignas(64) std::atomic<size_t> m_tail;            // 生产者写
+    size_t m_headCache = 0;                            // 生产者看到的头
+    alignas(64) T* m_data = nullptr;
+    size_t m_mask = 0;
+};
+
+#endif
@@ -0,0 +1,451 @@
+#include "scheduler.h"
+
+#include <climits>
+#include <cstdio>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "log.h"
+#include "thread.h"
+
+static thread_local Scheduler* t_scheduler = nullptr;
+static thread_local int t_worker_idx = -1;
+static thread_local uint32_t t_running_id = 0;         // 工作线程正在执行的协程号
+static thread_local bool t_requeue = false;            // 正在执行的协程通过Scheduler::Yield让出
+
+static void FutexWait(std::atomic<uint32_t>* addr, uint32_t val)
+{
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAIT_PRIVATE, val, nullptr, nullptr, 0);
+}
+
+static void FutexWake(std::atomic<uint32_t>* addr, int count)
+{
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+Scheduler::Scheduler(size_t threads, const std::string& name)
+    : m_name(name), m_inject(INJECT_CAPACITY)
+{
+    if (threads == 0)
+    {
+        threads = std::thread::hardware_concurrency();
+        threads = threads ? threads : 1;
+    }
+    for (size_t i = 0; i < threads; ++i)
+    {
+        m_workers.emplace_back(new Worker);
+        m_workers.back()->rand = (i + 1) * 0x9E3779B97F4A7C15ULL;
+    }
+    m_injected.store(0, std::memory_order_relaxed);
+    m_epoch.store(0, std::memory_order_relaxed);
+    m_sleepers.store(0, std::memory_order_relaxed);
+    m_searching.store(0, std::memory_order_relaxed);
+    m_waking.store(false, std::memory_order_relaxed);
+    m_started.store(false, std::memory_order_relaxed);
+    m_stopping.store(false, std::memory_order_relaxed);
+}
+
+Scheduler::~Scheduler()
+{
+    stop();
+}
+
+bool Scheduler::start()
+{
+    if (m_stopping.load(std::memory_order_relaxed) || m_started.exchange(true))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < m_workers.size(); ++i)
+    {
+        m_workers[i]->thread = std::thread(&Scheduler::run, this, i);
+    }
+    return true;
+}
+
+void Scheduler::stop()
+{
+    if (t_scheduler == this || m_stopped)
+    {
+        return;
+    }
+    m_stopping.store(true, std::memory_order_seq_cst);
+    for (size_t i = 0; i < m_workers.size(); ++i)
+    {
+        tickle();
+    }
+    for (auto& it : m_workers)
+    {
+        if (it->thread.joinable())
+        {
+            it->thread.join();
+        }
+    }
+    m_stopped = true;
+
+    // 没有启动过时注入队列里可能还有任务
+    Task* task = nullptr;
+    while (m_inject.pop(task))
+    {
+        delete task;
+    }
+}
+
+bool Scheduler::schedule(std::function<void()> cb)
+{
+    if (!cb)
+    {
+        return false;
+    }
+    return submit(new Task{nullptr, std::move(cb)});
+}
+
+bool Scheduler::schedule(Fiber::ptr fiber)
+{
+    if (!fiber)
+    {
+        return false;
+    }
+    return submit(new Task{std::move(fiber), nullptr});
+}
+
+bool Scheduler::submit(Task* task)
+{
+    if (t_scheduler == this)
+    {
+        // 工作线程自己产生的任务，停止过程中也要接受，否则正在执行的任务没法完成
+        Worker& worker = *m_workers[t_worker_idx];
+        worker.submitted.store(worker.submitted.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        worker.deque.push(task);
+    }
+    else
+    {
+        // 先计数再检查停止标志，和stopping()的先读标志再读计数配对，
+        // 保证工作线程不会在任务入队之前判定可以退出
+        m_injected.fetch_add(1, std::memory_order_seq_cst);
+        if (m_stopping.load(std::memory_order_seq_cst))
+        {
+            m_injected.fetch_sub(1, std::memory_order_seq_cst);
+            delete task;
+            tickle();
+            return false;
+        }
+        while (!m_inject.push(std::move(task)))
+        {
+            std::this_thread::yield();
+        }
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    notify();
+    return true;
+}
+
+void Scheduler::run(size_t idx)
+{
+    t_scheduler = this;
+    t_worker_idx = (int)idx;
+    ThreadInfo::SetThreadName(m_name + "_" + std::to_string(idx));
+    if (!m_cpus.empty())
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(m_cpus[idx % m_cpus.size()], &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        {
+            LOG_WARNING(LOG_NAME("system"), "scheduler {} worker {} bind cpu {} failed",
+                        m_name, idx, m_cpus[idx % m_cpus.size()]);
+        }
+    }
+    Fiber::GetThis();
+    onWorkerStart();
+
+    Worker& worker = *m_workers[idx];
+    bool searching = false;                            // 已经计入m_searching
+    for (uint64_t tick = 1; ; ++tick)
+    {
+        Task* task = search(worker, tick, searching);
+        searching = false;
+        if (task)
+        {
+            execute(worker, task);
+            continue;
+        }
+        if (stopping())
+        {
+            break;
+        }
+        Bump(worker, STAT_PARKS);
+        // 休眠前清掉唤醒标记，之后的提交重新可以叫醒线程；idle里会再检查一次有没有任务
+        m_waking.store(false, std::memory_order_seq_cst);
+        idle();
+        // 先进入查找状态再清掉唤醒标记，保证从被叫醒到找到任务之间的提交不会再叫醒别的线程
+        m_searching.fetch_add(1, std::memory_order_seq_cst);
+        m_waking.store(false, std::memory_order_seq_cst);
+        searching = true;
+    }
+    // 依次唤醒其他休眠的工作线程，让它们也看到停止条件
+    tickle();
+
+    worker.cbFiber.reset();
+    t_scheduler = nullptr;
+    t_worker_idx = -1;
+}
+
+Scheduler::Task* Scheduler::next(Worker& worker, uint64_t tick)
+{
+    Task* task = nullptr;
+    // 隔一段时间先看注入队列，避免本地任务不断产生时外部任务一直得不到执行
+    if (tick % INJECT_INTERVAL == 0 && m_inject.pop(task))
+    {
+        Bump(worker, STAT_INJECTED);
+        return task;
+    }
+    if ((task = worker.deque.pop()))
+    {
+        Bump(worker, STAT_LOCAL);
+        return task;
+    }
+    if (m_inject.pop(task))
+    {
+        Bump(worker, STAT_INJECTED);
+        return task;
+    }
+    return steal(worker);
+}
+
+Scheduler::Task* Scheduler::search(Worker& worker, uint64_t tick, bool counted)
+{
+    Task* task = next(worker, tick);
+    if (!counted)
+    {
+        // 同时查找的线程不超过一半，多了只是互相抢同一批任务
+        if (task || m_searching.load(std::memory_order_relaxed) * 2 >= m_workers.size())
+        {
+            return task;
+        }
+        m_searching.fetch_add(1, std::memory_order_seq_cst);
+    }
+    // 短时间内很可能有新任务提交或者别的线程积压出可偷的任务，先让出几轮再看，比直接休眠再被叫醒便宜
+    for (int i = 0; !task && i < SPIN_ROUNDS; ++i)
+    {
+        std::this_thread::yield();
+        task = next(worker, tick);
+    }
+    if (m_searching.fetch_sub(1, std::memory_order_seq_cst) == 1 && task)
+    {
+        // 最后一个查找的线程找到了任务，后面可能还有，接力叫醒一个同伴
+        notify();
+    }
+    if (!task)
+    {
+        // 和notify中先入队再读m_searching配对：提交者因为看到有线程在查找而没有唤醒时，这里一定能看到它的任务
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        task = next(worker, tick);
+    }
+    return task;
+}
+
+Scheduler::Task* Scheduler::steal(Worker& worker)
+{
+    size_t count = m_workers.size();
+    if (count <= 1)
+    {
+        return nullptr;
+    }
+    // xorshift挑一个起点，避免所有线程都从同一个目标开始偷
+    worker.rand ^= worker.rand << 13;
+    worker.rand ^= worker.rand >> 7;
+    worker.rand ^= worker.rand << 17;
+    size_t start = worker.rand % count;
+    for (size_t i = 0; i < count; ++i)
+    {
+        Worker& victim = *m_workers[(start + i) % count];
+        if (&victim == &worker)
+        {
+            continue;
+        }
+        Task* task = victim.deque.steal();
+        if (task)
+        {
+            Bump(worker, STAT_STEALS);
+            // 偷到说明别处还积压着任务，叫醒一个同伴一起偷
+            if (!victim.deque.empty())
+            {
+                notify();
+            }
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+void Scheduler::execute(Worker& worker, Task* task)
+{
+    Fiber::ptr fiber = std::move(task->fiber);
+    if (!fiber)
+    {
+        if (worker.cbFiber && worker.cbFiber->isFinished())
+        {
+            worker.cbFiber->reset(std::move(task->cb));
+            fiber = worker.cbFiber;
+        }
+        else
+        {
+            // 上一个回调协程还没有结束(让出后被别人持有)，换一个新的
+            fiber.reset(new Fiber(std::move(task->cb)));
+            worker.cbFiber = fiber;
+        }
+    }
+    delete task;
+
+    Bump(worker, STAT_RUNS);
+    t_requeue = false;
+    t_running_id = fiber->getId();
+    // 协程可能刚被别的线程重新提交，还没有完全切出，等它切出来
+    while (!fiber->resume())
+    {
+        if (fiber->getState() != Fiber::RUNNING)
+        {
+            break;
+        }
+        std::this_thread::yield();
+    }
+    t_running_id = 0;
+
+    if (t_requeue && fiber->getState() == Fiber::READY)
+    {
+        submit(new Task{std::move(fiber), nullptr});
+    }
+    worker.finished.store(worker.finished.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void Scheduler::Yield()
+{
+    // 只有工作线程直接执行的协程才能重新排队，嵌套resume的子协程照常Yield给它的调用者
+    if (!t_scheduler || t_running_id == 0 || Fiber::GetFiberId() != t_running_id)
+    {
+        return;
+    }
+    t_requeue = true;
+    Fiber::Yield();
+}
+
+void Scheduler::idle()
+{
+    uint32_t epoch = m_epoch.load(std::memory_order_acquire);
+    m_sleepers.fetch_add(1, std::memory_order_seq_cst);
+    // 和submit中入队之后的屏障配对：要么这里看到新任务，要么提交者看到有线程在休眠
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!hasWork() && !stopping())
+    {
+        FutexWait(&m_epoch, epoch);
+    }
+    m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void Scheduler::notify()
+{
+    // 先读再交换，所有线程都在忙时标记一直是true，提交只有两次读的开销
+    if (m_searching.load(std::memory_order_seq_cst) != 0 || m_waking.load(std::memory_order_seq_cst)
+        || m_waking.exchange(true, std::memory_order_seq_cst))
+    {
+        return;
+    }
+    tickle();
+}
+
+void Scheduler::tickle()
+{
+    if (m_sleepers.load(std::memory_order_seq_cst) == 0)
+    {
+        return;
+    }
+    m_epoch.fetch_add(1, std::memory_order_release);
+    FutexWake(&m_epoch, 1);
+}
+
+bool Scheduler::stopping()
+{
+    return m_stopping.load(std::memory_order_seq_cst) && pending() == 0;
+}
+
+bool Scheduler::hasWork() const
+{
+    if (!m_inject.empty())
+    {
+        return true;
+    }
+    for (auto& it : m_workers)
+    {
+        if (!it->deque.empty())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t Scheduler::pending() const
+{
+    // 先读完成数再读提交数，读的过程中有任务完成或提交只会让结果偏大，不会误判为0
+    uint64_t finished = 0;
+    for (auto& it : m_workers)
+    {
+        finished += it->finished.load(std::memory_order_acquire);
+    }
+    uint64_t submitted = m_injected.load(std::memory_order_seq_cst);
+    for (auto& it : m_workers)
+    {
+        submitted += it->submitted.load(std::memory_order_acquire);
+    }
+    return submitted - finished;
+}
+
+void Scheduler::Bump(Worker& worker, int stat)
+{
+    worker.stats[stat].store(worker.stats[stat].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+std::vector<Scheduler::WorkerStats> Scheduler::getStats() const
+{
+    std::vector<WorkerStats> stats;
+    for (auto& it : m_workers)
+    {
+        WorkerStats st;
+        st.runs = it->stats[STAT_RUNS].load(std::memory_order_relaxed);
+        st.local = it->stats[STAT_LOCAL].load(std::memory_order_relaxed);
+        st.injected = it->stats[STAT_INJECTED].load(std::memory_order_relaxed);
+        st.steals = it->stats[STAT_STEALS].load(std::memory_order_relaxed);
+        st.parks = it->stats[STAT_PARKS].load(std::memory_order_relaxed);
+        stats.push_back(st);
+    }
+    return stats;
+}
+
+std::string Scheduler::dumpStats() const
+{
+    std::string out;
+    char buf[256];
+    std::vector<WorkerStats> stats = getStats();
+    for (size_t i = 0; i < stats.size(); ++i)
+    {
+        snprintf(buf, sizeof(buf), "%s worker %zu: runs=%llu local=%llu injected=%llu steals=%llu parks=%llu\n",
+                 m_name.c_str(), i, (unsigned long long)stats[i].runs, (unsigned long long)stats[i].local,
+                 (unsigned long long)stats[i].injected, (unsigned long long)stats[i].steals,
+                 (unsigned long long)stats[i].parks);
+        out.append(buf);
+    }
+    return out;
+}
+
+Scheduler* Scheduler::GetThis()
+{
+    return t_scheduler;
+}
+
+int Scheduler::GetWorkerIndex()
+{
+    return t_worker_idx;
+}
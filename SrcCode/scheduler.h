@@ -0,0 +1,155 @@
+#ifndef __ZY_SCHEDULER_H__
+#define __ZY_SCHEDULER_H__
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "fiber.h"
+#include "ringbuffer.h"
+#include "work_steal_deque.h"
+
+// 工作窃取的N:M协程调度器
+// 固定数量的工作线程运行任意数量的协程，没有全局的运行队列锁：
+//     每个工作线程一个Chase-Lev双端队列，工作线程里产生的任务压进自己的队列底部，
+//     自己从底部取，空了再随机挑别的线程从顶部偷；
+//     非工作线程提交的任务放进共享的无锁注入队列(RingBuffer)，工作线程定期检查
+// 找不到任务的工作线程先有限次地重试/窃取(查找状态)，仍然没有才在futex上休眠；
+// 提交任务时已经有线程在查找、或者叫醒的线程还没开始查找时不重复唤醒，
+// 被叫醒的线程找到任务后如果它是最后一个查找的线程，再接力叫醒下一个
+//
+// 任务是一个回调或者一个协程；回调会放进工作线程缓存的协程里运行，
+// 所以任务里可以调用Scheduler::Yield让出，之后可能在别的工作线程上继续执行
+// 协程调用Fiber::Yield让出时调度器不会再管它，由持有者在合适的时候重新schedule
+//
+// 每个工作线程统计自己执行、窃取、休眠的次数，通过getStats/dumpStats查看
+//
+// 用法：
+//     Scheduler::ptr sc(new Scheduler(4, "worker"));
+//     sc->start();
+//     sc->schedule([]() { ... });
+//     sc->stop();        // 等所有任务执行完后回收工作线程
+class Scheduler
+{
+public:
+    typedef std::shared_ptr<Scheduler> ptr;
+
+    // 一个工作线程的计数
+    struct WorkerStats
+    {
+        uint64_t runs = 0;                             // 执行(包括继续执行)任务的次数
+        uint64_t local = 0;                            // 从自己的队列取到的任务数
+        uint64_t injected = 0;                         // 从注入队列取到的任务数
+        uint64_t steals = 0;                           // 从别的工作线程偷到的任务数
+        uint64_t parks = 0;                            // 找不到任务、进入idle休眠的次数
+    };
+
+    // threads为0时使用硬件线程数
+    explicit Scheduler(size_t threads = 0, const std::string& name = "scheduler");
+    virtual ~Scheduler();
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    const std::string& getName() const { return m_name; }
+    size_t getThreadCount() const { return m_workers.size(); }
+
+    // 把第i个工作线程绑定到cpus[i % cpus.size()]，必须在start之前调用，空表示不绑定
+    void setCpuAffinity(const std::vector<int>& cpus) { m_cpus = cpus; }
+
+    // 启动工作线程，重复调用或者已经停止时返回false
+    bool start();
+
+    // 不再接受新的外部任务，等已有的任务(包括它们产生的任务)全部执行完后回收工作线程
+    // 不能在工作线程里调用，可以重复调用
+    void stop();
+
+    // 提交任务，调度器已经停止时返回false
+    // 协程必须是INIT或READY状态，同一个协程不能同时提交两次
+    bool schedule(std::function<void()> cb);
+    bool schedule(Fiber::ptr fiber);
+
+    std::vector<WorkerStats> getStats() const;
+    std::string dumpStats() const;
+
+    // 当前线程所属的调度器，不是工作线程时为空
+    static Scheduler* GetThis();
+    // 当前工作线程的序号，不是工作线程时为-1
+    static int GetWorkerIndex();
+
+    // 当前协程让出执行权并重新排队，稍后继续执行(可能换一个工作线程)
+    // 不在调度器的协程中时什么也不做
+    static void Yield();
+
+protected:
+    // 工作线程找不到任务时调用，默认在futex上休眠，直到tickle或者超时
+    // 返回前不需要确认真的有任务，调用者会重新检查
+    virtual void idle();
+    // 唤醒一个休眠的工作线程，停止时和notify判定需要唤醒时调用
+    virtual void tickle();
+    // 工作线程可以退出的条件，子类可以追加自己的条件(例如还有等待中的IO事件)
+    virtual bool stopping();
+    // 工作线程开始调度之前在该线程上调用一次，子类可以在这里设置线程局部的状态
+    virtual void onWorkerStart() {}
+
+    // 有新任务时调用，已经有线程在查找或者正在被叫醒时直接返回，否则调用tickle
+    void notify();
+    // 是否还有没取走的任务，近似值
+    bool hasWork() const;
+    // 正在休眠的工作线程数
+    uint32_t getSleepers() const { return m_sleepers.load(std::memory_order_seq_cst); }
+
+private:
+    struct Task
+    {
+        Fiber::ptr fiber;
+        std::function<void()> cb;
+    };
+
+    struct Worker
+    {
+        Worker() : deque(256) {}
+
+        WorkStealingDeque<Task*> deque;
+        std::thread thread;
+        Fiber::ptr cbFiber;                            // 运行回调任务的协程，结束后复用
+        uint64_t rand = 0;                             // 挑选窃取目标用的随机数状态
+
+        // 以下只由本工作线程写，其他线程读
+        std::atomic<uint64_t> submitted{0};            // 本线程提交的任务数
+        std::atomic<uint64_t> finished{0};             // 本线程执行完一次的任务数
+        std::atomic<uint64_t> stats[5] = {};           // 按WorkerStats的字段顺序
+    };
+
+    enum { STAT_RUNS, STAT_LOCAL, STAT_INJECTED, STAT_STEALS, STAT_PARKS };
+    enum { INJECT_CAPACITY = 65536, INJECT_INTERVAL = 61, SPIN_ROUNDS = 32 };
+
+    bool submit(Task* task);
+    void run(size_t idx);
+    Task* next(Worker& worker, uint64_t tick);
+    Task* search(Worker& worker, uint64_t tick, bool counted);
+    Task* steal(Worker& worker);
+    void execute(Worker& worker, Task* task);
+    uint64_t pending() const;                          // 已提交还没执行完的任务数
+    static void Bump(Worker& worker, int stat);
+
+private:
+    std::string m_name;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<int> m_cpus;
+    RingBuffer<Task*> m_inject;                        // 非工作线程提交的任务
+    std::atomic<uint64_t> m_injected;                  // 提交到注入队列的任务数
+
+    std::atomic<uint32_t> m_epoch;                     // futex字，每次唤醒加一
+    std::atomic<uint32_t> m_sleepers;
+    std::atomic<uint32_t> m_searching;                 // 处于查找状态的工作线程数
+    std::atomic<bool> m_waking;                        // 已经发出唤醒，被叫醒的线程还没开始查找
+    std::atomic<bool> m_started;
+    std::atomic<bool> m_stopping;
+    bool m_stopped = false;
+};
+
+#endif
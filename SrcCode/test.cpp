@@ -1,50 +1,257 @@
-#include <iostream>
-
-#include "log.h"
-
-int main()
-{
-    // LogEvent::ptr event(new LogEvent(
-    //     LogLevel::INFO,		//日志级别
-    //     __FILE__, 			//文件名称
-    //     __LINE__, 		    //行号
-    //     1234567, 			//程序运行时间
-    //     2,					//线程ID
-    //     3, 					//协程ID
-    //     time(0),				//当前时间
-    //     "root"
-    // ));
-    // Logger::ptr lg(new Logger("zls"));
-
-    // LogEventWrap(lg, event);
-    // lg->log(event);
-
-    // lg->setLevel(LogLevel::UNKNOW);
-
-    // // 添加输出地
-    // LogAppender::ptr stdout(new StdoutLogAppender());
-    // LogAppender::ptr file(new FileAppender("log.txt"));
-
-    // event->getSs() << "heihei";
-    
-    // lg->addAppender(stdout);
-
-    // lg->log(event);
-
-    // LogFormatter::ptr formatter(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"));
-
-    // cout << formatter->format(event) << endl;
-
-
-    // Logger::ptr lg(new Logger("zls"));
-
-    // LOG_LEVEL_CPP(lg, LogLevel::DEBUG) << "hello mylog";
-
-    // LOG_LEVEL_C(lg, LogLevel::INFO, "hello mylog");
-
-    
-    LOG_LEVEL_CPP(Manager::getSingletion()->getRoot(), LogLevel::INFO) << "last test";
-
-
-    return 0;
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "fiber.h"
+#include "log.h"
+#include "scheduler.h"
+#include "timer.h"
+
+// 运行时的正确性检查，失败时打印原因并返回false
+
+// 协程里打的日志带上协程号，回到线程上之后协程号为0
+static bool TestFiberId()
+{
+    class FiberIdAppender : public LogAppender
+    {
+    public:
+        explicit FiberIdAppender(uint32_t& id) : m_id(id) {}
+        virtual void log(const LogEvent::ptr& event) override { m_id = event->getFiberId(); }
+    private:
+        uint32_t& m_id;
+    };
+    uint32_t logged = 0;
+    Logger::ptr lg(new Logger("test_fiber", LogLevel::INFO));
+    lg->addAppender(LogAppender::ptr(new FiberIdAppender(logged)));
+    Fiber::ptr fiber(new Fiber([&]() {
+        LOG_INFO(lg, "in fiber");
+        Fiber::Yield();
+    }));
+    fiber->resume();
+    if (logged == 0 || logged != fiber->getId() || Fiber::GetFiberId() != 0)
+    {
+        printf("fiber id mismatch: logged %u, expected %u\n", logged, fiber->getId());
+        return false;
+    }
+    fiber->resume();
+    if (!fiber->isFinished() || fiber->resume())
+    {
+        printf("fiber not finished after second resume\n");
+        return false;
+    }
+    return true;
+}
+
+// 外部扇出、任务内递归产生子任务都要执行完；稀疏提交时休眠的工作线程必须被叫醒
+static bool TestScheduler()
+{
+    for (size_t threads : {1, 4})
+    {
+        const size_t total = 100000;
+        std::atomic<uint64_t> done(0);
+        Scheduler::ptr sc(new Scheduler(threads, "test_sc"));
+        sc->start();
+        std::function<void(size_t)> spawn = [&](size_t n) {
+            done.fetch_add(1, std::memory_order_relaxed);
+            size_t left = (n - 1) / 2, right = n - 1 - left;
+            if (right > 0)
+            {
+                sc->schedule([&spawn, right]() { spawn(right); });
+            }
+            if (left > 0)
+            {
+                sc->schedule([&spawn, left]() { spawn(left); });
+            }
+        };
+        for (size_t i = 0; i < total; ++i)
+        {
+            sc->schedule([&]() { done.fetch_add(1, std::memory_order_relaxed); });
+        }
+        sc->schedule([&]() { spawn(total); });
+
+        for (int i = 0; i < 1000; ++i)
+        {
+            std::atomic<bool> ran(false);
+            sc->schedule([&]() {
+                Scheduler::Yield();
+                ran.store(true);
+            });
+            auto begin = std::chrono::steady_clock::now();
+            while (!ran.load())
+            {
+                if (std::chrono::steady_clock::now() - begin > std::chrono::seconds(5))
+                {
+                    printf("scheduler x%zu: task %d not run within 5s\n", threads, i);
+                    return false;
+                }
+                std::this_thread::yield();
+            }
+        }
+        sc->stop();
+        if (done.load() != total * 2 || sc->schedule([]() {}))
+        {
+            printf("scheduler x%zu: ran %llu tasks, expected %zu\n", threads,
+                   (unsigned long long)done.load(), total * 2);
+            return false;
+        }
+    }
+    return true;
+}
+
+// 时间轮：随机间隔覆盖几层的下放，检查不早到、不晚到、取消的不触发；循环定时器；管理器析构后的定时器
+static bool TestTimerWheel()
+{
+    const size_t total = 20000;
+    const uint64_t span = 100000;
+    const uint64_t step = 7;
+    std::mt19937_64 rng(12345);
+    std::vector<uint64_t> delays(total), fired(total, 0);
+    std::vector<Timer::ptr> cancelled;
+    uint64_t now = 0;
+    bool ok = true;
+    {
+        TimerManager tm;
+        uint64_t before = TimerManager::NowMs();
+        for (size_t i = 0; i < total; ++i)
+        {
+            delays[i] = 1 + rng() % span;
+            Timer::ptr timer = tm.addTimer(delays[i], [&fired, &now, i]() { fired[i] = now; });
+            if (i % 10 == 0)
+            {
+                cancelled.push_back(std::move(timer));
+            }
+        }
+        uint64_t after = TimerManager::NowMs();
+        for (auto& it : cancelled)
+        {
+            if (!it->cancel() || it->cancel())
+            {
+                printf("timer cancel returned wrong result\n");
+                ok = false;
+            }
+        }
+
+        size_t expired = 0;
+        std::vector<std::function<void()>> cbs;
+        for (now = after; tm.hasTimer(); now += step)
+        {
+            cbs.clear();
+            tm.listExpiredUntil(cbs, now);
+            for (auto& it : cbs)
+            {
+                it();
+            }
+            expired += cbs.size();
+        }
+        if (expired != total - total / 10 || tm.getTimerCount() != 0)
+        {
+            printf("timer wheel expired %zu, expected %zu\n", expired, total - total / 10);
+            ok = false;
+        }
+        for (size_t i = 0; i < total && ok; ++i)
+        {
+            bool was_cancelled = i % 10 == 0;
+            if (was_cancelled != (fired[i] == 0)
+                || (!was_cancelled && (fired[i] < before + delays[i] || fired[i] > after + delays[i] + step)))
+            {
+                printf("timer %zu delay %llu fired at %llu, added in [%llu, %llu]\n", i,
+                       (unsigned long long)delays[i], (unsigned long long)fired[i],
+                       (unsigned long long)before, (unsigned long long)after);
+                ok = false;
+            }
+        }
+
+    }
+    {
+        // 循环定时器每5ms一次，逐毫秒推进50ms；上面的时间轮已经推进到很远，换一个新的
+        TimerManager tm;
+        int count = 0;
+        Timer::ptr recurring = tm.addTimer(5, [&count]() { ++count; }, true);
+        uint64_t start = TimerManager::NowMs();
+        std::vector<std::function<void()>> cbs;
+        for (now = start; now <= start + 50; ++now)
+        {
+            cbs.clear();
+            tm.listExpiredUntil(cbs, now);
+            for (auto& it : cbs)
+            {
+                it();
+            }
+        }
+        if (count < 9 || count > 10)
+        {
+            printf("recurring timer fired %d times in 50ms, expected 9-10\n", count);
+            ok = false;
+        }
+        cancelled.push_back(tm.addTimer(1000, []() {}));
+        cancelled.push_back(recurring);
+    }
+    // 管理器已经析构，还拿着的定时器不能再操作时间轮
+    for (auto& it : cancelled)
+    {
+        if (it->cancel() || it->refresh() || it->reset(10, true))
+        {
+            printf("timer still usable after its manager was destroyed\n");
+            ok = false;
+            break;
+        }
+    }
+    return ok;
+}
+
+int main()
+{
+    int failures = 0;
+    failures += !TestFiberId();
+    failures += !TestScheduler();
+    failures += !TestTimerWheel();
+    printf("runtime checks: %d failed\n", failures);
+
+    // LogEvent::ptr event(new LogEvent(
+    //     LogLevel::INFO,		//日志级别
+    //     __FILE__, 			//文件名称
+    //     __LINE__, 		    //行号
+    //     1234567, 			//程序运行时间
+    //     2,					//线程ID
+    //     3, 					//协程ID
+    //     time(0),				//当前时间
+    //     "root"
+    // ));
+    // Logger::ptr lg(new Logger("zls"));
+
+    // LogEventWrap(lg, event);
+    // lg->log(event);
+
+    // lg->setLevel(LogLevel::UNKNOW);
+
+    // // 添加输出地
+    // LogAppender::ptr stdout(new StdoutLogAppender());
+    // LogAppender::ptr file(new FileAppender("log.txt"));
+
+    // event->getSs() << "heihei";
+    
+    // lg->addAppender(stdout);
+
+    // lg->log(event);
+
+    // LogFormatter::ptr formatter(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"));
+
+    // cout << formatter->format(event) << endl;
+
+
+    // Logger::ptr lg(new Logger("zls"));
+
+    // LOG_LEVEL_CPP(lg, LogLevel::DEBUG) << "hello mylog";
+
+    // LOG_LEVEL_C(lg, LogLevel::INFO, "hello mylog");
+
+    
+    LOG_LEVEL_CPP(Manager::getSingletion()->getRoot(), LogLevel::INFO) << "last test";
+
+
+    return failures != 0;
 }
\ No newline at end of file
@@ -0,0 +1,27 @@
+#include "thread.h"
+
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+void ThreadInfo::Init()
+{
+    t_data.tid = syscall(SYS_gettid);
+    if (t_data.name[0] == '\0')
+    {
+        pthread_getname_np(pthread_self(), t_data.name, sizeof(t_data.name));
+    }
+}
+
+void ThreadInfo::SetThreadName(const std::string& name)
+{
+    if (t_data.tid == 0)
+    {
+        Init();
+    }
+    size_t len = name.size() < NAME_SIZE - 1 ? name.size() : NAME_SIZE - 1;
+    memcpy(t_data.name, name.data(), len);
+    t_data.name[len] = '\0';
+    ++t_data.name_version;
+    pthread_setname_np(pthread_self(), t_data.name);
+}
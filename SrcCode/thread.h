@@ -0,0 +1,60 @@
+#ifndef __ZY_THREAD_H__
+#define __ZY_THREAD_H__
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// 当前线程的身份信息：线程号、线程名、当前协程号
+// 全部放在线程局部存储中，每个线程只在第一次使用时调用一次gettid和pthread_getname_np，
+// 之后写日志时读取它们只是一次内存访问
+class ThreadInfo
+{
+public:
+    enum { NAME_SIZE = 16 };                           // 与pthread线程名的长度限制一致，包含结尾的0
+
+    static uint32_t GetThreadId()
+    {
+        if (t_data.tid == 0)
+        {
+            Init();
+        }
+        return t_data.tid;
+    }
+
+    // 线程名，不超过15个字符
+    static const char* GetThreadName()
+    {
+        if (t_data.tid == 0)
+        {
+            Init();
+        }
+        return t_data.name;
+    }
+
+    // 同时设置内核中的线程名，超过15个字符的部分被截掉
+    static void SetThreadName(const std::string& name);
+
+    // 线程名每修改一次加一，用于判断缓存的线程名是否过期
+    static uint32_t GetNameVersion() { return t_data.name_version; }
+
+    // 当前运行的协程号，不在协程中时为0
+    static uint32_t GetFiberId() { return t_data.fiber_id; }
+    static void SetFiberId(uint32_t id) { t_data.fiber_id = id; }
+
+private:
+    static void Init();
+
+    // 只包含平凡类型，常量初始化，访问时不需要经过线程局部变量的初始化包装函数
+    struct Data
+    {
+        uint32_t tid;
+        uint32_t fiber_id;
+        uint32_t name_version;
+        char name[NAME_SIZE];
+    };
+
+    static inline thread_local Data t_data = { 0, 0, 0, { 0 } };
+};
+
+#endif
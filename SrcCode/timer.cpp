@@ -0,0 +1,344 @@
+#include "timer.h"
+
+#include <algorithm>
+
+Timer::Timer(Private, uint64_t ms, std::function<void()> cb, bool recurring, std::shared_ptr<TimerLock> lock)
+    : m_lock(std::move(lock)), m_interval(ms), m_recurring(recurring), m_cb(std::move(cb))
+{
+}
+
+bool Timer::cancel()
+{
+    // 回调和自身的引用放到锁外释放，回调捕获的对象析构时可能再操作定时器
+    Timer::ptr self;
+    std::function<void()> cb;
+    {
+        std::lock_guard<std::mutex> lock(m_lock->mutex);
+        TimerManager* manager = m_lock->manager;
+        if (!manager || !m_self)
+        {
+            return false;
+        }
+        manager->unlink(this);
+        --manager->m_count;
+        self.swap(m_self);
+        cb.swap(m_cb);
+    }
+    return true;
+}
+
+bool Timer::refresh()
+{
+    return reset(m_interval, true);
+}
+
+bool Timer::reset(uint64_t ms, bool from_now)
+{
+    TimerManager* manager = nullptr;
+    bool notify = false;
+    {
+        std::lock_guard<std::mutex> lock(m_lock->mutex);
+        manager = m_lock->manager;
+        if (!manager || !m_self)
+        {
+            return false;
+        }
+        manager->unlink(this);
+        uint64_t start = from_now ? TimerManager::NowMs() : m_expire - m_interval;
+        m_interval = ms;
+        m_expire = start + ms;
+        notify = manager->insert(this);
+    }
+    if (notify)
+    {
+        manager->onTimerInsertedAtFront();
+    }
+    return true;
+}
+
+TimerManager::TimerManager()
+    : m_lock(std::make_shared<TimerLock>()), m_current(std::max<uint64_t>(NowMs(), 1))
+{
+    m_lock->manager = this;
+}
+
+TimerManager::~TimerManager()
+{
+    // 脱离还被外面持有的定时器，并打断定时器自己持有自己的引用
+    std::vector<Timer::ptr> released;
+    std::lock_guard<std::mutex> lock(m_lock->mutex);
+    m_lock->manager = nullptr;
+    for (int i = 0; i < TOTAL_SLOTS; ++i)
+    {
+        for (auto& it : m_slots[i])
+        {
+            released.push_back(std::move(it.timer->m_self));
+        }
+        m_slots[i].clear();
+    }
+}
+
+Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring)
+{
+    Timer::ptr timer = std::make_shared<Timer>(Timer::Private(), ms, std::move(cb), recurring, m_lock);
+    bool notify = false;
+    {
+        std::lock_guard<std::mutex> lock(m_lock->mutex);
+        uint64_t now = NowMs();
+        if (m_count == 0)
+        {
+            // 时间轮是空的，直接拨到现在，免得之后一格一格地追
+            m_current = std::max(m_current, now);
+        }
+        timer->m_expire = now + ms;
+        timer->m_self = timer;
+        ++m_count;
+        notify = insert(timer.get());
+    }
+    if (notify)
+    {
+        onTimerInsertedAtFront();
+    }
+    return timer;
+}
+
+Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> cond,
+                                           bool recurring)
+{
+    return addTimer(ms, [cond, cb]() {
+        if (cond.lock())
+        {
+            cb();
+        }
+    }, recurring);
+}
+
+bool TimerManager::insert(Timer* timer)
+{
+    place(timer, timer->m_expire);
+    if (timer->m_expire < m_waitDeadline)
+    {
+        m_waitDeadline = timer->m_expire;
+        return true;
+    }
+    return false;
+}
+
+void TimerManager::place(Timer* timer, uint64_t expire)
+{
+    uint64_t at = std::max(expire, m_current);
+    uint64_t delta = at - m_current;
+    if (delta > MAX_DELTA)
+    {
+        // 超出最上层的范围，先放在最远处，下放时会按真实的到期时刻重新计算
+        delta = MAX_DELTA;
+        at = m_current + delta;
+    }
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (1ULL << Shift(level + 1)))
+    {
+        ++level;
+    }
+    int slot = (at >> Shift(level)) & (Slots(level) - 1);
+    int idx = Base(level) + slot;
+    std::vector<Entry>& entries = m_slots[idx];
+    timer->m_level = level;
+    timer->m_slot = slot;
+    timer->m_index = entries.size();
+    entries.push_back(Entry{expire, timer});
+    m_bitmap[idx / 64] |= 1ULL << (idx % 64);
+}
+
+void TimerManager::unlink(Timer* timer)
+{
+    int idx = Base(timer->m_level) + timer->m_slot;
+    std::vector<Entry>& entries = m_slots[idx];
+    // 最后一项挪到空出的位置
+    Entry last = entries.back();
+    entries[timer->m_index] = last;
+    last.timer->m_index = timer->m_index;
+    entries.pop_back();
+    if (entries.empty())
+    {
+        m_bitmap[idx / 64] &= ~(1ULL << (idx % 64));
+    }
+}
+
+int TimerManager::findNext(int level, int from) const
+{
+    int base = Base(level);
+    int slots = Slots(level);
+    // 槽数都是64的倍数，每层占整数个字，逐字查找
+    for (int dist = 0; dist < slots; )
+    {
+        int pos = (from + dist) & (slots - 1);
+        int bit = (base + pos) % 64;
+        uint64_t word = m_bitmap[(base + pos) / 64] >> bit;
+        if (word)
+        {
+            int d = dist + __builtin_ctzll(word);
+            return d < slots ? d : -1;
+        }
+        dist += 64 - bit;
+    }
+    return -1;
+}
+
+uint64_t TimerManager::nextDeadline() const
+{
+    uint64_t best = ~0ULL;
+    int d = findNext(0, m_current & (ROOT_SLOTS - 1));
+    if (d >= 0)
+    {
+        best = m_current + d;
+    }
+    // 上层的槽在下放的时刻就要处理，它里面的定时器都不早于这个时刻
+    // 从最后处理过的时刻算起，m_current正好在边界上时它自己的下放也要算进来
+    for (int level = 1; level < LEVELS; ++level)
+    {
+        uint64_t cur = (m_current - 1) >> Shift(level);
+        d = findNext(level, (cur + 1) & (LEVEL_SLOTS - 1));
+        if (d >= 0)
+        {
+            best = std::min(best, (cur + d + 1) << Shift(level));
+        }
+    }
+    return best;
+}
+
+void TimerManager::cascade(int level)
+{
+    int idx = Base(level) + ((m_current >> Shift(level)) & (LEVEL_SLOTS - 1));
+    m_spare.swap(m_slots[idx]);
+    m_bitmap[idx / 64] &= ~(1ULL << (idx % 64));
+    size_t n = m_spare.size();
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (i + PREFETCH_DISTANCE < n)
+        {
+            // 去处由项里的到期时刻决定，定时器本身只写不读
+            __builtin_prefetch(m_spare[i + PREFETCH_DISTANCE].timer, 1);
+        }
+        place(m_spare[i].timer, m_spare[i].expire);
+    }
+    recycle(idx);
+}
+
+void TimerManager::recycle(int idx)
+{
+    // 数组还给槽，保留容量，之后不用再分配
+    // 在锁内频繁分配大块内存时，glibc会先合并所有刚释放的定时器，把它们重新从内存里读一遍
+    // 最上层暂放的定时器可能又放回同一个槽，这时不交换
+    m_spare.clear();
+    if (m_slots[idx].empty())
+    {
+        m_slots[idx].swap(m_spare);
+    }
+}
+
+void TimerManager::advance(uint64_t now, std::vector<std::function<void()>>& cbs)
+{
+    while (m_current <= now)
+    {
+        // 中间没有要处理的槽时直接跳过去
+        uint64_t next = nextDeadline();
+        if (next > now)
+        {
+            m_current = now + 1;
+            break;
+        }
+        m_current = next;
+
+        // 第0层转完一圈，逐层检查是否需要把上层的槽下放
+        if ((m_current & (ROOT_SLOTS - 1)) == 0)
+        {
+            for (int level = 1; level < LEVELS; ++level)
+            {
+                cascade(level);
+                if (((m_current >> Shift(level)) & (LEVEL_SLOTS - 1)) != 0)
+                {
+                    break;
+                }
+            }
+        }
+
+        int idx = m_current & (ROOT_SLOTS - 1);
+        m_spare.swap(m_slots[idx]);
+        m_bitmap[idx / 64] &= ~(1ULL << (idx % 64));
+        size_t n = m_spare.size();
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (i + PREFETCH_DISTANCE < n)
+            {
+                // 定时器在内存中是分散的，提前取后面的
+                __builtin_prefetch(m_spare[i + PREFETCH_DISTANCE].timer, 1);
+            }
+            Timer* timer = m_spare[i].timer;
+            if (m_spare[i].expire > m_current)
+            {
+                // 按最远距离暂放的定时器，还没有真正到期
+                place(timer, m_spare[i].expire);
+                continue;
+            }
+            if (timer->m_recurring)
+            {
+                cbs.push_back(timer->m_cb);
+                // 落后时从现在开始计时，不补发错过的次数
+                timer->m_expire = now + std::max<uint64_t>(timer->m_interval, 1);
+                insert(timer);
+            }
+            else
+            {
+                cbs.push_back(std::move(timer->m_cb));
+                timer->m_cb = nullptr;
+                --m_count;
+                // 回调已经移走，定时器本身的析构没有副作用，直接在锁内释放，趁它还在缓存里
+                timer->m_self.reset();
+            }
+        }
+        recycle(idx);
+        ++m_current;
+    }
+}
+
+uint64_t TimerManager::getNextTimeout()
+{
+    std::lock_guard<std::mutex> lock(m_lock->mutex);
+    uint64_t deadline = nextDeadline();
+    m_waitDeadline = deadline;
+    if (deadline == ~0ULL)
+    {
+        return NO_TIMEOUT;
+    }
+    uint64_t now = NowMs();
+    return deadline > now ? deadline - now : 0;
+}
+
+void TimerManager::listExpired(std::vector<std::function<void()>>& cbs)
+{
+    listExpiredUntil(cbs, NowMs());
+}
+
+void TimerManager::listExpiredUntil(std::vector<std::function<void()>>& cbs, uint64_t now_ms)
+{
+    std::lock_guard<std::mutex> lock(m_lock->mutex);
+    if (m_count == 0 || now_ms < m_current)
+    {
+        return;
+    }
+    advance(now_ms, cbs);
+    // 等待的线程醒来处理过了，之后插入的定时器按新的最早时刻判断是否需要通知
+    m_waitDeadline = nextDeadline();
+}
+
+bool TimerManager::hasTimer()
+{
+    std::lock_guard<std::mutex> lock(m_lock->mutex);
+    return m_count != 0;
+}
+
+size_t TimerManager::getTimerCount()
+{
+    std::lock_guard<std::mutex> lock(m_lock->mutex);
+    return m_count;
+}
@@ -0,0 +1,157 @@
+#ifndef __ZY_TIMER_H__
+#define __ZY_TIMER_H__
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "clock.h"
+
+class TimerManager;
+
+// 时间轮的锁，管理器和它创建的定时器共同持有
+// 管理器析构时在锁内把manager置空，调用者拿着的Timer::ptr比管理器活得久时，
+// cancel/refresh/reset照常加锁，看到已经脱离管理器后返回false
+struct TimerLock
+{
+    std::mutex mutex;
+    TimerManager* manager = nullptr;
+};
+
+// 定时器，由TimerManager::addTimer创建
+// 挂在时间轮上时由时间轮持有一份引用，调用者不保存返回值也会照常触发
+class Timer : public std::enable_shared_from_this<Timer>
+{
+friend class TimerManager;
+private:
+    // 只有TimerManager能构造，构造函数公开只是为了让make_shared把定时器和引用计数放在一次分配里
+    struct Private
+    {
+        explicit Private() = default;
+    };
+
+public:
+    typedef std::shared_ptr<Timer> ptr;
+
+    Timer(Private, uint64_t ms, std::function<void()> cb, bool recurring, std::shared_ptr<TimerLock> lock);
+
+    // 取消定时器，已经触发(非循环)、已经取消或者管理器已经析构时返回false
+    bool cancel();
+    // 从现在起重新计时，间隔不变
+    bool refresh();
+    // 修改间隔，from_now为真时从现在开始计时，否则从上一次的起点开始计时
+    bool reset(uint64_t ms, bool from_now);
+
+    uint64_t getInterval() const { return m_interval; }
+    bool isRecurring() const { return m_recurring; }
+
+private:
+    std::shared_ptr<TimerLock> m_lock;
+    uint64_t m_interval;                               // 间隔(毫秒)
+    uint64_t m_expire = 0;                             // 到期时刻(毫秒)
+    bool m_recurring;
+    std::function<void()> m_cb;
+
+    // 在时间轮上的位置(层、槽、槽内下标)，受m_lock保护
+    uint16_t m_level = 0;
+    uint16_t m_slot = 0;
+    uint32_t m_index = 0;
+    Timer::ptr m_self;                                 // 挂在时间轮上时指向自己，摘下时释放
+};
+
+// 定时器管理，分层时间轮实现
+// 精度1毫秒，第0层256个槽，每槽1毫秒；往上四层各64个槽，每槽是下一层一圈的时长：
+//     第0层 256ms，第1层 16.4s，第2层 17.5min，第3层 18.6h，第4层 49.7天
+// 定时器按剩余时间放进能容纳它的最低一层，上层的槽在下层转完一圈时整体下放(重新插入)，
+// 插入和取消都是O(1)：槽是连续的数组，取消时用最后一项填补空位；超过49.7天的定时器按49.7天处理，到期时再次下放
+// 每层一张槽位位图，计算下一次需要醒来的时刻只需要在每层找下一个非空的槽
+// 槽里的每一项带着到期时刻，下放时不用读定时器本身就能决定去处；遍历槽时按下标提前预取后面的定时器，
+// 不像链表那样每一步都要等上一个节点从内存读进来
+//
+// 时间取自Clock(TSC)，换算成启动以来的毫秒数，不受系统时间调整影响
+// 多线程安全，所有操作在一把锁内完成；锁放在和定时器共享的TimerLock里，管理器析构后定时器仍可以安全地调用
+class TimerManager
+{
+friend class Timer;
+public:
+    static constexpr uint64_t NO_TIMEOUT = ~0ULL;
+
+    TimerManager();
+    virtual ~TimerManager();
+
+    TimerManager(const TimerManager&) = delete;
+    TimerManager& operator=(const TimerManager&) = delete;
+
+    // ms毫秒后调用cb，recurring为真时每隔ms毫秒调用一次
+    Timer::ptr addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false);
+    // 同上，但触发时cond已经销毁则不调用cb，用于回调依赖的对象可能先被释放的场合
+    Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> cond,
+                                 bool recurring = false);
+
+    // 距离下一次需要处理时间轮的毫秒数，没有定时器时返回NO_TIMEOUT
+    // 可能早于最近的定时器到期(上层的槽需要下放)，但不会晚于它
+    uint64_t getNextTimeout();
+
+    // 推进时间轮到当前时刻，取出到期定时器的回调，循环定时器重新计时
+    void listExpired(std::vector<std::function<void()>>& cbs);
+    // 同上，推进到指定的时刻(毫秒，与NowMs同一基准)，用于测试
+    void listExpiredUntil(std::vector<std::function<void()>>& cbs, uint64_t now_ms);
+
+    bool hasTimer();
+    size_t getTimerCount();
+
+    // 时间轮使用的时钟，启动以来的毫秒数
+    static uint64_t NowMs() { return Clock::ToNanoseconds(Clock::Now()) / 1000000; }
+
+protected:
+    // 新插入的定时器比正在等待的最早时刻还早，需要唤醒等待的线程重新计算超时
+    // 在锁外调用
+    virtual void onTimerInsertedAtFront() {}
+
+private:
+    enum
+    {
+        LEVELS = 5,
+        ROOT_BITS = 8,
+        LEVEL_BITS = 6,
+        ROOT_SLOTS = 1 << ROOT_BITS,
+        LEVEL_SLOTS = 1 << LEVEL_BITS,
+        TOTAL_SLOTS = ROOT_SLOTS + (LEVELS - 1) * LEVEL_SLOTS,
+        PREFETCH_DISTANCE = 8
+    };
+
+    struct Entry
+    {
+        uint64_t expire;                               // 定时器的到期时刻，在最上层暂放时晚于槽对应的时刻
+        Timer* timer;
+    };
+
+    static constexpr uint64_t MAX_DELTA = (1ULL << (ROOT_BITS + (LEVELS - 1) * LEVEL_BITS)) - 1;
+
+    // 以下函数调用者持有m_lock->mutex
+    bool insert(Timer* timer);                         // 返回是否需要通知等待的线程
+    void place(Timer* timer, uint64_t expire);         // 按到期时刻放进对应的槽
+    void unlink(Timer* timer);
+    void cascade(int level);
+    void recycle(int idx);                             // 处理完一个槽，把m_spare换回去
+    void advance(uint64_t now, std::vector<std::function<void()>>& cbs);
+    uint64_t nextDeadline() const;                     // 下一次需要处理的时刻，没有定时器时为~0
+
+    static int Shift(int level) { return level == 0 ? 0 : ROOT_BITS + (level - 1) * LEVEL_BITS; }
+    static int Slots(int level) { return level == 0 ? ROOT_SLOTS : LEVEL_SLOTS; }
+    static int Base(int level) { return level == 0 ? 0 : ROOT_SLOTS + (level - 1) * LEVEL_SLOTS; }
+    // 在level层从from开始(包含)按环形顺序找第一个非空的槽，返回距离，没有时返回-1
+    int findNext(int level, int from) const;
+
+private:
+    std::shared_ptr<TimerLock> m_lock;
+    uint64_t m_current;                                // 下一个要处理的时刻(毫秒)
+    uint64_t m_waitDeadline = ~0ULL;                   // 等待线程正在等的时刻，由getNextTimeout记录
+    size_t m_count = 0;
+    std::vector<Entry> m_slots[TOTAL_SLOTS];           // 各层的槽依次排列
+    std::vector<Entry> m_spare;                        // 正在处理的槽和它交换出来，处理完再换回去
+    uint64_t m_bitmap[(TOTAL_SLOTS + 63) / 64] = {};   // 非空槽的位图
+};
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef __ZY_WORK_STEAL_DEQUE_H__
+#define __ZY_WORK_STEAL_DEQUE_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 工作窃取双端队列 (Chase-Lev，内存序按 Lê 等人在弱内存模型下的证明版本)
+// 所有者线程在底部push/pop，像栈一样后进先出，刚产生的任务还在缓存里；
+// 其他线程从顶部steal，先进先出，偷走的是最早放进去、通常也是最大的那块工作
+// 所有者的push/pop平时没有加锁指令，只有队列里只剩最后一个元素时才和窃取者CAS竞争
+//
+// T必须是可以放进std::atomic的平凡类型(一般是指针)，空值T()表示没有取到
+// 容量不够时翻倍扩容，旧数组保留到队列销毁，正在读旧数组的窃取者不受影响
+template<class T>
+class WorkStealingDeque
+{
+public:
+    // 初始容量会被向上取整为 2 的幂
+    explicit WorkStealingDeque(size_t capacity = 256)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        Array* array = new Array(size);
+        m_arrays.push_back(array);
+        m_array.store(array, std::memory_order_relaxed);
+        m_top.store(0, std::memory_order_relaxed);
+        m_bottom.store(0, std::memory_order_relaxed);
+    }
+
+    ~WorkStealingDeque()
+    {
+        for (Array* it : m_arrays)
+        {
+            delete it;
+        }
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // 只能由所有者调用
+    void push(T val)
+    {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_acquire);
+        Array* array = m_array.load(std::memory_order_relaxed);
+        if (b - t > (int64_t)array->mask)
+        {
+            array = grow(array, t, b);
+        }
+        array->put(b, val);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // 只能由所有者调用，队列空时返回T()
+    T pop()
+    {
+        int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        Array* array = m_array.load(std::memory_order_relaxed);
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        if (t > b)
+        {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return T();
+        }
+        T val = array->get(b);
+        if (t == b)
+        {
+            // 最后一个元素，和窃取者抢
+            if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                val = T();
+            }
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return val;
+    }
+
+    // 任意线程调用，队列空或者和别人竞争失败时返回T()
+    T steal()
+    {
+        int64_t t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = m_bottom.load(std::memory_order_acquire);
+        if (t >= b)
+        {
+            return T();
+        }
+        Array* array = m_array.load(std::memory_order_acquire);
+        T val = array->get(t);
+        if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            return T();
+        }
+        return val;
+    }
+
+    // 近似值，仅用于判断是否有活可干和统计
+    size_t size() const
+    {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        return b > t ? (size_t)(b - t) : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    size_t capacity() const { return m_array.load(std::memory_order_relaxed)->mask + 1; }
+
+private:
+    struct Array
+    {
+        explicit Array(size_t size) : mask(size - 1), cells(new std::atomic<T>[size]) {}
+        ~Array() { delete[] cells; }
+
+        T get(int64_t idx) const { return cells[idx & mask].load(std::memory_order_relaxed); }
+        void put(int64_t idx, T val) { cells[idx & mask].store(val, std::memory_order_relaxed); }
+
+        size_t mask;
+        std::atomic<T>* cells;
+    };
+
+    // 只有所有者会扩容，复制[t, b)之后原子地换上新数组
+    Array* grow(Array* old, int64_t t, int64_t b)
+    {
+        Array* array = new Array((old->mask + 1) * 2);
+        for (int64_t i = t; i < b; ++i)
+        {
+            array->put(i, old->get(i));
+        }
+        m_arrays.push_back(array);
+        m_array.store(array, std::memory_order_release);
+        return array;
+    }
+
+private:
+    // 顶部被窃取者修改，底部只有所有者修改，放在不同的缓存行
+    alignas(64) std::atomic<int64_t> m_top;
+    alignas(64) std::atomic<int64_t> m_bottom;
+    alignas(64) std::atomic<Array*> m_array;
+    std::vector<Array*> m_arrays;                      // 所有分配过的数组，只有所有者访问
+};
+
+#endif